@@ -250,7 +250,8 @@ void *alias_mapping_high(int cap, size_t mapsize, int protect, void *source)
   void *target = (void *)-1;
 
 #ifdef __x86_64__
-  /* use MAP_32BIT also for MAPPING_INIT_LOWRAM until simx86 is 64bit-safe */
+  /* use MAP_32BIT also for MAPPING_INIT_LOWRAM: the code generated by
+     simx86 on x86-64 addresses DOS memory with 32-bit pointers */
   if (cap & (MAPPING_DPMI|MAPPING_VGAEMU|MAPPING_INIT_LOWRAM)) {
     target = mmap(NULL, mapsize, protect,
 		MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
@@ -359,6 +359,7 @@ int main(int argc, char **argv, char * const *envp)
     iodev_init();		/* initialize devices */
     init_all_DOS_tables();	/* longest init function! needs to be optimized */
     dos2tty_init();
+    mfs_init();
     signal_init();              /* initialize sig's & sig handlers */
     if (config.exitearly) {
       dbug_printf("Leaving DOS before booting\n");
@@ -37,6 +37,8 @@
 #include "adlib.h"
 #include "dbadlib.h"
 #include <limits.h>
+#include <string.h>
+#include <errno.h>
 #include <pthread.h>
 #include <semaphore.h>
 
@@ -72,6 +74,25 @@ static pthread_t syn_thr;
 static sem_t syn_sem;
 static void *synth_thread(void *arg);
 
+/*
+ * $_opl_file: register writes are logged in the DOSBox raw OPL v2
+ * format (.dro), which test/bench/opl-bench and many players replay.
+ * A code byte indexes a table of the 122 OPL registers, bit 7 selects
+ * the second register set; two more codes encode delays in ms.
+ */
+#define DRO_HDR_SIZE 26
+#define DRO_SHORT_DELAY 0x7e	/* delay of val + 1 ms */
+#define DRO_LONG_DELAY 0x7f	/* delay of (val + 1) * 256 ms */
+static FILE *dro_file;
+static unsigned char dro_map[DRO_SHORT_DELAY];	/* code -> register */
+static unsigned char dro_code[256];		/* register -> code + 1 */
+static int dro_maplen;
+static int dro_index;		/* selected register incl. the set bit */
+static int dro_opl3;		/* OPL3 mode, enables the second set */
+static unsigned dro_pairs;
+static long long dro_start;
+static unsigned dro_ms;
+
 Bit8u adlib_io_read_base(ioport_t port)
 {
     Bit8u ret;
@@ -90,11 +111,125 @@ static Bit8u adlib_io_read(ioport_t port)
 
 static void opl3_update(void);
 
+static int dro_reg_valid(int reg)
+{
+    switch (reg & 0xe0) {
+    case 0x00:
+	return reg == 0x01 || reg == 0x04 || reg == 0x05 || reg == 0x08;
+    case 0x20: case 0x40: case 0x60: case 0x80: case 0xe0:
+	/* operator registers: slots 0-5, 8-13, 16-21 */
+	return (reg & 0x1f) < 0x16 && (reg & 7) < 6;
+    case 0xa0:
+	return (reg & 0x0f) < 9 || reg == 0xbd;
+    case 0xc0:
+	return reg < 0xc9;
+    }
+    return 0;
+}
+
+static void dro_put(int code, int val)
+{
+    unsigned char pair[2] = { code, val };
+
+    fwrite(pair, 2, 1, dro_file);
+    dro_pairs++;
+}
+
+static void dro_write_header(void)
+{
+    unsigned char h[DRO_HDR_SIZE];
+
+    memcpy(h, "DBRAWOPL", 8);
+    h[8] = 2;			/* version 2.0 */
+    h[9] = h[10] = h[11] = 0;
+    h[12] = dro_pairs;
+    h[13] = dro_pairs >> 8;
+    h[14] = dro_pairs >> 16;
+    h[15] = dro_pairs >> 24;
+    h[16] = dro_ms;
+    h[17] = dro_ms >> 8;
+    h[18] = dro_ms >> 16;
+    h[19] = dro_ms >> 24;
+    h[20] = 2;			/* OPL3 */
+    h[21] = 0;			/* interleaved commands */
+    h[22] = 0;			/* no compression */
+    h[23] = DRO_SHORT_DELAY;
+    h[24] = DRO_LONG_DELAY;
+    h[25] = dro_maplen;
+    fwrite(h, DRO_HDR_SIZE, 1, dro_file);
+    fwrite(dro_map, dro_maplen, 1, dro_file);
+}
+
+static void dro_open(const char *name)
+{
+    int reg;
+
+    dro_file = fopen(name, "w");
+    if (!dro_file) {
+	error("ADLIB: can't open %s: %s\n", name, strerror(errno));
+	return;
+    }
+    for (reg = 0; reg < 256; reg++) {
+	if (!dro_reg_valid(reg))
+	    continue;
+	dro_map[dro_maplen] = reg;
+	dro_code[reg] = ++dro_maplen;
+    }
+    /* header again with the lengths on close */
+    dro_write_header();
+    S_printf("Adlib: capturing OPL writes to %s\n", name);
+}
+
+static void dro_close(void)
+{
+    if (!dro_file)
+	return;
+    fseek(dro_file, 0, SEEK_SET);
+    dro_write_header();
+    fclose(dro_file);
+    dro_file = NULL;
+    S_printf("Adlib: captured %u ms of OPL writes\n", dro_ms);
+}
+
+static void dro_log(ioport_t port, Bit8u value, long long now)
+{
+    unsigned ms, delay;
+    int reg, code;
+
+    if (!(port & 1)) {
+	dro_index = value | ((port & 2) && (dro_opl3 || value == 5) ? 0x100 : 0);
+	return;
+    }
+    reg = dro_index & 0xff;
+    code = dro_code[reg];
+    /* timer registers don't affect the sound */
+    if (!code || (dro_index < 0x100 && reg >= 2 && reg <= 4))
+	return;
+    if (dro_index == 0x105)
+	dro_opl3 = value & 1;
+
+    if (!dro_pairs)
+	dro_start = now;
+    ms = (now - dro_start) / 1000;
+    delay = ms - dro_ms;
+    while (delay > 256) {
+	unsigned n = delay / 256 > 256 ? 256 : delay / 256;
+	dro_put(DRO_LONG_DELAY, n - 1);
+	delay -= n * 256;
+    }
+    if (delay)
+	dro_put(DRO_SHORT_DELAY, delay - 1);
+    dro_ms = ms;
+    dro_put((code - 1) | (dro_index >> 1 & 0x80), value);
+}
+
 void adlib_io_write_base(ioport_t port, Bit8u value)
 {
     adlib_time_last = GETusTIME(0);
     if (debug_level('S') >= 9)
 	S_printf("Adlib: Write %hhx to port %x\n", value, port);
+    if (dro_file)
+	dro_log(port, value, adlib_time_last);
     if ( port&1 ) {
       opl3_update();
     }
@@ -147,6 +282,9 @@ void opl3_init(void)
 	error("ADLIB: Cannot registering port handler\n");
     }
 
+    if (config.opl_file && config.opl_file[0])
+	dro_open(config.opl_file);
+
     if (!oplops)
 	oplops = &dbadlib_ops;
     opl3_impl = oplops->Create(opl3_rate);
@@ -168,6 +306,7 @@ void adlib_reset(void)
 
 void adlib_done(void)
 {
+    dro_close();
     if (!oplops->Generate)
 	return;
     pthread_cancel(syn_thr);
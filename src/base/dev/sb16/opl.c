@@ -50,6 +50,10 @@ static Bit32s vibval_var2[BLOCKBUF_SIZE];
 //static Bit32s vibval_var3[BLOCKBUF_SIZE];
 //static Bit32s vibval_var4[BLOCKBUF_SIZE];
 
+// vibrato and output of the feedback operators of the 2op channels
+static Bit32s vibval_fb[NUM_CHANNELS][BLOCKBUF_SIZE];
+static Bit32s fbval[NUM_CHANNELS][BLOCKBUF_SIZE];
+
 // vibrato/trmolo value table pointers
 static Bit32s *vibval1, *vibval2, *vibval3, *vibval4;
 static Bit32s *tremval1, *tremval2, *tremval3, *tremval4;
@@ -148,16 +152,6 @@ static fltype decrelconst[4] = {
 };
 
 
-static void operator_advance(op_type* op_pt, Bit32s vib) {
-	op_pt->wfpos = op_pt->tcount;						// waveform position
-	
-	// advance waveform time
-	op_pt->tcount += op_pt->tinc;
-	op_pt->tcount += (int64_t)(op_pt->tinc)*vib/FIXEDPT;
-
-	op_pt->generator_pos += generator_add;
-}
-
 static void operator_advance_drums(op_type* op_pt1, Bit32s vib1, op_type* op_pt2, Bit32s vib2, op_type* op_pt3, Bit32s vib3) {
 	Bit32u c1 = op_pt1->tcount/FIXEDPT;
 	Bit32u c3 = op_pt3->tcount/FIXEDPT;
@@ -173,7 +167,6 @@ static void operator_advance_drums(op_type* op_pt1, Bit32s vib1, op_type* op_pt2
 	// advance waveform time
 	op_pt1->tcount += op_pt1->tinc;
 	op_pt1->tcount += (Bit32s)(op_pt1->tinc)*vib1/FIXEDPT;
-	op_pt1->generator_pos += generator_add;
 
 	//Snare
 	inttm = ((1+snare_phase_bit) ^ noisebit)<<8;
@@ -181,7 +174,6 @@ static void operator_advance_drums(op_type* op_pt1, Bit32s vib1, op_type* op_pt2
 	// advance waveform time
 	op_pt2->tcount += op_pt2->tinc;
 	op_pt2->tcount += (Bit32s)(op_pt2->tinc)*vib2/FIXEDPT;
-	op_pt2->generator_pos += generator_add;
 
 	//Cymbal
 	inttm = (1+phasebit)<<8;
@@ -189,24 +181,6 @@ static void operator_advance_drums(op_type* op_pt1, Bit32s vib1, op_type* op_pt2
 	// advance waveform time
 	op_pt3->tcount += op_pt3->tinc;
 	op_pt3->tcount += (Bit32s)(op_pt3->tinc)*vib3/FIXEDPT;
-	op_pt3->generator_pos += generator_add;
-}
-
-
-// output level is sustained, mode changes only when operator is turned off (->release)
-// or when the keep-sustained bit is turned off (->sustain_nokeep)
-static void operator_output(op_type* op_pt, Bit32s modulator, Bit32s trem) {
-	if (op_pt->op_state != OF_TYPE_OFF) {
-		op_pt->lastcval = op_pt->cval;
-		Bit32u i = (Bit32u)((op_pt->wfpos+modulator)/FIXEDPT);
-
-		// wform: -16384 to 16383 (0x4000)
-		// trem :  32768 to 65535 (0x10000)
-		// step_amp: 0.0 to 1.0
-		// vol  : 1/2^14 to 1/2^29 (/0x4000; /1../0x8000)
-
-		op_pt->cval = (Bit32s)(op_pt->step_amp*op_pt->vol*op_pt->cur_wform[i&op_pt->cur_wmask]*trem/16.0);
-	}
 }
 
 
@@ -308,16 +282,172 @@ static void operator_attack(op_type* op_pt) {
 }
 
 
-typedef void (*optype_fptr)(op_type*);
+/*
+	The operators are rendered a block of samples at a time: first the
+	waveform positions of the whole block, then the envelope, then the
+	output. The phase ramp, the output of modulated operators and the
+	channel mixing are flat loops over the block without dependencies
+	between the samples. The envelope runs on a copy of the operator
+	that stays in registers, and the feedback operators, the only
+	outputs that depend on the previous sample, are stepped in one
+	loop over the channels so that their chains overlap. All of this
+	is scalar code; the channels are interleaved, not put in SIMD lanes.
+*/
+
+// advance the waveform time of an operator for a block of samples,
+// without vibrato this is a plain ramp
+static void operator_advance_block(op_type* op_pt, const Bit32s* vib, Bit32u* wfpos, Bits n) {
+	Bit32u tcount = op_pt->tcount;
+	Bit32u tinc = op_pt->tinc;
+	Bits i;
+
+	if (vib == vibval_const) {
+		for (i=0;i<n;i++) wfpos[i] = tcount + (Bit32u)i*tinc;
+		tcount += (Bit32u)n*tinc;
+	} else {
+		for (i=0;i<n;i++) {
+			wfpos[i] = tcount;
+			tcount += tinc;
+			tcount += (int64_t)tinc*vib[i]/FIXEDPT;
+		}
+	}
+	op_pt->tcount = tcount;
+	op_pt->wfpos = wfpos[n-1];
+}
 
-optype_fptr opfuncs[6] = {
-	operator_attack,
-	operator_decay,
-	operator_release,
-	operator_sustain,	// sustain phase (keeping level)
-	operator_release,	// sustain_nokeep phase (release-style)
-	operator_off
-};
+// run the envelope generator for a block of samples and store the gain
+// of each sample; returns the number of samples before the operator was
+// turned off, only those produce output
+static Bits operator_envelope_block(op_type* op_org, fltype* env, Bits n) {
+	op_type op_local = *op_org;	// a local copy can live in registers
+	op_type* op_pt = &op_local;
+	Bits i;
+
+	for (i=0;i<n;i++) {
+		op_pt->generator_pos += generator_add;
+		switch (op_pt->op_state) {
+		case OF_TYPE_ATT:
+			operator_attack(op_pt);
+			break;
+		case OF_TYPE_DEC:
+			operator_decay(op_pt);
+			break;
+		case OF_TYPE_REL:
+		case OF_TYPE_SUS_NOKEEP:	// release-style
+			operator_release(op_pt);
+			break;
+		case OF_TYPE_SUS:
+			operator_sustain(op_pt);
+			break;
+		default:
+			operator_off(op_pt);
+			break;
+		}
+		if (op_pt->op_state == OF_TYPE_OFF) {
+			op_pt->generator_pos += (Bit32u)(n-i-1)*generator_add;
+			break;
+		}
+		env[i] = op_pt->step_amp*op_pt->vol;
+	}
+	*op_org = op_local;
+	return i;
+}
+
+// the output stays at its last value once the operator is off
+static void operator_output_hold(op_type* op_pt, const Bit32s* out, Bits nout, Bits n, Bit32s* fill) {
+	Bits i;
+
+	if (nout >= 2) {
+		op_pt->lastcval = out[nout-2];
+		op_pt->cval = out[nout-1];
+	} else if (nout == 1) {
+		op_pt->lastcval = op_pt->cval;
+		op_pt->cval = out[0];
+	}
+	for (i=nout;i<n;i++) fill[i] = op_pt->cval;
+}
+
+// wform: -16384 to 16383 (0x4000)
+// trem :  32768 to 65535 (0x10000)
+// env  : step_amp (0.0 to 1.0) * vol (1/2^14 to 1/2^29 (/0x4000; /1../0x8000))
+
+// operator output for a block of samples, phase modulated by the output
+// of another operator if modulator is not NULL
+static void operator_render(op_type* op_pt, const Bit32u* wfpos, const Bit32s* trem,
+		const Bit32s* modulator, Bits n, Bit32s* out) {
+	fltype env[BLOCKBUF_SIZE];
+	const Bit16s* wform = op_pt->cur_wform;
+	Bit32u wmask = op_pt->cur_wmask;
+	Bits i, nout;
+
+	nout = operator_envelope_block(op_pt, env, n);
+	if (modulator) {
+		for (i=0;i<nout;i++) {
+			Bit32u idx = (Bit32u)((wfpos[i]+modulator[i]*FIXEDPT)/FIXEDPT);
+			out[i] = (Bit32s)(env[i]*wform[idx&wmask]*trem[i]/16.0);
+		}
+	} else {
+		for (i=0;i<nout;i++) {
+			Bit32u idx = wfpos[i]/FIXEDPT;
+			out[i] = (Bit32s)(env[i]*wform[idx&wmask]*trem[i]/16.0);
+		}
+	}
+	operator_output_hold(op_pt, out, nout, n, out);
+}
+
+static void operator_block(op_type* op_pt, const Bit32s* vib, const Bit32s* trem,
+		const Bit32s* modulator, Bits n, Bit32s* out) {
+	Bit32u wfpos[BLOCKBUF_SIZE];
+
+	operator_advance_block(op_pt, vib, wfpos, n);
+	operator_render(op_pt, wfpos, trem, modulator, n, out);
+}
+
+// operators that are modulated by their own output (feedback) for a block
+// of samples. Each sample depends on the previous one, so a single operator
+// is one long chain of dependent operations. The operators of different
+// channels are stepped together to overlap their chains.
+static void operators_block_fb(op_type** ops, const Bit32s** vib, const Bit32s** trem,
+		Bits nops, Bits n, Bit32s (*out)[BLOCKBUF_SIZE]) {
+	static Bit32u wfpos[NUM_CHANNELS][BLOCKBUF_SIZE];
+	static fltype env[NUM_CHANNELS][BLOCKBUF_SIZE];
+	const Bit16s* wform[NUM_CHANNELS];
+	Bit32u wmask[NUM_CHANNELS];
+	Bit32s lastcval[NUM_CHANNELS], cval[NUM_CHANNELS], mfbi[NUM_CHANNELS];
+	Bits nout[NUM_CHANNELS];
+	Bits i, j, nmax = 0;
+
+	for (j=0;j<nops;j++) {
+		operator_advance_block(ops[j], vib[j], wfpos[j], n);
+		nout[j] = operator_envelope_block(ops[j], env[j], n);
+		if (nout[j] > nmax) nmax = nout[j];
+		wform[j] = ops[j]->cur_wform;
+		wmask[j] = ops[j]->cur_wmask;
+		lastcval[j] = ops[j]->lastcval;
+		cval[j] = ops[j]->cval;
+		mfbi[j] = ops[j]->mfbi;
+	}
+	for (i=0;i<nmax;i++) {
+		for (j=0;j<nops;j++) {
+			if (i >= nout[j]) continue;
+			Bit32s modulator = (lastcval[j]+cval[j])*mfbi[j]/2;
+			Bit32u idx = (Bit32u)((wfpos[j][i]+modulator)/FIXEDPT);
+			lastcval[j] = cval[j];
+			cval[j] = (Bit32s)(env[j][i]*wform[j][idx&wmask[j]]*trem[j][i]/16.0);
+			out[j][i] = cval[j];
+		}
+	}
+	for (j=0;j<nops;j++) {
+		ops[j]->lastcval = lastcval[j];
+		ops[j]->cval = cval[j];
+		for (i=nout[j];i<n;i++) out[j][i] = cval[j];
+	}
+}
+
+static void operator_block_fb(op_type* op_pt, const Bit32s* vib, const Bit32s* trem,
+		Bits n, Bit32s* out) {
+	operators_block_fb(&op_pt, &vib, &trem, 1, n, (Bit32s (*)[BLOCKBUF_SIZE])out);
+}
 
 static void change_attackrate(Bitu regbase, op_type* op_pt) {
 	Bits attackrate = adlibreg[ARC_ATTR_DECR+regbase]>>4;
@@ -970,6 +1100,12 @@ void opl_getsample(Bit16s* sndptr, Bits numsamples) {
 	Bit32s vib_lut[BLOCKBUF_SIZE];
 	Bit32s trem_lut[BLOCKBUF_SIZE];
 
+	// operator outputs of the current channel
+	Bit32s obuf1[BLOCKBUF_SIZE], obuf2[BLOCKBUF_SIZE], obuf3[BLOCKBUF_SIZE];
+#if defined(OPLTYPE_IS_OPL3)
+	Bit32s obuf4[BLOCKBUF_SIZE];	// 4op channels
+#endif
+
 	Bits samples_to_process = numsamples;
 	Bits cursmp;
 	for (cursmp=0; cursmp<samples_to_process; cursmp+=endsamples) {
@@ -1012,12 +1148,9 @@ void opl_getsample(Bit16s* sndptr, Bits numsamples) {
 					else tremval1 = tremval_const;
 
 					// calculate channel output
+					operator_block(&cptr[9],vibval1,tremval1,NULL,endsamples,obuf1);
 					for (i=0;i<endsamples;i++) {
-						operator_advance(&cptr[9],vibval1[i]);
-						opfuncs[cptr[9].op_state](&cptr[9]);
-						operator_output(&cptr[9],0,tremval1[i]);
-						
-						Bit32s chanval = cptr[9].cval*2;
+						Bit32s chanval = obuf1[i]*2;
 						CHANVAL_OUT
 					}
 				}
@@ -1040,16 +1173,10 @@ void opl_getsample(Bit16s* sndptr, Bits numsamples) {
 					else tremval2 = tremval_const;
 
 					// calculate channel output
+					operator_block_fb(&cptr[0],vibval1,tremval1,endsamples,obuf1);
+					operator_block(&cptr[9],vibval2,tremval2,obuf1,endsamples,obuf2);
 					for (i=0;i<endsamples;i++) {
-						operator_advance(&cptr[0],vibval1[i]);
-						opfuncs[cptr[0].op_state](&cptr[0]);
-						operator_output(&cptr[0],(cptr[0].lastcval+cptr[0].cval)*cptr[0].mfbi/2,tremval1[i]);
-
-						operator_advance(&cptr[9],vibval2[i]);
-						opfuncs[cptr[9].op_state](&cptr[9]);
-						operator_output(&cptr[9],cptr[0].cval*FIXEDPT,tremval2[i]);
-						
-						Bit32s chanval = cptr[9].cval*2;
+						Bit32s chanval = obuf2[i]*2;
 						CHANVAL_OUT
 					}
 				}
@@ -1068,11 +1195,9 @@ void opl_getsample(Bit16s* sndptr, Bits numsamples) {
 				else tremval3 = tremval_const;
 
 				// calculate channel output
+				operator_block(&cptr[0],vibval3,tremval3,NULL,endsamples,obuf1);
 				for (i=0;i<endsamples;i++) {
-					operator_advance(&cptr[0],vibval3[i]);
-					opfuncs[cptr[0].op_state](&cptr[0]);		//TomTom
-					operator_output(&cptr[0],0,tremval3[i]);
-					Bit32s chanval = cptr[0].cval*2;
+					Bit32s chanval = obuf1[i]*2;
 					CHANVAL_OUT
 				}
 			}
@@ -1108,19 +1233,18 @@ void opl_getsample(Bit16s* sndptr, Bits numsamples) {
 				else tremval4 = tremval_const;
 
 				// calculate channel output
+				Bit32u drum_wfpos[3][BLOCKBUF_SIZE];
 				for (i=0;i<endsamples;i++) {
 					operator_advance_drums(&op[7],vibval1[i],&op[7+9],vibval2[i],&op[8+9],vibval4[i]);
-
-					opfuncs[op[7].op_state](&op[7]);			//Hihat
-					operator_output(&op[7],0,tremval1[i]);
-
-					opfuncs[op[7+9].op_state](&op[7+9]);		//Snare
-					operator_output(&op[7+9],0,tremval2[i]);
-
-					opfuncs[op[8+9].op_state](&op[8+9]);		//Cymbal
-					operator_output(&op[8+9],0,tremval4[i]);
-
-					Bit32s chanval = (op[7].cval + op[7+9].cval + op[8+9].cval)*2;
+					drum_wfpos[0][i] = op[7].wfpos;
+					drum_wfpos[1][i] = op[7+9].wfpos;
+					drum_wfpos[2][i] = op[8+9].wfpos;
+				}
+				operator_render(&op[7],drum_wfpos[0],tremval1,NULL,endsamples,obuf1);		//Hihat
+				operator_render(&op[7+9],drum_wfpos[1],tremval2,NULL,endsamples,obuf2);	//Snare
+				operator_render(&op[8+9],drum_wfpos[2],tremval4,NULL,endsamples,obuf3);	//Cymbal
+				for (i=0;i<endsamples;i++) {
+					Bit32s chanval = (obuf1[i] + obuf2[i] + obuf3[i])*2;
 					CHANVAL_OUT
 				}
 			}
@@ -1131,6 +1255,35 @@ void opl_getsample(Bit16s* sndptr, Bits numsamples) {
 		if ((adlibreg[0x105]&1)==0) max_channel = NUM_CHANNELS/2;
 #endif
 		Bits cur_ch;
+
+		// first the feedback operators (op1) of all 2op channels, together
+		op_type* fb_ops[NUM_CHANNELS];
+		const Bit32s* fb_vib[NUM_CHANNELS];
+		const Bit32s* fb_trem[NUM_CHANNELS];
+		Bits fb_idx[NUM_CHANNELS];
+		Bits nfb = 0;
+		for (cur_ch=max_channel-1; cur_ch>=0; cur_ch--) {
+			fb_idx[cur_ch] = -1;
+			if ((adlibreg[ARC_PERC_MODE]&0x20) && (cur_ch >= 6) && (cur_ch < 9)) continue;
+#if defined(OPLTYPE_IS_OPL3)
+			cptr = (cur_ch < 9) ? &op[cur_ch] : &op[cur_ch+9];
+			if ((adlibreg[0x105]&1) && (cptr->is_4op_attached || cptr->is_4op)) continue;
+#else
+			cptr = &op[cur_ch];
+#endif
+			if ((cptr[9].op_state == OF_TYPE_OFF) && (cptr[0].op_state == OF_TYPE_OFF)) continue;
+			if ((cptr[0].vibrato) && (cptr[0].op_state != OF_TYPE_OFF)) {
+				for (i=0;i<endsamples;i++)
+					vibval_fb[nfb][i] = (Bit32s)((vib_lut[i]*cptr[0].freq_high/8)*FIXEDPT*VIBFAC);
+				fb_vib[nfb] = vibval_fb[nfb];
+			} else fb_vib[nfb] = vibval_const;
+			if (cptr[0].tremolo) fb_trem[nfb] = trem_lut;	// tremolo enabled, use table
+			else fb_trem[nfb] = tremval_const;
+			fb_ops[nfb] = cptr;
+			fb_idx[cur_ch] = nfb++;
+		}
+		operators_block_fb(fb_ops,fb_vib,fb_trem,nfb,endsamples,fbval);
+
 		for (cur_ch=max_channel-1; cur_ch>=0; cur_ch--) {
 			// skip drum/percussion operators
 			if ((adlibreg[ARC_PERC_MODE]&0x20) && (cur_ch >= 6) && (cur_ch < 9)) continue;
@@ -1165,12 +1318,9 @@ void opl_getsample(Bit16s* sndptr, Bits numsamples) {
 							else tremval1 = tremval_const;
 
 							// calculate channel output
+							operator_block_fb(&cptr[0],vibval1,tremval1,endsamples,obuf1);
 							for (i=0;i<endsamples;i++) {
-								operator_advance(&cptr[0],vibval1[i]);
-								opfuncs[cptr[0].op_state](&cptr[0]);
-								operator_output(&cptr[0],(cptr[0].lastcval+cptr[0].cval)*cptr[0].mfbi/2,tremval1[i]);
-
-								Bit32s chanval = cptr[0].cval;
+								Bit32s chanval = obuf1[i];
 								CHANVAL_OUT
 							}
 						}
@@ -1187,16 +1337,10 @@ void opl_getsample(Bit16s* sndptr, Bits numsamples) {
 							else tremval2 = tremval_const;
 
 							// calculate channel output
+							operator_block(&cptr[9],vibval1,tremval1,NULL,endsamples,obuf1);
+							operator_block(&cptr[3],vibval_const,tremval2,obuf1,endsamples,obuf2);
 							for (i=0;i<endsamples;i++) {
-								operator_advance(&cptr[9],vibval1[i]);
-								opfuncs[cptr[9].op_state](&cptr[9]);
-								operator_output(&cptr[9],0,tremval1[i]);
-
-								operator_advance(&cptr[3],0);
-								opfuncs[cptr[3].op_state](&cptr[3]);
-								operator_output(&cptr[3],cptr[9].cval*FIXEDPT,tremval2[i]);
-
-								Bit32s chanval = cptr[3].cval;
+								Bit32s chanval = obuf2[i];
 								CHANVAL_OUT
 							}
 						}
@@ -1206,12 +1350,9 @@ void opl_getsample(Bit16s* sndptr, Bits numsamples) {
 							else tremval1 = tremval_const;
 
 							// calculate channel output
+							operator_block(&cptr[3+9],vibval_const,tremval1,NULL,endsamples,obuf1);
 							for (i=0;i<endsamples;i++) {
-								operator_advance(&cptr[3+9],0);
-								opfuncs[cptr[3+9].op_state](&cptr[3+9]);
-								operator_output(&cptr[3+9],0,tremval1[i]);
-
-								Bit32s chanval = cptr[3+9].cval;
+								Bit32s chanval = obuf1[i];
 								CHANVAL_OUT
 							}
 						}
@@ -1227,12 +1368,9 @@ void opl_getsample(Bit16s* sndptr, Bits numsamples) {
 							else tremval1 = tremval_const;
 
 							// calculate channel output
+							operator_block_fb(&cptr[0],vibval1,tremval1,endsamples,obuf1);
 							for (i=0;i<endsamples;i++) {
-								operator_advance(&cptr[0],vibval1[i]);
-								opfuncs[cptr[0].op_state](&cptr[0]);
-								operator_output(&cptr[0],(cptr[0].lastcval+cptr[0].cval)*cptr[0].mfbi/2,tremval1[i]);
-
-								Bit32s chanval = cptr[0].cval;
+								Bit32s chanval = obuf1[i];
 								CHANVAL_OUT
 							}
 						}
@@ -1251,20 +1389,11 @@ void opl_getsample(Bit16s* sndptr, Bits numsamples) {
 							else tremval3 = tremval_const;
 
 							// calculate channel output
+							operator_block(&cptr[9],vibval1,tremval1,NULL,endsamples,obuf1);
+							operator_block(&cptr[3],vibval_const,tremval2,obuf1,endsamples,obuf2);
+							operator_block(&cptr[3+9],vibval_const,tremval3,obuf2,endsamples,obuf3);
 							for (i=0;i<endsamples;i++) {
-								operator_advance(&cptr[9],vibval1[i]);
-								opfuncs[cptr[9].op_state](&cptr[9]);
-								operator_output(&cptr[9],0,tremval1[i]);
-
-								operator_advance(&cptr[3],0);
-								opfuncs[cptr[3].op_state](&cptr[3]);
-								operator_output(&cptr[3],cptr[9].cval*FIXEDPT,tremval2[i]);
-
-								operator_advance(&cptr[3+9],0);
-								opfuncs[cptr[3+9].op_state](&cptr[3+9]);
-								operator_output(&cptr[3+9],cptr[3].cval*FIXEDPT,tremval3[i]);
-
-								Bit32s chanval = cptr[3+9].cval;
+								Bit32s chanval = obuf3[i];
 								CHANVAL_OUT
 							}
 						}
@@ -1272,36 +1401,20 @@ void opl_getsample(Bit16s* sndptr, Bits numsamples) {
 					continue;
 				}
 #endif
-				// 2op additive synthesis
-				if ((cptr[9].op_state == OF_TYPE_OFF) && (cptr[0].op_state == OF_TYPE_OFF)) continue;
-				if ((cptr[0].vibrato) && (cptr[0].op_state != OF_TYPE_OFF)) {
-					vibval1 = vibval_var1;
-					for (i=0;i<endsamples;i++)
-						vibval1[i] = (Bit32s)((vib_lut[i]*cptr[0].freq_high/8)*FIXEDPT*VIBFAC);
-				} else vibval1 = vibval_const;
+				// 2op additive synthesis, op1 has already been done above
+				if (fb_idx[cur_ch] < 0) continue;
 				if ((cptr[9].vibrato) && (cptr[9].op_state != OF_TYPE_OFF)) {
 					vibval2 = vibval_var2;
 					for (i=0;i<endsamples;i++)
 						vibval2[i] = (Bit32s)((vib_lut[i]*cptr[9].freq_high/8)*FIXEDPT*VIBFAC);
 				} else vibval2 = vibval_const;
-				if (cptr[0].tremolo) tremval1 = trem_lut;	// tremolo enabled, use table
-				else tremval1 = tremval_const;
 				if (cptr[9].tremolo) tremval2 = trem_lut;	// tremolo enabled, use table
 				else tremval2 = tremval_const;
 
 				// calculate channel output
+				operator_block(&cptr[9],vibval2,tremval2,NULL,endsamples,obuf2);
 				for (i=0;i<endsamples;i++) {
-					// carrier1
-					operator_advance(&cptr[0],vibval1[i]);
-					opfuncs[cptr[0].op_state](&cptr[0]);
-					operator_output(&cptr[0],(cptr[0].lastcval+cptr[0].cval)*cptr[0].mfbi/2,tremval1[i]);
-
-					// carrier2
-					operator_advance(&cptr[9],vibval2[i]);
-					opfuncs[cptr[9].op_state](&cptr[9]);
-					operator_output(&cptr[9],0,tremval2[i]);
-
-					Bit32s chanval = cptr[9].cval + cptr[0].cval;
+					Bit32s chanval = obuf2[i] + fbval[fb_idx[cur_ch]][i];
 					CHANVAL_OUT
 				}
 			} else {
@@ -1326,16 +1439,10 @@ void opl_getsample(Bit16s* sndptr, Bits numsamples) {
 							else tremval2 = tremval_const;
 
 							// calculate channel output
+							operator_block_fb(&cptr[0],vibval1,tremval1,endsamples,obuf1);
+							operator_block(&cptr[9],vibval2,tremval2,obuf1,endsamples,obuf2);
 							for (i=0;i<endsamples;i++) {
-								operator_advance(&cptr[0],vibval1[i]);
-								opfuncs[cptr[0].op_state](&cptr[0]);
-								operator_output(&cptr[0],(cptr[0].lastcval+cptr[0].cval)*cptr[0].mfbi/2,tremval1[i]);
-
-								operator_advance(&cptr[9],vibval2[i]);
-								opfuncs[cptr[9].op_state](&cptr[9]);
-								operator_output(&cptr[9],cptr[0].cval*FIXEDPT,tremval2[i]);
-
-								Bit32s chanval = cptr[9].cval;
+								Bit32s chanval = obuf2[i];
 								CHANVAL_OUT
 							}
 						}
@@ -1347,16 +1454,10 @@ void opl_getsample(Bit16s* sndptr, Bits numsamples) {
 							else tremval2 = tremval_const;
 
 							// calculate channel output
+							operator_block(&cptr[3],vibval_const,tremval1,NULL,endsamples,obuf1);
+							operator_block(&cptr[3+9],vibval_const,tremval2,obuf1,endsamples,obuf2);
 							for (i=0;i<endsamples;i++) {
-								operator_advance(&cptr[3],0);
-								opfuncs[cptr[3].op_state](&cptr[3]);
-								operator_output(&cptr[3],0,tremval1[i]);
-
-								operator_advance(&cptr[3+9],0);
-								opfuncs[cptr[3+9].op_state](&cptr[3+9]);
-								operator_output(&cptr[3+9],cptr[3].cval*FIXEDPT,tremval2[i]);
-
-								Bit32s chanval = cptr[3+9].cval;
+								Bit32s chanval = obuf2[i];
 								CHANVAL_OUT
 							}
 						}
@@ -1385,24 +1486,12 @@ void opl_getsample(Bit16s* sndptr, Bits numsamples) {
 							else tremval4 = tremval_const;
 
 							// calculate channel output
+							operator_block_fb(&cptr[0],vibval1,tremval1,endsamples,obuf1);
+							operator_block(&cptr[9],vibval2,tremval2,obuf1,endsamples,obuf2);
+							operator_block(&cptr[3],vibval_const,tremval3,obuf2,endsamples,obuf3);
+							operator_block(&cptr[3+9],vibval_const,tremval4,obuf3,endsamples,obuf4);
 							for (i=0;i<endsamples;i++) {
-								operator_advance(&cptr[0],vibval1[i]);
-								opfuncs[cptr[0].op_state](&cptr[0]);
-								operator_output(&cptr[0],(cptr[0].lastcval+cptr[0].cval)*cptr[0].mfbi/2,tremval1[i]);
-
-								operator_advance(&cptr[9],vibval2[i]);
-								opfuncs[cptr[9].op_state](&cptr[9]);
-								operator_output(&cptr[9],cptr[0].cval*FIXEDPT,tremval2[i]);
-
-								operator_advance(&cptr[3],0);
-								opfuncs[cptr[3].op_state](&cptr[3]);
-								operator_output(&cptr[3],cptr[9].cval*FIXEDPT,tremval3[i]);
-
-								operator_advance(&cptr[3+9],0);
-								opfuncs[cptr[3+9].op_state](&cptr[3+9]);
-								operator_output(&cptr[3+9],cptr[3].cval*FIXEDPT,tremval4[i]);
-
-								Bit32s chanval = cptr[3+9].cval;
+								Bit32s chanval = obuf4[i];
 								CHANVAL_OUT
 							}
 						}
@@ -1410,36 +1499,20 @@ void opl_getsample(Bit16s* sndptr, Bits numsamples) {
 					continue;
 				}
 #endif
-				// 2op frequency modulation
-				if ((cptr[9].op_state == OF_TYPE_OFF) && (cptr[0].op_state == OF_TYPE_OFF)) continue;
-				if ((cptr[0].vibrato) && (cptr[0].op_state != OF_TYPE_OFF)) {
-					vibval1 = vibval_var1;
-					for (i=0;i<endsamples;i++)
-						vibval1[i] = (Bit32s)((vib_lut[i]*cptr[0].freq_high/8)*FIXEDPT*VIBFAC);
-				} else vibval1 = vibval_const;
+				// 2op frequency modulation, op1 has already been done above
+				if (fb_idx[cur_ch] < 0) continue;
 				if ((cptr[9].vibrato) && (cptr[9].op_state != OF_TYPE_OFF)) {
 					vibval2 = vibval_var2;
 					for (i=0;i<endsamples;i++)
 						vibval2[i] = (Bit32s)((vib_lut[i]*cptr[9].freq_high/8)*FIXEDPT*VIBFAC);
 				} else vibval2 = vibval_const;
-				if (cptr[0].tremolo) tremval1 = trem_lut;	// tremolo enabled, use table
-				else tremval1 = tremval_const;
 				if (cptr[9].tremolo) tremval2 = trem_lut;	// tremolo enabled, use table
 				else tremval2 = tremval_const;
 
 				// calculate channel output
+				operator_block(&cptr[9],vibval2,tremval2,fbval[fb_idx[cur_ch]],endsamples,obuf2);
 				for (i=0;i<endsamples;i++) {
-					// modulator
-					operator_advance(&cptr[0],vibval1[i]);
-					opfuncs[cptr[0].op_state](&cptr[0]);
-					operator_output(&cptr[0],(cptr[0].lastcval+cptr[0].cval)*cptr[0].mfbi/2,tremval1[i]);
-
-					// carrier
-					operator_advance(&cptr[9],vibval2[i]);
-					opfuncs[cptr[9].op_state](&cptr[9]);
-					operator_output(&cptr[9],cptr[0].cval*FIXEDPT,tremval2[i]);
-
-					Bit32s chanval = cptr[9].cval;
+					Bit32s chanval = obuf2[i];
 					CHANVAL_OUT
 				}
 			}
@@ -328,7 +328,7 @@ unsigned char Misc_get_input_status_1()
   static int flip = 0;
   /* Timings are 'ballpark' guesses and may vary from mode to mode, but
      such accuracy is probably not important... I hope. (--adm) */
-  static int vvfreq = 17000;	/* 70 Hz - but the best we'll get with
+  static int vvfreq = VGA_VRETRACE_US;	/* 70 Hz - but the best we'll get with
   				 * current PIC will be 50 Hz */
   hitimer_t t, tdiff;
   unsigned char retval;
@@ -260,6 +260,9 @@
 #include <string.h>
 #include <errno.h>
 #include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "cpu.h"		/* root@sjoerd: for context structure */
 #include "emu.h"
 #include "int.h"
@@ -1451,7 +1454,7 @@ static int vga_emu_map(unsigned mapping, unsigned first_page)
     vgaemu_update_prot_cache(vmt->base_page + u, prot);
     /* need to fix up protection for clean pages */
     if(vga.mode_class == GRAPH && !vga.mem.dirty_map[vmt->first_page + u] &&
-	    prot == VGA_EMU_RW_PROT)
+	    prot == VGA_EMU_RW_PROT && !vga.mem.diff)
       _vga_emu_adjust_protection(vmt->first_page + u, 0, VGA_PROT_RO, 0);
   }
   pthread_mutex_unlock(&prot_mtx);
@@ -1842,6 +1845,165 @@ static void print_prot_map()
  * DANG_END_FUNCTION
  *
  */
+/*
+ * Snapshot diff mode ($_vga_diff_modes).
+ *
+ * The frame buffer stays writable and is compared against a copy of the
+ * last displayed frame in DIFF_CHUNK (cache line) sized pieces. Ranges
+ * are merged when less than a scan line apart, as the remapper works
+ * on whole lines anyway. Pages flagged in dirty_map (full redraws,
+ * writes done by vgaemu itself) get their snapshot inverted, so that
+ * every byte of them compares different.
+ *
+ * Only for packed pixel modes without instruction emulation. pos is a
+ * byte offset here, not a page number.
+ */
+#define DIFF_CHUNK 64
+
+/* is the current mode listed in $_vga_diff_modes? */
+static int vgaemu_diff_wanted(void)
+{
+  const char *p = config.vga_diff_modes;
+  char *end;
+  long m;
+
+  if (!p)
+    return 0;
+  if (strcmp(p, "all") == 0)
+    return 1;
+  while (*p) {
+    m = strtol(p, &end, 0);
+    if (end == p)
+      break;
+    if (m == vga.VGA_mode || m == vga.VESA_mode)
+      return 1;
+    p = end;
+  }
+  return 0;
+}
+
+static int diff_mode_ok(void)
+{
+  if (!vga.mem.diff_wanted || vga.mode_class != GRAPH || vga.inst_emu ||
+      vga.mem.planes != 1)
+    return 0;
+  switch (vga.mode_type) {
+    case P8: case P15: case P16: case P24: case P32:
+      return 1;
+  }
+  return 0;
+}
+
+/* switch between page protection and snapshot diffs; prot_mtx held */
+static void vgaemu_diff_check(void)
+{
+  int i, on = diff_mode_ok();
+
+  if (on == vga.mem.diff)
+    return;
+  if (on && !vga.mem.snapshot) {
+    vga.mem.snapshot = malloc(vga.mem.size);
+    if (!vga.mem.snapshot) {
+      error("VGA: no memory for frame buffer snapshot\n");
+      vga.mem.diff_wanted = 0;
+      return;
+    }
+  }
+  vga_msg("vga_emu_update: snapshot diffs %s\n", on ? "on" : "off");
+  vga.mem.diff = on;
+  /* open all pages for writing; when switching back the update loop
+   * protects the dirty ones again */
+  for (i = 0; i < vga.mem.pages; i++)
+    _vga_emu_adjust_protection(i, 0, on ? RW : DEF_PROT, 1);
+  /* the writes made while diffing are only in the snapshot compare, so
+   * redraw everything; dirty_all_video_pages() would take prot_mtx */
+  if (!on && vga.mem.dirty_map)
+    memset(vga.mem.dirty_map, 1, vga.mem.pages);
+}
+
+static void vgaemu_diff_invalidate(void)
+{
+  int i, k;
+
+  for (i = 0; i < vga.mem.pages; i++) {
+    unsigned char *b, *s;
+    if (!vga.mem.dirty_map[i])
+      continue;
+    b = vga.mem.base + (i << PAGE_SHIFT);
+    s = vga.mem.snapshot + (i << PAGE_SHIFT);
+    for (k = 0; k < PAGE_SIZE; k++)
+      s[k] = ~b[k];
+    vga.mem.dirty_map[i] = 0;
+  }
+}
+
+static inline int chunk_differs(const unsigned char *a, const unsigned char *b)
+{
+#ifdef __SSE2__
+  __m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)a),
+                              _mm_loadu_si128((const __m128i *)b));
+  __m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + 16)),
+                              _mm_loadu_si128((const __m128i *)(b + 16)));
+  __m128i e2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + 32)),
+                              _mm_loadu_si128((const __m128i *)(b + 32)));
+  __m128i e3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + 48)),
+                              _mm_loadu_si128((const __m128i *)(b + 48)));
+  e0 = _mm_and_si128(_mm_and_si128(e0, e1), _mm_and_si128(e2, e3));
+  return _mm_movemask_epi8(e0) != 0xffff;
+#else
+  return memcmp(a, b, DIFF_CHUNK) != 0;
+#endif
+}
+
+/* compare the part of the chunk at `a' that lies in [lo, hi) */
+static int diff_chunk_dirty(unsigned a, unsigned lo, unsigned hi)
+{
+  unsigned s, e;
+
+  if (a >= lo && a + DIFF_CHUNK <= hi)
+    return chunk_differs(vga.mem.base + a, vga.mem.snapshot + a);
+  s = _max(a, lo);
+  e = _min(a + DIFF_CHUNK, hi);
+  return memcmp(vga.mem.base + s, vga.mem.snapshot + s, e - s) != 0;
+}
+
+static int __vga_emu_update_diff(vga_emu_update_type *veut,
+    unsigned display_start, unsigned display_end, int pos)
+{
+  unsigned a, start, end, gap;
+
+  if (pos == -1) {
+    vgaemu_diff_invalidate();
+    pos = display_start;
+  }
+  if (pos >= display_end)
+    return -1;
+
+  for (a = pos & ~(DIFF_CHUNK - 1); a < display_end &&
+      !diff_chunk_dirty(a, pos, display_end); a += DIFF_CHUNK);
+  if (a >= display_end)
+    return -1;
+  start = _max(a, pos);
+
+  gap = _max(vga.scan_len, DIFF_CHUNK);
+  for (end = a += DIFF_CHUNK; a < display_end && a - end < gap;
+      a += DIFF_CHUNK) {
+    if (diff_chunk_dirty(a, pos, display_end))
+      end = a + DIFF_CHUNK;
+  }
+  end = _min(end, display_end);
+
+  /* snapshot before the remapper reads, so no later write gets lost */
+  memcpy(vga.mem.snapshot + start, vga.mem.base + start, end - start);
+  veut->update_start = start;
+  veut->update_len = end - start;
+
+  vga_deb_update("vga_emu_update: diff update_start = %d, update_len = %d\n",
+    veut->update_start, veut->update_len);
+
+  return end;
+}
+
 /* for threaded rendering we need to disable cycling as it can lead
  * to lock starvations */
 static int __vga_emu_update(vga_emu_update_type *veut, unsigned display_start,
@@ -1927,7 +2089,12 @@ int vga_emu_update(vga_emu_update_type *veut, unsigned display_start,
 {
   int ret;
   pthread_mutex_lock(&prot_mtx);
-  ret = __vga_emu_update(veut, display_start, display_end, pos);
+  if (pos == -1)
+    vgaemu_diff_check();
+  if (vga.mem.diff)
+    ret = __vga_emu_update_diff(veut, display_start, display_end, pos);
+  else
+    ret = __vga_emu_update(veut, display_start, display_end, pos);
   pthread_mutex_unlock(&prot_mtx);
   return ret;
 }
@@ -2342,6 +2509,7 @@ static int __vga_emu_setmode(int mode, int width, int height)
     vga.scan_len *= vga.pixel_size >> 3;
   }
   vga.inst_emu = ((vga.mode_type==PL4 || vga.mode_type==PL2) ? EMU_ALL_INST : 0);
+  vga.mem.diff_wanted = vgaemu_diff_wanted();
 
   vga_msg("vga_emu_setmode: scan_len = %d\n", vga.scan_len);
   i = vga.scan_len;
@@ -2451,6 +2619,9 @@ static int __vga_emu_setmode(int mode, int width, int height)
   /* need to fix vgaemu before this is possible */
   vgaemu_adj_cfg(CFG_MODE_CONTROL, 1);
 #endif
+  pthread_mutex_lock(&prot_mtx);
+  vgaemu_diff_check();
+  pthread_mutex_unlock(&prot_mtx);
 
   vga_msg("vga_emu_setmode: mode initialized\n");
 
@@ -2461,6 +2632,9 @@ static int _is_dirty(void)
 {
   int i, ret = 0;
 
+  /* writes are not tracked, only a diff can tell */
+  if (vga.mem.diff || diff_mode_ok())
+    return 1;
   if (vga.mem.dirty_map) {
     for (i = 0; i < vga.mem.pages; i++) {
       if (vga.mem.dirty_map[i]) {
@@ -2803,8 +2977,10 @@ static void vgaemu_adjust_instremu(void)
         if (vga.mem.dirty_map[i])
           _vga_emu_adjust_protection(i, 0, NONE, 1);
       }
-      pthread_mutex_unlock(&prot_mtx);
       vga.inst_emu = EMU_ALL_INST;
+      /* diff mode left the clean pages writable too */
+      vgaemu_diff_check();
+      pthread_mutex_unlock(&prot_mtx);
     }
   } else {
     if (vga.inst_emu != 0) {
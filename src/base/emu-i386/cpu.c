@@ -371,10 +371,16 @@ void cpu_setup(void)
 
 #ifdef X86_EMULATOR
   if (config.cpu_vm == CPUVM_EMU || config.cpu_vm_dpmi == CPUVM_EMU) {
+    const char *how = CONFIG_CPUSIM ? "interpreter" :
+#ifdef __x86_64__
+	"x86-64 jit";
+#else
+	"i386 jit";
+#endif
     if (config.cpu_vm == CPUVM_EMU)
-      warn("using CPU emulation for vm86()\n");
+      warn("using CPU emulation (%s) for vm86()\n", how);
     if (config.cpu_vm_dpmi == CPUVM_EMU)
-      warn("using CPU emulation for DPMI\n");
+      warn("using CPU emulation (%s) for DPMI\n", how);
   }
   init_emu_cpu();
 #endif
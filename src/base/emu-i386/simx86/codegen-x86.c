@@ -108,19 +108,26 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <pthread.h>
 #include "utilities.h"
 #include "emu86.h"
 #include "dlmalloc.h"
 #include "mapping.h"
 #ifdef HOST_ARCH_X86
 #include "codegen-x86.h"
+#include "jitcache.h"
+#include "jitprof.h"
 
 static void Gen_x86(int op, int mode, ...);
 static void AddrGen_x86(int op, int mode, ...);
 static unsigned int CloseAndExec_x86(unsigned int PC, int mode, int ln);
+static void BgTraceInit(void);
+static int BgTraceStart(TNode *G, TNode *N);
 
 hitimer_u TimeStartExec;
 static TNode *LastXNode = NULL;
+/* set by CodeGen() on a fatal error, passed to TheCPU.err by the caller */
+static __thread int GenErr;
 
 /////////////////////////////////////////////////////////////////////////////
 
@@ -173,6 +180,9 @@ void InitGen_x86(void)
 	CloseAndExec = CloseAndExec_x86;
 	UseLinker = USE_LINKER;
 	InitTrees();
+	jitcache_init();
+	jitprof_init();
+	BgTraceInit();
 }
 
 
@@ -186,8 +196,8 @@ static unsigned char *CodeGen(unsigned char *CodePtr, unsigned char *BaseGenBuf,
 			      IMeta *I, int j)
 {
 	/* evil hack, keeping state from MOVS_SavA to MOVS_SetA in
-	   a static variable */
-	static unsigned char * rep_retry_ptr = (unsigned char*)0xdeadbeef;
+	   a static variable; per thread, for the background worker */
+	static __thread unsigned char * rep_retry_ptr = (unsigned char*)0xdeadbeef;
 	IGen *IG = &(I->gen[j]);
 	register unsigned char *Cp = CodePtr;
 	unsigned char * CpTemp;
@@ -311,7 +321,7 @@ static unsigned char *CodeGen(unsigned char *CodePtr, unsigned char *BaseGenBuf,
 		break;
 	case O_FOP: {
 		unsigned char *p = Fp87_op_x86(CodePtr, IG->p0, IG->p1);
-		if (p == NULL) TheCPU.err = -96;
+		if (p == NULL) GenErr = -96;
 		else Cp = p;
 		}
 		break;
@@ -489,7 +499,7 @@ static unsigned char *CodeGen(unsigned char *CodePtr, unsigned char *BaseGenBuf,
 	case O_DEC_R:
 		rcod = 0x08fe;
 arith0:		{
-		G1(POPdx,Cp);	// get flags from stack into %%edx
+		GetFlags(Cp);	// get flags from stack into %%edx
 		switch (IG->op) {
 		case O_ADC_R: // tests carry
 		case O_SBB_R: // tests carry
@@ -520,11 +530,12 @@ arith0:		{
 				G2(0x4301|rcod,Cp); G1(IG->p0,Cp);
 			}
 		}
-		G1(PUSHF,Cp);	// flags back on stack
+		PutFlags(Cp);	// flags back on stack
 		}
 		break;
 	case O_CLEAR:
-		G3M(POPdx,0x31,0xc0,Cp);	//ignore flags; xorl %%eax,%%eax
+		DropFlags(Cp);	// ignore flags
+		G2M(0x31,0xc0,Cp);	// xorl %%eax,%%eax
 		if (mode & MBYTE) {
 			// movb %%al,offs(%%ebx)
 			G3M(0x88,0x43,IG->p0,Cp);
@@ -533,10 +544,10 @@ arith0:		{
 			// mov{wl} %%{e}ax,offs(%%ebx)
 			Gen66(mode,Cp); G3M(0x89,0x43,IG->p0,Cp);
 		}
-		G1(PUSHF,Cp);	// new flags on stack
+		PutFlags(Cp);	// new flags on stack
 		break;
 	case O_TEST:
-		G1(POPdx,Cp);			// ignore flags
+		DropFlags(Cp);			// ignore flags
 		if (mode & MBYTE) {
 			// testb $0xff,offs(%%ebx)
 			G4M(0xf6,0x43,IG->p0,0xffu,Cp);
@@ -549,13 +560,13 @@ arith0:		{
 			// test $0xffffffff,offs(%%ebx)
 			G3M(0xf7,0x43,IG->p0,Cp); G4(0xffffffff,Cp);
 		}
-		G1(PUSHF,Cp);	// new flags on stack
+		PutFlags(Cp);	// new flags on stack
 		break;
 	case O_SBSELF:
 		// if CY=0 -> reg=0,  flag=xx46
 		// if CY=1 -> reg=-1, flag=xx97
 		// pop %%edx; shr $1,%%edx to get carry flag from stack
-		G3M(POPdx,0xd1,0xea,Cp);
+		GetFlags(Cp); G2M(0xd1,0xea,Cp);
 		// sbbl %%eax,%%eax
 		G2M(0x19,0xc0,Cp);
 		if (mode & MBYTE) {
@@ -566,7 +577,7 @@ arith0:		{
 			// mov{wl} %%{e}ax,offs(%%ebx)
 			Gen66(mode,Cp); G3M(0x89,0x43,IG->p0,Cp);
 		}
-		G1(PUSHF,Cp);	// flags back on stack
+		PutFlags(Cp);	// flags back on stack
 		break;
 	case O_ADD_FR:
 		rcod = ADDbfrm; /* 0x00 */ goto arith1;
@@ -585,7 +596,7 @@ arith0:		{
 	case O_CMP_FR:
 		rcod = CMPbfrm; /* 0x38 */
 arith1:
-		G1(POPdx,Cp);	// get flags from stack into %%edx
+		GetFlags(Cp);	// get flags from stack into %%edx
 		if (IG->op == O_ADC_FR || IG->op == O_SBB_FR) {
 			// shr $1,%%edx to get carry flag from stack
 			G2M(0xd1,0xea,Cp);
@@ -613,7 +624,7 @@ arith1:
 				G2(0x4301|rcod,Cp); G1(IG->p0,Cp);
 			}
 		}
-		G1(PUSHF,Cp);	// flags back on stack
+		PutFlags(Cp);	// flags back on stack
 		break;
 	case O_NOT:
 		if (mode & MBYTE) {
@@ -627,7 +638,7 @@ arith1:
 		}
 		break;
 	case O_NEG:
-		G1(POPdx,Cp);	// ignore flags from stack
+		DropFlags(Cp);	// ignore flags from stack
 		if (mode & MBYTE) {
 			// negb %%al
 			G2M(0xf6,0xd8,Cp);
@@ -637,10 +648,10 @@ arith1:
 			Gen66(mode,Cp);
 			G2M(0xf7,0xd8,Cp);
 		}
-		G1(PUSHF,Cp);	// new flags on stack
+		PutFlags(Cp);	// new flags on stack
 		break;
 	case O_INC:
-		G1(POPdx,Cp);	// get flags from stack into %%edx
+		GetFlags(Cp);	// get flags from stack into %%edx
 		// shr $1,%%edx to get preserved carry flag from stack
 		G2M(0xd1,0xea,Cp);
 		if (mode & MBYTE) {
@@ -663,10 +674,10 @@ arith1:
 			G1(0x40,Cp);
 #endif
 		}
-		G1(PUSHF,Cp);	// flags back on stack before writing
+		PutFlags(Cp);	// flags back on stack before writing
 		break;
 	case O_DEC:
-		G1(POPdx,Cp);	// get flags from stack into %%edx
+		GetFlags(Cp);	// get flags from stack into %%edx
 		// shr $1,%%edx to get preserved carry flag from stack
 		G2M(0xd1,0xea,Cp);
 		if (mode & MBYTE) {
@@ -689,7 +700,7 @@ arith1:
 			G1(0x48,Cp);
 #endif
 		}
-		G1(PUSHF,Cp);	// flags back on stack
+		PutFlags(Cp);	// flags back on stack
 		break;
 	case O_CMPXCHG: {
 		G1(POPdx,Cp);	// ignore flags from stack
@@ -2324,6 +2335,21 @@ shrot0:
 		}
 		break;
 
+	case JF_SIDE: {		// opc, dspt, hint
+		unsigned char opc = IG->p0;
+		int dspt = IG->p1;
+		//	7y 11		(inverted condition) skip exit
+		// t:	c7 83 [Ofs_SIDEEXIT] [hint]
+		//	b8 [t_pc] 5a c3
+		// nt:	trace goes on with next instr
+		PopPushF(Cp);	// get flags from stack
+		G2M(opc^1,10+TAILSIZE,Cp);
+		G2M(0xc7,0x83,Cp); G4(Ofs_SIDEEXIT,Cp); G4(IG->p2,Cp);
+		G1(0xb8,Cp); G4(dspt,Cp); G2(0xc35a,Cp);
+		if (debug_level('e')>2) e_printf("J_Side %08x\n",dspt);
+		}
+		break;
+
 	case JLOOP_LINK: {	// opc, PC, dspt, dspnt, link
 		unsigned char opc = IG->p0;
 		int dspt = IG->p1;
@@ -2728,6 +2754,14 @@ static void Gen_x86(int op, int mode, ...)
 		}
 		break;
 
+	case JF_SIDE: {		// opc, dspt, hint
+		unsigned char opc = (unsigned char)va_arg(ap,int);
+		IG->p0 = opc;
+		IG->p1 = va_arg(ap,int);	// dspt
+		IG->p2 = va_arg(ap,int);	// hint
+		}
+		break;
+
 	}
 
 	va_end(ap);
@@ -2739,9 +2773,78 @@ static void Gen_x86(int op, int mode, ...)
 
 
 /////////////////////////////////////////////////////////////////////////////
+/*
+ * Flag liveness.
+ * The guest flags live on the host stack between ops; every op changing
+ * them pops the old ones and pushes the new ones back with PUSHF. Going
+ * backwards through the sequence we track which of the condition flags
+ * can still be read; all of them are at the end of the sequence and
+ * after any op we don't know about. An op of the arithmetic group whose
+ * flags are all overwritten before being read gets the NOFLAGS bit, so
+ * that CodeGen leaves the stack alone for it.
+ * Memory accesses can fault and report the flags on the stack to the
+ * guest, so they stop the search in protected mode.
+ */
+static void FlagLiveness(IMeta *I0)
+{
+	unsigned int live = EFLAGS_CC;
+	int i, j, dead = 0;
 
+	for (i=CurrIMeta-1; i>=0; i--) {
+	    IMeta *I = &I0[i];
+	    for (j=I->ngen-1; j>=0; j--) {
+		IGen *IG = &(I->gen[j]);
+		unsigned int w, r;
 
-static CodeBuf *ProduceCode(unsigned int PC, IMeta *I0)
+		switch (IG->op) {
+		case O_ADD_R: case O_OR_R: case O_AND_R: case O_SUB_R:
+		case O_XOR_R: case O_CMP_R:
+		case O_ADD_FR: case O_OR_FR: case O_AND_FR: case O_SUB_FR:
+		case O_XOR_FR: case O_CMP_FR:
+		case O_NEG: case O_CLEAR: case O_TEST:
+			w = EFLAGS_CC; r = 0;
+			break;
+		case O_ADC_R: case O_SBB_R: case O_ADC_FR: case O_SBB_FR:
+		case O_SBSELF:
+			w = EFLAGS_CC; r = EFLAGS_CF;
+			break;
+		case O_INC_R: case O_DEC_R: case O_INC: case O_DEC:
+			/* CF is preserved */
+			w = EFLAGS_CC & ~EFLAGS_CF; r = 0;
+			break;
+		case A_DI_0: case A_DI_1: case A_DI_2: case A_DI_2D:
+		case A_SR_SH4: case L_NOP: case L_REG: case S_REG:
+		case L_REG2REG: case S_DI_R: case L_IMM: case L_IMM_R1:
+		case L_MOVZS: case L_ZXAX: case O_NOT:
+			continue;	/* flags untouched */
+		case L_DI_R1: case S_DI: case S_DI_IMM:
+			if (REALADDR())
+				continue;
+			/* fall through */
+		default:
+			live = EFLAGS_CC;
+			continue;
+		}
+		if (live & w) {
+		    IG->mode &= ~NOFLAGS;
+		    /* the flags not written are pushed back as found */
+		    live = (EFLAGS_CC & ~w) | r;
+		}
+		else {
+		    IG->mode |= NOFLAGS;
+		    live |= r;
+		    dead++;
+		}
+	    }
+	}
+	if (debug_level('e')>2 && dead)
+	    e_printf("FlagLiveness: %d ops with dead flags\n",dead);
+}
+
+
+/* Produce the code for the nmeta instructions in I0[]. On the background
+ * worker (bg) the buffer is malloc()ed, as the caller copies it anyway. */
+static CodeBuf *ProduceCode(unsigned int PC, IMeta *I0, int nmeta, int bg)
 {
 	int i,j,nap,mall_req;
 	unsigned int adr_lo=0, adr_hi=0;
@@ -2751,9 +2854,9 @@ static CodeBuf *ProduceCode(unsigned int PC, IMeta *I0)
 
 	if (debug_level('e')>1) {
 	    e_printf("---------------------------------------------\n");
-	    e_printf("ProduceCode: CurrIMeta=%d\n",CurrIMeta);
+	    e_printf("ProduceCode: nmeta=%d\n",nmeta);
 	}
-	if (CurrIMeta < 0) leavedos_main(0xbac3);
+	if (nmeta < 0) leavedos_main(0xbac3);
 
 	/* reserve space for auto-ptr and info structures */
 	nap = I0->ncount+1;
@@ -2765,25 +2868,28 @@ static CodeBuf *ProduceCode(unsigned int PC, IMeta *I0)
 	 *	0000	(GenCodeBuf) pointed from {TNode}.mblock
 	 *		contains a back pointer to the TNode
 	 * 0008/0004	self-pointer (address of this location)
-	 * 0010/0008	Addr2Pc table (nap) pointed from {TNode}.pmeta
-	 *	nap+10/8 actual code produced (BaseGenBuf)
+	 * 0010/0008	cnext, next CodeBuf in the eviction clock ring
+	 * 0018/000c	cprev, previous CodeBuf in the ring
+	 * 0020/0010	Addr2Pc table (nap) pointed from {TNode}.pmeta
+	 *	nap+20/10 actual code produced (BaseGenBuf)
 	 *		plus tail code
 	 * Only the code part is filled here.
 	 * GenBufSize contain a first guess of the amount of space required
 	 *
 	 */
 	GenBufSize = 0;
-	for (i=0; i<CurrIMeta; i++)
+	for (i=0; i<nmeta; i++)
 	    GenBufSize += I0[i].ngen * MAX_GEND_BYTES_PER_OP;
 	mall_req = GenBufSize + offsetof(CodeBuf, meta) + sizeof(Addr2Pc) * nap + 32;// 32 for tail
-	GenCodeBuf = dlmalloc(mall_req);
+	GenCodeBuf = bg ? malloc(mall_req) : dlmalloc(mall_req);
 	/* actual code buffer starts from here */
 	BaseGenBuf = CodePtr = (unsigned char *)&GenCodeBuf->meta[nap];
 	I0->daddr = 0;
 	if (debug_level('e')>1)
 	    e_printf("CodeBuf=%p siz %zd CodePtr=%p\n",GenCodeBuf,GenBufSize,CodePtr);
+	GenErr = 0;
 
-	for (i=0; i<CurrIMeta; i++) {
+	for (i=0; i<nmeta; i++) {
 	    IMeta *I = &I0[i];
 	    if (i==0) {
 		adr_lo = adr_hi = I->npc;
@@ -2838,8 +2944,8 @@ static CodeBuf *ProduceCode(unsigned int PC, IMeta *I0)
 	}
 
 	/* show jump+tail code */
-	if ((debug_level('e')>6) && (CurrIMeta>0)) {
-		IMeta *GL = &I0[CurrIMeta-1];
+	if ((debug_level('e')>6) && (nmeta>0)) {
+		IMeta *GL = &I0[nmeta-1];
 		unsigned char *pl = &BaseGenBuf[GL->daddr+GL->len];
 		GCPrint(pl, BaseGenBuf, CodePtr - pl);
 	}
@@ -2848,13 +2954,28 @@ static CodeBuf *ProduceCode(unsigned int PC, IMeta *I0)
 
 	/* shrink buffer to what is actually needed */
 	mall_req = I0->totlen + offsetof(CodeBuf, meta) + sizeof(Addr2Pc) * nap;
-	GenCodeBuf = dlrealloc(GenCodeBuf, mall_req);
+	GenCodeBuf = bg ? realloc(GenCodeBuf, mall_req) :
+		dlrealloc(GenCodeBuf, mall_req);
 	if (debug_level('e')>3)
 		e_printf("Seq len %#x:%#x\n",I0->seqlen,I0->totlen);
 
 	return GenCodeBuf;
 }
 
+/* code which embeds host addresses can't be reused by another process */
+static int CanCacheCode(IMeta *I0)
+{
+	int i, j;
+
+	for (i=0; i<CurrIMeta; i++) {
+	    for (j=0; j<I0[i].ngen; j++) {
+		if (I0[i].gen[j].op == O_INT)
+		    return 0;
+	    }
+	}
+	return 1;
+}
+
 
 /////////////////////////////////////////////////////////////////////////////
 /*
@@ -2921,6 +3042,13 @@ static void NodeLinker(TNode *LG, TNode *G)
 	if (!UseLinker)
 #endif
 	    return;
+	/* nodes whose exits are profiled must always be entered and
+	 * left through Exec_x86 */
+	if ((G->flags & F_TRACE) || (LG && (LG->flags & F_TRACE)))
+	    return;
+	/* nor can the profiler count linked nodes */
+	if (jitprof_on)
+	    return;
 
 #ifdef PROFILE
 	if (debug_level('e')) t0 = GETTSC();
@@ -3164,6 +3292,477 @@ void NodeUnlinker(TNode *G)
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+/*
+ * Trace formation.
+ *
+ * A node ending with a forward conditional jump, whose not taken branch
+ * is the following instruction, is built with the F_TRACE flag. Such a
+ * node is not linked, so it is always entered and left through Exec_x86
+ * and its exits can be counted. After TRACE_THRESHOLD exits:
+ *  - if the jump was (almost) never taken, its not taken address is
+ *    remembered in TraceHints[] and, on its next run, the node is
+ *    dropped together with the node it falls through to. The node gets
+ *    parsed again, and _JumpGen() now compiles the jump as a side exit
+ *    (JF_SIDE) and goes on parsing after it. The fall-through code thus
+ *    becomes part of a longer sequence, which can grow further the same
+ *    way at its own final jump.
+ *  - otherwise the flag is cleared and the node is linked as usual.
+ * A side exit leaves through Exec_x86 too, and stores its hint in
+ * TheCPU.side_exit on the way. If a side exit is taken often after all
+ * (SIDE_EXIT_THRESHOLD), its hint is dropped and so are the nodes with
+ * the jump, which are parsed again and profiled as before.
+ * With $_cpuemu_bgcompile the code for the trace is produced in the
+ * background instead, see below.
+ */
+
+#define TRACE_HINTS	(1<<TRACE_HINT_BITS)
+
+static unsigned int TraceHints[TRACE_HINTS];
+static struct {
+	unsigned int pc;
+	unsigned int cnt;
+} SideExits[TRACE_HINTS];
+static unsigned int SideExitsTaken;
+static unsigned int SideExitDrop;
+
+static inline unsigned int TraceHintIdx(unsigned int pc)
+{
+	return (pc * 0x9e3779b1u) >> (32-TRACE_HINT_BITS);
+}
+
+/* should the jump falling through to pc be compiled as a side exit? */
+int TraceHint(unsigned int pc)
+{
+	return TraceHints[TraceHintIdx(pc)] == pc;
+}
+
+static void TraceProfile(TNode *G, unsigned int ePC)
+{
+	if (ePC == G->clink.t_target)
+		G->tr_t++;
+	else if (ePC == G->clink.nt_target)
+		G->tr_nt++;
+	else	/* left in the middle (signal, fault) */
+		return;
+	if ((G->tr_t + G->tr_nt) >= TRACE_THRESHOLD &&
+	    G->tr_t > TRACE_THRESHOLD/16) {
+		/* both ways are used, nothing to gain */
+		G->flags &= ~F_TRACE;
+	}
+}
+
+/* called after running compiled code if a side exit was taken */
+void SideExitProfile(void)
+{
+	unsigned int pc = TheCPU.side_exit;
+	unsigned int i = TraceHintIdx(pc);
+
+	TheCPU.side_exit = 0;
+	if (++SideExitsTaken % TRACE_HINTS == 0) {
+		unsigned int j;
+		for (j = 0; j < TRACE_HINTS; j++)
+			SideExits[j].cnt >>= 1;
+	}
+	/* count it even without a hint, the trace can come from the
+	 * code cache */
+	if (SideExits[i].pc != pc) {
+		SideExits[i].pc = pc;
+		SideExits[i].cnt = 0;
+	}
+	if (++SideExits[i].cnt < SIDE_EXIT_THRESHOLD)
+		return;
+	SideExits[i].cnt = 0;
+	if (TraceHints[i] == pc)
+		TraceHints[i] = 0;
+	SideExitDrop = pc;
+}
+
+/* called between sequences: drop the nodes with a side exit that
+ * is taken too often, so that they are parsed again */
+void SideExitRebuild(void)
+{
+	unsigned int pc = SideExitDrop;
+
+	if (!pc)
+		return;
+	SideExitDrop = 0;
+	if (debug_level('e')>1)
+		e_printf("Trace: side exit to %08x taken, rebuilding\n", pc);
+	TracesDropped++;
+	/* the last byte of the jump */
+	InvalidateNodeRange(pc - 1, 1, NULL);
+}
+
+/* called before running G; returns 1 if G was dropped to be parsed
+ * again as a trace */
+int BuildTrace(TNode *G)
+{
+	TNode *N;
+
+	if ((G->tr_t + G->tr_nt) < TRACE_THRESHOLD || (G->flags & F_BGTRACE))
+		return 0;
+	if (debug_level('e')>1)
+		e_printf("Trace: node %08x falls through to %08x (%d:%d)\n",
+			G->key, G->clink.nt_target, G->tr_nt, G->tr_t);
+	TraceHints[TraceHintIdx(G->clink.nt_target)] = G->clink.nt_target;
+	N = PeekTree(G->clink.nt_target);
+	if (N == G)
+		N = NULL;
+	TracesBuilt++;
+	if (BgTraceStart(G, N))
+		return 1;
+	if (N)
+		KillNode(N);
+	KillNode(G);
+	return 1;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+/*
+ * Background trace compilation ($_cpuemu_bgcompile).
+ *
+ * A trace is still parsed on the CPU thread, but its code is produced
+ * by a worker thread, while the node it replaces goes on running:
+ *  - BuildTrace() leaves the node G and the node N it falls through to
+ *    in the tree, and the parser does not stop at their code marks
+ *    (BgTraceSkip()).
+ *  - CloseAndExec_x86() hands a copy of the parsed InstrMeta over to
+ *    the worker and runs G instead. The trace must not have left the
+ *    code of G and N, else it is produced here after all.
+ *  - The worker runs ProduceCode() on the copy.
+ *  - FindExecCode() calls BgTracePublish() between sequences. If G and N
+ *    are still in the tree, the guest code they were made from did not
+ *    change, and the code is moved into the tree in place of G, as
+ *    CloseAndExec_x86() would. Otherwise it is dropped, and G becomes
+ *    a trace candidate again.
+ * G and N carry F_BGTRACE meanwhile, so that a node parsed again at the
+ * same address is not taken for them. At most BGTRACE_QUEUE_LEN traces
+ * are on their way at a time; when that many are, a trace is built on
+ * the CPU thread as usual.
+ * Only traces can be produced this way, as there is older code to run
+ * meanwhile. A sequence seen for the first time, or after its code was
+ * invalidated, is produced by CloseAndExec_x86() before it runs: the
+ * x86 backend can't run guest code any other way, and codegen-sim is
+ * an alternative backend for the whole emulator (its own FPU state,
+ * segment bases without mem_base, flags), not a tier to fall back to
+ * for a single sequence.
+ */
+
+struct bgjob {
+	unsigned int pc, key, nkey, cs, env;
+	int mode, nmeta, cacheable;
+	IMeta *imeta;
+	CodeBuf *cb;		/* malloc()ed, NULL if ProduceCode() failed */
+	hitimer_t gentime;
+};
+
+/* the nodes being parsed again as a trace; CPU thread only */
+static struct {
+	int on;
+	unsigned int key, nkey;
+	unsigned int base[2], len[2];
+} BgParse;
+
+static pthread_t bg_thr;
+static int bg_thr_running;
+static pthread_mutex_t bg_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bg_cnd = PTHREAD_COND_INITIALIZER;
+/* to the worker, under bg_mtx */
+static struct bgjob *bg_wq[BGTRACE_QUEUE_LEN];
+static unsigned int bg_wq_head, bg_wq_tail;
+static int bg_stop;
+/* back from the worker; bg_dq_head is released by the worker */
+static struct bgjob *bg_dq[BGTRACE_QUEUE_LEN];
+static unsigned int bg_dq_head, bg_dq_tail;
+/* jobs not yet published, CPU thread only */
+static int bg_pending;
+static int BgTracesDone, BgTracesDropped;
+
+static void *bg_worker(void *arg)
+{
+	struct bgjob *j;
+	hitimer_t t0;
+
+	pthread_mutex_lock(&bg_mtx);
+	for (;;) {
+		while (bg_wq_head == bg_wq_tail && !bg_stop)
+			pthread_cond_wait(&bg_cnd, &bg_mtx);
+		if (bg_stop)
+			break;
+		j = bg_wq[bg_wq_tail++ % BGTRACE_QUEUE_LEN];
+		pthread_mutex_unlock(&bg_mtx);
+
+		t0 = GETTSC();
+		j->cb = ProduceCode(j->pc, j->imeta, j->nmeta, 1);
+		if (GenErr < 0) {
+			free(j->cb);
+			j->cb = NULL;
+		}
+		j->gentime = GETTSC() - t0;
+
+		/* no overflow, there are never more than
+		 * BGTRACE_QUEUE_LEN jobs */
+		bg_dq[bg_dq_head % BGTRACE_QUEUE_LEN] = j;
+		__atomic_store_n(&bg_dq_head, bg_dq_head + 1, __ATOMIC_RELEASE);
+		pthread_mutex_lock(&bg_mtx);
+	}
+	pthread_mutex_unlock(&bg_mtx);
+	return NULL;
+}
+
+static void BgTraceInit(void)
+{
+	BgParse.on = 0;
+	bg_wq_head = bg_wq_tail = bg_dq_head = bg_dq_tail = 0;
+	bg_pending = 0;
+	bg_stop = 0;
+	if (!config.cpuemu_bgcompile)
+		return;
+	if (pthread_create(&bg_thr, NULL, bg_worker, NULL) != 0) {
+		error("simx86: no thread for background trace compile\n");
+		return;
+	}
+#if defined(HAVE_PTHREAD_SETNAME_NP) && defined(__GLIBC__)
+	pthread_setname_np(bg_thr, "dosemu: jitbg");
+#endif
+	bg_thr_running = 1;
+}
+
+static void BgJobFree(struct bgjob *j)
+{
+	free(j->cb);
+	free(j->imeta);
+	free(j);
+}
+
+void BgTraceDone(void)
+{
+	if (!bg_thr_running)
+		return;
+	pthread_mutex_lock(&bg_mtx);
+	bg_stop = 1;
+	pthread_cond_signal(&bg_cnd);
+	pthread_mutex_unlock(&bg_mtx);
+	pthread_join(bg_thr, NULL);
+	bg_thr_running = 0;
+	while (bg_wq_tail != bg_wq_head)
+		BgJobFree(bg_wq[bg_wq_tail++ % BGTRACE_QUEUE_LEN]);
+	while (bg_dq_tail != bg_dq_head)
+		BgJobFree(bg_dq[bg_dq_tail++ % BGTRACE_QUEUE_LEN]);
+	bg_pending = 0;
+	BgParse.on = 0;
+	if (debug_level('e'))
+		dbug_printf("Background traces: %d done, %d dropped\n",
+			    BgTracesDone, BgTracesDropped);
+	BgTracesDone = BgTracesDropped = 0;
+}
+
+static inline int BgParseCovers(unsigned int pc)
+{
+	return pc - BgParse.base[0] <= BgParse.len[0] ||
+		pc - BgParse.base[1] <= BgParse.len[1];
+}
+
+/* the parse is not ended by the code marks of the nodes which are
+ * being parsed again as a trace */
+int BgTraceSkip(unsigned int pc)
+{
+	return BgParse.on && BgParseCovers(pc);
+}
+
+/* the node at key, if it is the one BgTraceStart() flagged */
+static TNode *BgTraceNode(unsigned int key)
+{
+	TNode *G = PeekTree(key);
+
+	return G && (G->flags & F_BGTRACE) ? G : NULL;
+}
+
+static void BgTraceEnd(unsigned int key, unsigned int nkey, int kill)
+{
+	TNode *G = BgTraceNode(key);
+	TNode *N = nkey != key ? BgTraceNode(nkey) : NULL;
+
+	if (N) {
+		N->flags &= ~F_BGTRACE;
+		if (kill)
+			KillNode(N);
+	}
+	if (G) {
+		G->flags &= ~F_BGTRACE;
+		if (kill)
+			KillNode(G);
+	}
+}
+
+/* called by BuildTrace(); returns 1 if the trace for G is to be
+ * produced in the background */
+static int BgTraceStart(TNode *G, TNode *N)
+{
+	if (!bg_thr_running || bg_pending >= BGTRACE_QUEUE_LEN ||
+	    (N && (N->flags & F_BGTRACE)))
+		return 0;
+	/* the last one was never parsed */
+	if (BgParse.on)
+		BgTraceEnd(BgParse.key, BgParse.nkey, 1);
+	BgParse.on = 1;
+	BgParse.key = G->key;
+	BgParse.base[0] = G->seqbase;
+	BgParse.len[0] = G->seqlen;
+	if (N == NULL)
+		N = G;
+	BgParse.nkey = N->key;
+	BgParse.base[1] = N->seqbase;
+	BgParse.len[1] = N->seqlen;
+	G->flags |= F_BGTRACE;
+	N->flags |= F_BGTRACE;
+	return 1;
+}
+
+/*
+ * Called by CloseAndExec_x86() for the sequence parsed after
+ * BgTraceStart(). Queues the sequence for the worker and returns the
+ * node to run instead, or NULL if it has to be produced here; then G
+ * and N are dropped, as BuildTrace() does without the worker.
+ */
+static TNode *BgTraceQueue(unsigned int PC, int mode)
+{
+	TNode *G;
+	struct bgjob *j;
+	int i, ok;
+
+	BgParse.on = 0;
+	G = BgTraceNode(BgParse.key);
+	ok = InstrMeta[0].npc == BgParse.key && G && GoodNode(G, mode) &&
+		(BgParse.nkey == BgParse.key || BgTraceNode(BgParse.nkey)) &&
+		BgParseCovers(PC);
+	/* only the code of G and N is watched for changes */
+	for (i = 0; ok && i < CurrIMeta; i++)
+		ok = BgParseCovers(InstrMeta[i].npc);
+	if (!ok) {
+		BgTraceEnd(BgParse.key, BgParse.nkey, 1);
+		return NULL;
+	}
+
+	/* FlagLiveness() looks at the CPU mode, so it can't run later */
+	FlagLiveness(InstrMeta);
+	j = malloc(sizeof(*j));
+	j->pc = PC;
+	j->key = BgParse.key;
+	j->nkey = BgParse.nkey;
+	j->cs = LONG_CS;
+	j->mode = mode;
+	j->env = jitcache_env();
+	j->nmeta = CurrIMeta;
+	j->cacheable = CanCacheCode(InstrMeta);
+	j->cb = NULL;
+	j->imeta = malloc(sizeof(IMeta) * CurrIMeta);
+	for (i = 0; i < CurrIMeta; i++) {
+		IMeta *I = &InstrMeta[i];
+		int k;
+
+		memcpy(&j->imeta[i], I, (char *)&I->gen[I->ngen] - (char *)I);
+		/* the jump ops point to the linkdesc of InstrMeta[0] */
+		for (k = 0; k < I->ngen; k++) {
+			if (I->gen[k].op >= JMP_INDIRECT &&
+			    I->gen[k].op <= JLOOP_LINK)
+				j->imeta[i].gen[k].lt = &j->imeta[0].clink;
+		}
+	}
+
+	/* as Move2Tree() would */
+	CurrIMeta = -1;
+	memset(&InstrMeta[0], 0, sizeof(IMeta));
+
+	pthread_mutex_lock(&bg_mtx);
+	bg_wq[bg_wq_head++ % BGTRACE_QUEUE_LEN] = j;
+	pthread_cond_signal(&bg_cnd);
+	pthread_mutex_unlock(&bg_mtx);
+	bg_pending++;
+	if (debug_level('e')>1)
+		e_printf("Trace: %08x queued for the background\n", j->key);
+	return G;
+}
+
+static void BgTraceInsert(struct bgjob *j)
+{
+	TNode *G;
+	IMeta *I0 = j->imeta;
+	CodeBuf *cb;
+	unsigned char *code, *bgcode;
+	int i, nap;
+
+	/* a write to the code of G or N would have invalidated them */
+	G = BgTraceNode(j->key);
+	if (G == NULL || (j->nkey != j->key && !BgTraceNode(j->nkey))) {
+		BgTraceEnd(j->key, j->nkey, 0);
+		goto drop;
+	}
+	if (j->cb == NULL) {
+		/* don't try again */
+		G->flags &= ~F_TRACE;
+		BgTraceEnd(j->key, j->nkey, 0);
+		goto drop;
+	}
+
+	nap = I0->ncount + 1;
+	cb = dlmalloc(offsetof(CodeBuf, meta) + sizeof(Addr2Pc) * nap +
+		      I0->totlen);
+	code = (unsigned char *)&cb->meta[nap];
+	bgcode = (unsigned char *)&j->cb->meta[nap];
+	memcpy(code, bgcode, I0->totlen);
+	if (I0->clink.t_type == 0)	/* tail code added by ProduceCode */
+		I0->clink.t_link.abs = (unsigned int *)
+			(code + ((unsigned char *)I0->clink.t_link.abs - bgcode));
+	for (i = 0; i < j->nmeta; i++)
+		memcpy(&InstrMeta[i], &I0[i], offsetof(IMeta, gen));
+
+	if (debug_level('e')>1)
+		e_printf("Trace: %08x from the background\n", j->key);
+	BgTraceEnd(j->key, j->nkey, 1);
+	NodesParsed++;
+#ifdef PROFILE
+	if (debug_level('e')) TotalNodesParsed++;
+#endif
+	if (j->cacheable)
+		jitcache_store(InstrMeta, cb, j->cs, j->mode, j->env);
+	G = Move2Tree(InstrMeta, cb);
+	e_markpage(G->seqbase, G->seqlen);
+	e_mprotect(G->seqbase, G->seqlen);
+	G->cs = j->cs;
+	G->mode = j->mode;
+	if (jitprof_on)
+		jitprof_gen(G, j->gentime);
+	NodeLinker(G, G);
+	BgTracesDone++;
+	return;
+
+drop:
+	if (debug_level('e')>1)
+		e_printf("Trace: %08x from the background dropped\n", j->key);
+	BgTracesDropped++;
+}
+
+/* called between sequences: move the traces the worker has done into
+ * the tree */
+void BgTracePublish(void)
+{
+	struct bgjob *j;
+
+	/* InstrMeta is in use while a sequence is being parsed */
+	if (!bg_pending || CurrIMeta >= 0)
+		return;
+	while (bg_dq_tail != __atomic_load_n(&bg_dq_head, __ATOMIC_ACQUIRE)) {
+		j = bg_dq[bg_dq_tail++ % BGTRACE_QUEUE_LEN];
+		bg_pending--;
+		BgTraceInsert(j);
+		BgJobFree(j);
+	}
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
 /*
  * These are the functions which actually executes the generated code.
@@ -3192,6 +3791,7 @@ static unsigned int CloseAndExec_x86(unsigned int PC, int mode, int ln)
 	IMeta *I0;
 	TNode *G;
 	CodeBuf *GenCodeBuf;
+	hitimer_t tp = 0;
 
 	if (CurrIMeta <= 0) {
 /**/		e_printf("(X) Nothing to exec at %08x\n",PC);
@@ -3204,16 +3804,26 @@ static unsigned int CloseAndExec_x86(unsigned int PC, int mode, int ln)
 	if (debug_level('e')>2) {
 		e_printf("== (%d) == Closing sequence at %08x\n",ln,PC);
 	}
+	if (BgParse.on && (G = BgTraceQueue(PC, mode)) != NULL)
+		return Exec_x86(G, ln);
 
-	GenCodeBuf = ProduceCode(PC, I0);
+	if (jitprof_on)
+		tp = GETTSC();
+	FlagLiveness(I0);
+	GenCodeBuf = ProduceCode(PC, I0, CurrIMeta, 0);
 	/* check for fatal error */
-	if (TheCPU.err < 0)
+	if (GenErr < 0) {
+		TheCPU.err = GenErr;
 		return I0->npc;
+	}
 
 	NodesParsed++;
 #ifdef PROFILE
 	if (debug_level('e')) TotalNodesParsed++;
 #endif
+	if (CanCacheCode(I0))
+		jitcache_store(I0, GenCodeBuf, LONG_CS, mode,
+			       jitcache_env());
 	G = Move2Tree(I0, GenCodeBuf);		/* when is G==NULL? */
 	/* InstrMeta will be zeroed at this point */
 	/* mprotect the page here; a page fault will be triggered
@@ -3223,11 +3833,58 @@ static unsigned int CloseAndExec_x86(unsigned int PC, int mode, int ln)
 	e_mprotect(G->seqbase, G->seqlen);
 	G->cs = LONG_CS;
 	G->mode = mode;
+	if (jitprof_on)
+		jitprof_gen(G, GETTSC() - tp);
 	/* check links INSIDE current node */
 	NodeLinker(G, G);
 	return Exec_x86(G, ln);
 }
 
+/*
+ * Called when PC was not found in the tree: try to take the sequence
+ * from the persistent code cache instead of translating it again.
+ */
+TNode *FindCachedCode(unsigned int PC, int mode)
+{
+	CodeBuf *GenCodeBuf;
+	TNode *G;
+	hitimer_t tp = 0;
+
+	/* InstrMeta is in use while a sequence is being parsed */
+	if (CurrIMeta >= 0)
+		return NULL;
+	if (jitprof_on)
+		tp = GETTSC();
+	GenCodeBuf = jitcache_fetch(PC, LONG_CS, mode, jitcache_env(),
+				    InstrMeta);
+	if (GenCodeBuf == NULL)
+		return NULL;
+	if ((InstrMeta[0].flags & F_TRACE) &&
+	    InstrMeta[0].clink.t_type > JMP_LINK) {
+		/* stored before it was turned into a trace? The not taken
+		 * target is read from the code, as Move2Tree() does */
+		unsigned char *code = (unsigned char *)
+			&GenCodeBuf->meta[InstrMeta[0].ncount + 1];
+		if (TraceHint(*(unsigned int *)
+				(code + InstrMeta[0].clink.nt_link.rel))) {
+			dlfree(GenCodeBuf);
+			memset(&InstrMeta[0], 0, sizeof(IMeta));
+			return NULL;
+		}
+	}
+	if (debug_level('e')>2)
+		e_printf("** Found cached code at %08x\n",PC);
+	G = Move2Tree(InstrMeta, GenCodeBuf);
+	e_markpage(G->seqbase, G->seqlen);
+	e_mprotect(G->seqbase, G->seqlen);
+	G->cs = LONG_CS;
+	G->mode = mode;
+	if (jitprof_on)
+		jitprof_gen(G, GETTSC() - tp);
+	NodeLinker(G, G);
+	return G;
+}
+
 static unsigned int Exec_x86_pre(unsigned char *ecpu)
 {
 	unsigned long flg;
@@ -3340,7 +3997,12 @@ unsigned int Exec_x86(TNode *G, int ln)
 			: "=a"(TimeStartExec.t.tl),"=d"(TimeStartExec.t.th)
 		);
 
-	ePC = Exec_x86_asm(&mem_ref, &flg, ecpu, SeqStart);
+	if (G->prof) {
+		hitimer_t tp = GETTSC();
+		ePC = Exec_x86_asm(&mem_ref, &flg, ecpu, SeqStart);
+		jitprof_exec(G, GETTSC() - tp);
+	} else
+		ePC = Exec_x86_asm(&mem_ref, &flg, ecpu, SeqStart);
 
 	if (eTimeCorrect >= 0)
 		__asm__ __volatile__ (
@@ -3349,6 +4011,10 @@ unsigned int Exec_x86(TNode *G, int ln)
 		);
 
 	Exec_x86_post(flg, mem_ref);
+	if (G->flags & F_TRACE)
+		TraceProfile(G, ePC);
+	if (TheCPU.side_exit)
+		SideExitProfile();
 
 	/* was there at least one FP op in the sequence? */
 	if (seqflg & F_FPOP) {
@@ -3449,7 +4115,16 @@ unsigned int Exec_x86_fast(TNode *G)
 	unsigned mode = G->mode;
 
 	do {
-		ePC = Exec_x86_asm(&mem_ref, &flg, ecpu, G->addr);
+		if (G->prof) {
+			hitimer_t tp = GETTSC();
+			ePC = Exec_x86_asm(&mem_ref, &flg, ecpu, G->addr);
+			jitprof_exec(G, GETTSC() - tp);
+		} else
+			ePC = Exec_x86_asm(&mem_ref, &flg, ecpu, G->addr);
+		if (G->flags & F_TRACE)
+			TraceProfile(G, ePC);
+		if (TheCPU.side_exit)
+			SideExitProfile();
 		if (G->alive > 0) {
 			if (LastXNode->clink.unlinked_jmp_targets &&
 			    (LastXNode->clink.t_target == G->key ||
@@ -3462,7 +4137,7 @@ unsigned int Exec_x86_fast(TNode *G)
 			break;
 		}
 	} while (!TheCPU.err && (G=FindTree(ePC)) &&
-		 GoodNode(G, mode) && !(G->flags & (F_FPOP|F_INHI)));
+		 GoodNode(G, mode) && !(G->flags & (F_FPOP|F_INHI|F_TRACE)));
 
 	Exec_x86_post(flg, mem_ref);
 	TheCPU.sigalrm_pending = 0;
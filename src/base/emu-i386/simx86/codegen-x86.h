@@ -49,6 +49,7 @@
 extern unsigned int VgaAbsBankBase;
 extern unsigned int Exec_x86(TNode *G, int ln);
 extern unsigned int Exec_x86_fast(TNode *G);
+extern TNode *FindCachedCode(unsigned int PC, int mode);
 
 /////////////////////////////////////////////////////////////////////////////
 
@@ -75,6 +76,14 @@ extern unsigned int Exec_x86_fast(TNode *G);
 #define PopPushF(Cp)	if (((Cp)==BaseGenBuf)||((Cp)[-1]!=PUSHF)) \
 				G2(0x9c9d,(Cp))
 
+// ops marked NOFLAGS produce flags which are never read: the previous
+// flags are left on the stack and nothing is pushed back.
+// GetFlags: pop %%edx or movl (%%esp),%%edx
+#define GetFlags(Cp)	{ if (mode & NOFLAGS) G3M(0x8b,0x14,0x24,Cp) \
+			  else G1(POPdx,Cp); }
+#define DropFlags(Cp)	{ if (!(mode & NOFLAGS)) G1(POPdx,Cp); }
+#define PutFlags(Cp)	{ if (!(mode & NOFLAGS)) G1(PUSHF,Cp); }
+
 // cld; btl $0xa,EFLAGS(%ebx); jnc 1f; std; 1f:
 #define GetDF(Cp)		\
   G4M(CLD,TwoByteESC,0xba,0x63,Cp);	\
@@ -115,6 +124,13 @@ extern unsigned int Exec_x86_fast(TNode *G);
 unsigned char *Fp87_op_x86(unsigned char *CodePtr, int exop, int reg);
 void InitGen_x86(void);
 void NodeUnlinker(TNode *G);
+int TraceHint(unsigned int pc);
+void SideExitProfile(void);
+void SideExitRebuild(void);
+int BuildTrace(TNode *G);
+int BgTraceSkip(unsigned int pc);
+void BgTracePublish(void);
+void BgTraceDone(void);
 
 extern unsigned char TailCode[];
 
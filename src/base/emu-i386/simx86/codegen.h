@@ -150,6 +150,7 @@
 #define JB_LINK		114
 #define JF_LINK		115
 #define JLOOP_LINK	116
+#define JF_SIDE		117	// side exit of a trace, sequence goes on
 
 /////////////////////////////////////////////////////////////////////////////
 //
@@ -186,12 +187,15 @@
 // for HOST_ARCH_X86
 #define MREPCOND 0x01000000	// this is SCASx or CMPSx, REP can be terminated
 				// by flags
+#define NOFLAGS	0x02000000	// flags produced by the op are dead
 
 // values for TNode.flags and IMeta.flags
 #define F_FPOP	0x0001
 #define F_HITC	0x0002
 #define F_SLFL	0x0004
 #define F_INHI	0x0008
+#define F_TRACE	0x0010	// exits are being profiled, don't link
+#define F_BGTRACE 0x0020	// trace code is being produced in the background
 
 /////////////////////////////////////////////////////////////////////////////
 
@@ -54,6 +54,7 @@ void m_munprotect(unsigned int addr, unsigned int len, unsigned char *eip)
 	}
 	/* if only data in aliased low memory is hit, nothing to do */
 	if (LINEAR2UNIX(addr) != MEM_BASE32(addr)) {
+		e_mpwrite(addr, len);
 		if (e_querymark(addr, len))
 			// no need to invalidate the whole page here,
 			// as the page does not need to be unprotected
@@ -70,6 +71,55 @@ void m_munprotect(unsigned int addr, unsigned int len, unsigned char *eip)
 	InvalidateNodeRange(addr,len,eip);
 }
 
+/*
+ * Single patched stores only drop the nodes overlapping the written
+ * bytes. If code remains in the page it stays protected and 1 is
+ * returned: the store then has to go through e_mwindow(), which costs
+ * two mprotect()s. A page written that way more than MWRITE_WINDOWS
+ * times holds busy data next to the code, so then its code is dropped
+ * and the page is unprotected once, as m_munprotect() does.
+ */
+static struct {
+	unsigned int page;
+	int cnt;
+} mwrite_pages[1 << MWRITE_PAGE_BITS];
+
+static int m_mwrite(unsigned int addr, unsigned int len, unsigned char *eip)
+{
+	int hit = e_querymark(addr, len);
+	int i;
+
+	if (debug_level('e')>1) {
+		if (debug_level('e')>3)
+			e_printf("\tM_MWRITE %08x:%p\n", addr,eip);
+		if (hit)
+			e_printf("CODE %08x hit in DATA %p patch\n",addr,eip);
+	}
+	e_mpwrite(addr, len);
+	if (hit)
+		InvalidateNodeRange(addr,len,eip);
+	/* aliased low memory is written through the alias */
+	if (LINEAR2UNIX(addr) != MEM_BASE32(addr))
+		return 0;
+	/* the last code in the page was hit, it is unprotected now */
+	if (!e_querymprotrange(addr, len))
+		return 0;
+	i = (addr >> PAGE_SHIFT) & ((1 << MWRITE_PAGE_BITS) - 1);
+	if (mwrite_pages[i].page != (addr & PAGE_MASK)) {
+		mwrite_pages[i].page = addr & PAGE_MASK;
+		mwrite_pages[i].cnt = 0;
+	}
+	if (++mwrite_pages[i].cnt > MWRITE_WINDOWS) {
+		mwrite_pages[i].cnt = 0;
+		m_munprotect(addr, len, eip);
+		return e_querymprotrange(addr, len);
+	}
+#ifdef PROFILE
+	if (debug_level('e') && !hit) PageFaultsAvoided++;
+#endif
+	return 1;
+}
+
 #define repmovs(std,letter,cld)			       \
 	asm volatile(#std" ; rep ; movs"#letter ";" #cld"\n\t" \
 		     : "=&c" (ecx), "=&D" (edi), "=&S" (esi)   \
@@ -248,57 +298,72 @@ asmlinkage void stk_32(unsigned char *paddr, Bit32u value)
 asmlinkage void wri_8(unsigned char *paddr, Bit8u value, unsigned char *eip)
 {
 	dosaddr_t addr;
+	int win;
 
 	in_cpatch++;
 	assert(InCompiledCode);
 	InCompiledCode--;
 	addr = DOSADDR_REL(paddr);
-	m_munprotect(addr, 1, eip);
+	win = m_mwrite(addr, 1, eip);
 	InCompiledCode++;
+	if (win)
+		e_mwindow(addr, 1, 1);
 	if (!emu_ldt_write(paddr, value, 1)) {
 		if (vga_write_access(addr))
 			vga_write(addr, value);
 		else
 			WRITE_BYTE(addr,value);
 	}
+	if (win)
+		e_mwindow(addr, 1, 0);
 	in_cpatch--;
 }
 
 asmlinkage void wri_16(unsigned char *paddr, Bit16u value, unsigned char *eip)
 {
 	dosaddr_t addr;
+	int win;
 
 	in_cpatch++;
 	assert(InCompiledCode);
 	InCompiledCode--;
 	addr = DOSADDR_REL(paddr);
-	m_munprotect(addr, 2, eip);
+	win = m_mwrite(addr, 2, eip);
 	InCompiledCode++;
+	if (win)
+		e_mwindow(addr, 2, 1);
 	if (!emu_ldt_write(paddr, value, 2)) {
 		if (vga_write_access(addr))
 			vga_write_word(addr, value);
 		else
 			WRITE_WORD(addr,value);
 	}
+	if (win)
+		e_mwindow(addr, 2, 0);
 	in_cpatch--;
 }
 
 asmlinkage void wri_32(unsigned char *paddr, Bit32u value, unsigned char *eip)
 {
 	dosaddr_t addr;
+	int win;
 
 	in_cpatch++;
 	assert(InCompiledCode);
 	InCompiledCode--;
 	addr = DOSADDR_REL(paddr);
-	m_munprotect(addr, 4, eip);
+	win = m_mwrite(addr, 4, eip);
 	InCompiledCode++;
+	if (win)
+		e_mwindow(addr, 4, 1);
 	if (!emu_ldt_write(paddr, value, 4)) {
 		if (vga_write_access(addr))
 			vga_write_dword(addr, value);
 		else
 			WRITE_DWORD(addr,value);
 	}
+	if (win)
+		e_mwindow(addr, 4, 0);
 	in_cpatch--;
 }
 
@@ -908,12 +908,9 @@ static void print_statistics(void)
 		k = ((long long)NodesFound * 100UL) /
 			(long long)TotalNodesExecd;
 		dbug_printf("Find hits         %16d (%lld%%)\n",NodesFound,k);
-		k = ((long long)NodesFastFound * 100UL) /
-			(long long)TotalNodesExecd;
-		dbug_printf("Find last hits    %16d (%lld%%)\n",
-			    NodesFastFound,k);
 	}
 	dbug_printf("Page faults       %16d\n",PageFaults);
+	dbug_printf("Faults avoided    %16d\n",PageFaultsAvoided);
 	dbug_printf("Signals received  %16d\n",EmuSignals);
 	dbug_printf("Tree cleanups     %16d\n",TreeCleanups);
 #endif
@@ -52,7 +52,34 @@
 #undef	ASM_DUMP
 #define ASM_DUMP_FILE	"/DOS/asmdump.log"
 
-#define AVL_MAX_HEIGHT	20
+/* enough for an AVL tree holding NODES_IN_POOL nodes */
+#define AVL_MAX_HEIGHT	32
+/* log2 of the node hash size, keep it well above NODES_IN_POOL */
+#define NODEHASH_BITS	18
+
+/* a forward Jcc taken the same way this many times becomes part of a
+ * trace; log2 of the size of the table remembering such branches */
+#define TRACE_THRESHOLD	64
+#define TRACE_HINT_BITS	12
+/* a side exit taken this many times drops its hint and the trace; the
+ * counts are halved every 1<<TRACE_HINT_BITS side exits */
+#define SIDE_EXIT_THRESHOLD	16
+
+/* patched stores into a page that still has code go through a write
+ * window this many times, then the page is unprotected as a whole;
+ * log2 of the number of pages counted */
+#define MWRITE_WINDOWS	4
+#define MWRITE_PAGE_BITS	6
+
+/* size limit for the persistent code cache file ($_cpuemu_cache) */
+#define JITCACHE_MAX_SIZE	(64*1024*1024)
+/* stores waiting for the code cache writer thread */
+#define JITCACHE_QUEUE_LEN	256
+/* traces on their way to or from the background code generator
+ * ($_cpuemu_bgcompile) */
+#define BGTRACE_QUEUE_LEN	16
+/* seconds between dumps of the jit profile ($_cpuemu_profile) */
+#define JITPROF_PERIOD	5
 #undef	DEBUG_TREE
 #define DEBUG_TREE_FILE	"/DOS/treedump.log"
 
@@ -66,9 +93,10 @@
 #undef	DEBUG_VGA
 
 #define NODES_IN_POOL	100000
-#define NODELIFE(n)	200
-#define CLEAN_SPEED(n)	(((n)<<2)+1)
-#define AGENODE		CreationIndex
+/* TNode.alive of live nodes: every lookup sets NODE_USED, the eviction
+ * clock ages a node to NODE_AGED once before evicting it */
+#define NODE_USED	2
+#define NODE_AGED	1
 
 #undef	TRAP_RETRACE
 
@@ -700,6 +700,7 @@ extern int Running;		/* into interpreter loop */
 extern unsigned int mMaxMem;
 extern int UseLinker;
 extern int PageFaults;
+extern int PageFaultsAvoided;
 
 extern volatile int CEmuStat;
 extern volatile int InCompiledCode;
@@ -734,6 +735,10 @@ void Cpu2Reg (void);
 int e_debug_check(unsigned int PC);
 int e_mprotect(unsigned int addr, size_t len);
 int e_querymprotrange(unsigned int addr, size_t len);
+void e_mpwrite(unsigned int addr, size_t len);
+uint64_t e_mpgen(void);
+int e_mpunchanged(unsigned int addr, size_t len, uint64_t gen);
+void e_mwindow(unsigned int addr, size_t len, int wr);
 int e_markpage(unsigned int addr, size_t len);
 int e_unmarkpage(unsigned int addr, size_t len);
 int e_querymark(unsigned int addr, size_t len);
@@ -203,6 +203,8 @@ static unsigned int _JumpGen(unsigned int P2, int mode, int opc,
 		    d_nt = P1 - LONG_CS + dsp2;
 		    if (mode&DATA16) d_nt &= 0xffff;
 		    j_nt = d_nt + LONG_CS;
+		    /* the sequence, and its code marks, end after the jmp */
+		    *r_P0 = P1 + 2;
 		    if (debug_level('e')>1)
 			e_printf("JMPs (%02x,%d) at %08x after Jcc: t=%08x nt=%08x\n",
 				 Fetch(P1),dsp2,P1,j_t,j_nt);
@@ -214,6 +216,7 @@ static unsigned int _JumpGen(unsigned int P2, int mode, int opc,
 		    d_nt = P1 - LONG_CS + dsp2;
 		    if (mode&DATA16) d_nt &= 0xffff;
 		    j_nt = d_nt + LONG_CS;
+		    *r_P0 = P1 + skp2;
 		    if (debug_level('e')>1)
 			e_printf("JMPl (%02x,%d) at %08x after Jcc: t=%08x nt=%08x\n",
 				 Fetch(P1),dsp2,P1,j_t,j_nt);
@@ -250,6 +253,21 @@ static unsigned int _JumpGen(unsigned int P2, int mode, int opc,
 		    /* forward jump or backward jump >=256 bytes */
 		    if (CONFIG_CPUSIM)
 			Gen(JF_LINK, mode, opc, P2, j_t, j_nt);
+#if !defined(SINGLESTEP)
+		    else if (dsp > pskip && opc != JCXZ &&
+			     j_nt == P2 + pskip && !(EFLAGS & TF)) {
+			/* the not taken branch is the next instruction:
+			 * if it was found to be the hot one, leave by a
+			 * side exit if taken and go on parsing, else
+			 * let the exits of the node be profiled */
+			if (TraceHint(j_nt)) {
+			    Gen(JF_SIDE, mode, opc, j_t, j_nt);
+			    return j_nt;
+			}
+			Gen(JF_LINK, mode, opc, P2, j_t, j_nt, &InstrMeta[0].clink);
+			InstrMeta[CurrIMeta].flags |= F_TRACE;
+		    }
+#endif
 		    else
 			Gen(JF_LINK, mode, opc, P2, j_t, j_nt, &InstrMeta[0].clink);
 		}
@@ -358,6 +376,8 @@ static unsigned int FindExecCode(unsigned int PC)
 		PC = CloseAndExec(PC, mode, __LINE__);
 		if (TheCPU.err) return PC;
 	}
+	SideExitRebuild();
+	BgTracePublish();
 	/* for a sequence to be found, it must begin with
 	 * an allowable opcode. Look into table.
 	 * NOTE - this while can loop forever and stop
@@ -365,11 +385,14 @@ static unsigned int FindExecCode(unsigned int PC)
 	 * a 'descheduling point' for checking signals.
 	 */
 	while (!(CEmuStat & (CeS_TRAP|CeS_DRTRAP|CeS_SIGPEND)) &&
-	       (G=FindTree(PC))) {
+	       ((G=FindTree(PC)) || (G=FindCachedCode(PC, mode)))) {
 		if (!GoodNode(G, mode)) {
 			InvalidateNodeRange(G->seqbase, G->seqlen, NULL);
 			return PC;
 		}
+		/* hot fall-through: parse it again as a trace */
+		if ((G->flags & F_TRACE) && BuildTrace(G))
+			return PC;
 		if (debug_level('e')>2)
 			e_printf("** Found compiled code at %08x\n",PC);
 		if (debug_level('e') &&
@@ -408,6 +431,8 @@ static unsigned int FindExecCode(unsigned int PC)
 			break;
 		}
 		if (TheCPU.err) return PC;
+		SideExitRebuild();
+		BgTracePublish();
 	}
 	return PC;
 }
@@ -495,7 +520,7 @@ static unsigned int _Interp86(unsigned int PC, int basemode)
 				CEmuStat |= CeS_TRAP;
 		}
 #ifdef HOST_ARCH_X86
-		if (!CONFIG_CPUSIM && e_querymark(PC, 1)) {
+		if (!CONFIG_CPUSIM && e_querymark(PC, 1) && !BgTraceSkip(PC)) {
 			unsigned int P2 = PC;
 			if (NewNode) {
 				P0 = PC;
@@ -513,7 +538,8 @@ static unsigned int _Interp86(unsigned int PC, int basemode)
 				}
 			}
 #endif
-			if (P2 == PC || e_querymark(P2, 1)) {
+			if ((P2 == PC || e_querymark(P2, 1)) &&
+			    !BgTraceSkip(P2)) {
 				/* slow path */
 				InvalidateNodeRange(P2, 1, NULL);
 			}
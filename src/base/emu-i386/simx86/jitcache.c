@@ -0,0 +1,583 @@
+/*
+ * (C) Copyright 1992, ..., 2014 the "DOSEMU-Development-Team".
+ *
+ * for details see file COPYING in the DOSEMU distribution
+ */
+
+/*
+ * Persistent code cache for the x86 JIT.
+ *
+ * Code sequences produced by ProduceCode() are appended to a file
+ * together with their Addr2Pc tables, keyed by start PC, CS base and
+ * CPU mode, and with a hash of the guest bytes they were translated
+ * from. On a later run (or after the node was cleaned from the tree)
+ * a sequence is taken from the file instead of being parsed and
+ * generated again, provided the guest bytes still hash the same.
+ *
+ * The generated code only refers to the host through %ebx (TheCPU)
+ * and the stubs reached from there, so it can be reused as long as
+ * the dosemu binary itself did not change. Sequences that embed host
+ * addresses are never stored (see ProduceCode).
+ *
+ * All file I/O is done by a worker thread, so that neither loading the
+ * index at startup nor appending new sequences stalls the CPU thread:
+ * until the worker has published the index (jc_ready) the cache simply
+ * misses, and stores are handed over through a small queue and dropped
+ * if the worker falls behind.
+ *
+ * Several dosemu instances can share the file, and each has it mapped.
+ * So the file is only ever appended to, under flock(), up to
+ * JITCACHE_MAX_SIZE; it is never truncated. To discard it, a new file
+ * is written and renamed over it, and an instance that finds that its
+ * file was replaced this way switches to the new one, if it is from
+ * the same build.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "emu86.h"
+#include "dlmalloc.h"
+#include "codegen-arch.h"
+#include "dosemu_config.h"
+#include "utilities.h"
+#include "dos2linux.h"
+#include "jitcache.h"
+
+#ifdef HOST_ARCH_X86
+
+#define JC_MAGIC	"DOSJITC1"
+
+struct jc_hdr {
+	char magic[8];
+	uint64_t build_id;
+};
+
+/* on-disk record; followed by Addr2Pc[ncount+1] and totlen code bytes */
+struct jc_rec {
+	uint32_t reclen;
+	uint32_t pc, cs, mode, env;
+	uint32_t seqbase, seqlen, srclen;
+	uint64_t srchash;
+	uint16_t ncount, flags, totlen, t_type;
+	uint32_t t_rel, nt_rel;
+} __attribute__((packed));
+
+struct jc_ent {
+	struct jc_ent *next;
+	const struct jc_rec *rec;
+	void *mem;		/* rec, if stored during this run */
+	uint64_t gen;		/* e_mpgen() when the guest bytes were hashed */
+	int src_ok;		/* and if they matched */
+};
+
+#define JC_HASH_BITS	14
+#define JC_HASH_SIZE	(1<<JC_HASH_BITS)
+
+static struct jc_ent *jc_hash[JC_HASH_SIZE];
+static int jc_fd = -1;
+static char *jc_path;
+static void *jc_map;
+static size_t jc_mapsize;
+static off_t jc_filesize;
+static uint64_t jc_build_id;
+
+/* written by the worker before jc_ready is set, read-only after that */
+static int jc_ready;
+static pthread_t jc_thr;
+static int jc_thr_running;
+static pthread_mutex_t jc_wq_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jc_wq_cnd = PTHREAD_COND_INITIALIZER;
+static const struct jc_rec *jc_wq[JITCACHE_QUEUE_LEN];
+static unsigned int jc_wq_head, jc_wq_tail;
+static int jc_wq_stop;
+
+static int jc_hits, jc_misses, jc_stale, jc_stores, jc_dropped;
+
+/*
+ * Parse time state the code depends on besides cs and mode: the INT,
+ * IRET, POPF, CLI and STI paths look at IOPL, VM and CR4.VME/PVI, TF
+ * stops jump folding, and far jumps to the video BIOS are special.
+ */
+unsigned int jitcache_env(void)
+{
+	return (EFLAGS & (EFLAGS_IOPL_MASK | EFLAGS_VM | EFLAGS_TF)) |
+	       (TheCPU.cr[4] & (CR4_VME | CR4_PVI)) |
+	       ((config.vbios_seg >> 12) & 0xf) << 24;
+}
+
+static inline unsigned jc_hidx(unsigned pc, unsigned cs, unsigned mode)
+{
+	return ((pc ^ (cs * 0x9e3779b1u) ^ (mode << 7)) * 0x9e3779b1u) >>
+		(32 - JC_HASH_BITS);
+}
+
+static inline uint64_t fnv1a(uint64_t h, unsigned char c)
+{
+	return (h ^ c) * 0x100000001b3ULL;
+}
+
+static uint64_t hash_guest(unsigned int addr, unsigned int len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	unsigned int i;
+
+	for (i = 0; i < len; i++)
+		h = fnv1a(h, read_byte(addr + i));
+	return h;
+}
+
+/* Bytes of guest code covered by a sequence. seqlen stops at the start
+ * of the last instruction when the sequence ends with a backward jump,
+ * so add room for one more instruction without crossing into the next
+ * page, which could be unmapped. */
+static unsigned int guest_len(unsigned int seqbase, unsigned int seqlen)
+{
+	unsigned int end = seqbase + seqlen;
+	unsigned int pgend = (end | (PAGE_SIZE - 1)) + 1;
+
+	end += 15;
+	if (end > pgend)
+		end = pgend;
+	return end - seqbase;
+}
+
+/* The translation depends on the code generator, so tie the cache file
+ * to the exact dosemu binary that wrote it. */
+static uint64_t get_build_id(void)
+{
+	struct stat st;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	uint64_t v[5];
+	unsigned i;
+
+	if (stat("/proc/self/exe", &st) != 0)
+		return 0;
+	v[0] = st.st_size;
+	v[1] = st.st_mtime;
+	v[2] = sizeof(IMeta);
+	v[3] = sizeof(struct jc_rec);
+	v[4] = TAILSIZE;
+	for (i = 0; i < sizeof(v); i++)
+		h = fnv1a(h, ((unsigned char *)v)[i]);
+	return h;
+}
+
+static void jc_add(const struct jc_rec *rec, void *mem)
+{
+	struct jc_ent *e = malloc(sizeof(*e));
+	unsigned h = jc_hidx(rec->pc, rec->cs, rec->mode);
+
+	e->rec = rec;
+	e->mem = mem;
+	e->gen = 0;
+	e->src_ok = 0;
+	e->next = jc_hash[h];
+	jc_hash[h] = e;
+}
+
+/*
+ * Replace the file by a new one with a header and the first len bytes
+ * of records of recs. The old file is left as it is, for the instances
+ * that still have it mapped.
+ */
+static int jc_replace_file(const void *recs, size_t len)
+{
+	struct jc_hdr hdr;
+	char tmp[strlen(jc_path) + 8];
+	int fd;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, JC_MAGIC, sizeof(hdr.magic));
+	hdr.build_id = jc_build_id;
+	sprintf(tmp, "%s.XXXXXX", jc_path);
+	fd = mkostemp(tmp, O_APPEND | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    (len && write(fd, recs, len) != len) ||
+	    rename(tmp, jc_path) != 0) {
+		unlink(tmp);
+		close(fd);
+		return -1;
+	}
+	flock(fd, LOCK_EX);
+	close(jc_fd);
+	jc_fd = fd;
+	jc_filesize = sizeof(hdr) + len;
+	return 0;
+}
+
+/*
+ * Called on the worker with jc_fd locked: if another instance replaced
+ * the file, continue with the new one, which must be from this build.
+ */
+static int jc_check_file(void)
+{
+	struct stat st, st2;
+	struct jc_hdr hdr;
+	int fd;
+
+	if (stat(jc_path, &st) != 0 || fstat(jc_fd, &st2) != 0)
+		return -1;
+	if (st.st_dev == st2.st_dev && st.st_ino == st2.st_ino)
+		return 0;
+	fd = open(jc_path, O_RDWR | O_APPEND | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	flock(fd, LOCK_EX);
+	if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    memcmp(hdr.magic, JC_MAGIC, sizeof(hdr.magic)) != 0 ||
+	    hdr.build_id != jc_build_id) {
+		close(fd);
+		return -1;
+	}
+	close(jc_fd);
+	jc_fd = fd;
+	return 0;
+}
+
+/* runs on the worker: validate the file and index its records */
+static int jc_load(void)
+{
+	struct stat st;
+	const struct jc_hdr *hdr;
+	size_t off;
+
+	flock(jc_fd, LOCK_EX);
+	if (fstat(jc_fd, &st) != 0 || st.st_size < sizeof(*hdr) ||
+	    st.st_size > JITCACHE_MAX_SIZE) {
+		if (jc_replace_file(NULL, 0) != 0)
+			goto err;
+		flock(jc_fd, LOCK_UN);
+		return 0;
+	}
+	jc_mapsize = st.st_size;
+	jc_map = mmap(NULL, jc_mapsize, PROT_READ, MAP_PRIVATE, jc_fd, 0);
+	if (jc_map == MAP_FAILED) {
+		jc_map = NULL;
+		goto err;
+	}
+	hdr = jc_map;
+	if (memcmp(hdr->magic, JC_MAGIC, sizeof(hdr->magic)) != 0 ||
+	    hdr->build_id != jc_build_id) {
+		e_printf("simx86: code cache is from another build, discarded\n");
+		munmap(jc_map, jc_mapsize);
+		jc_map = NULL;
+		if (jc_replace_file(NULL, 0) != 0)
+			goto err;
+		flock(jc_fd, LOCK_UN);
+		return 0;
+	}
+	/* index all complete records; a file with a truncated tail is
+	 * replaced by one without it, as appending to it would be lost */
+	off = sizeof(*hdr);
+	while (off + sizeof(struct jc_rec) <= jc_mapsize) {
+		const struct jc_rec *rec = (const struct jc_rec *)
+			((const char *)jc_map + off);
+		if (rec->reclen < sizeof(*rec) || off + rec->reclen > jc_mapsize ||
+		    rec->reclen != sizeof(*rec) + rec->totlen +
+		    sizeof(Addr2Pc) * (rec->ncount + 1))
+			break;
+		jc_add(rec, NULL);
+		off += rec->reclen;
+	}
+	jc_filesize = off;
+	if (off != jc_mapsize && jc_replace_file((const char *)jc_map +
+			sizeof(*hdr), off - sizeof(*hdr)) != 0)
+		goto err;
+	flock(jc_fd, LOCK_UN);
+	return 0;
+
+err:
+	error("simx86: code cache disabled: %s\n", strerror(errno));
+	flock(jc_fd, LOCK_UN);
+	return -1;
+}
+
+static void *jc_worker(void *arg)
+{
+	const struct jc_rec *rec;
+	struct stat st;
+
+	if (jc_load() != 0)
+		return NULL;
+	__atomic_store_n(&jc_ready, 1, __ATOMIC_RELEASE);
+
+	pthread_mutex_lock(&jc_wq_mtx);
+	for (;;) {
+		while (jc_wq_head == jc_wq_tail && !jc_wq_stop)
+			pthread_cond_wait(&jc_wq_cnd, &jc_wq_mtx);
+		if (jc_wq_head == jc_wq_tail)
+			break;
+		rec = jc_wq[jc_wq_tail++ % JITCACHE_QUEUE_LEN];
+		pthread_mutex_unlock(&jc_wq_mtx);
+
+		flock(jc_fd, LOCK_EX);
+		if (jc_check_file() != 0) {
+			flock(jc_fd, LOCK_UN);
+			e_printf("simx86: code cache replaced by another "
+				 "build, not stored to any more\n");
+			pthread_mutex_lock(&jc_wq_mtx);
+			break;
+		}
+		/* the size limit holds for all instances together */
+		if (fstat(jc_fd, &st) != 0 ||
+		    st.st_size + rec->reclen > JITCACHE_MAX_SIZE) {
+			flock(jc_fd, LOCK_UN);
+			e_printf("simx86: code cache full\n");
+			pthread_mutex_lock(&jc_wq_mtx);
+			break;
+		}
+		if (write(jc_fd, rec, rec->reclen) != rec->reclen) {
+			flock(jc_fd, LOCK_UN);
+			error("simx86: code cache write failed: %s\n",
+			      strerror(errno));
+			pthread_mutex_lock(&jc_wq_mtx);
+			break;
+		}
+		flock(jc_fd, LOCK_UN);
+		pthread_mutex_lock(&jc_wq_mtx);
+	}
+	pthread_mutex_unlock(&jc_wq_mtx);
+	return NULL;
+}
+
+void jitcache_init(void)
+{
+	char *path;
+
+	if (CONFIG_CPUSIM || !config.cpuemu_cache || !config.cpuemu_cache[0])
+		return;
+	jc_build_id = get_build_id();
+	if (!jc_build_id)
+		return;
+	if (config.cpuemu_cache[0] == '/')
+		path = strdup(config.cpuemu_cache);
+	else
+		path = assemble_path(LOCALDIR, config.cpuemu_cache);
+	jc_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+	if (jc_fd == -1) {
+		error("simx86: cannot open code cache %s: %s\n", path,
+		      strerror(errno));
+		free(path);
+		return;
+	}
+	e_printf("simx86: using code cache %s\n", path);
+	jc_path = path;
+
+	jc_wq_head = jc_wq_tail = 0;
+	jc_wq_stop = 0;
+	if (pthread_create(&jc_thr, NULL, jc_worker, NULL) != 0) {
+		error("simx86: code cache disabled: no worker thread\n");
+		close(jc_fd);
+		jc_fd = -1;
+		free(jc_path);
+		jc_path = NULL;
+		return;
+	}
+#if defined(HAVE_PTHREAD_SETNAME_NP) && defined(__GLIBC__)
+	pthread_setname_np(jc_thr, "dosemu: jitc");
+#endif
+	jc_thr_running = 1;
+}
+
+void jitcache_done(void)
+{
+	int i;
+
+	if (jc_fd == -1)
+		return;
+	if (jc_thr_running) {
+		pthread_mutex_lock(&jc_wq_mtx);
+		jc_wq_stop = 1;
+		pthread_cond_signal(&jc_wq_cnd);
+		pthread_mutex_unlock(&jc_wq_mtx);
+		pthread_join(jc_thr, NULL);
+		jc_thr_running = 0;
+	}
+	jc_ready = 0;
+	if (debug_level('e'))
+		dbug_printf("JIT code cache: hits %d misses %d stale %d stores %d"
+			    " dropped %d\n", jc_hits, jc_misses, jc_stale,
+			    jc_stores, jc_dropped);
+	for (i = 0; i < JC_HASH_SIZE; i++) {
+		struct jc_ent *e = jc_hash[i];
+		while (e) {
+			struct jc_ent *e2 = e;
+			e = e->next;
+			free(e2->mem);
+			free(e2);
+		}
+		jc_hash[i] = NULL;
+	}
+	if (jc_map)
+		munmap(jc_map, jc_mapsize);
+	jc_map = NULL;
+	close(jc_fd);
+	jc_fd = -1;
+	free(jc_path);
+	jc_path = NULL;
+	jc_hits = jc_misses = jc_stale = jc_stores = jc_dropped = 0;
+}
+
+/*
+ * Store a just produced sequence. Must be called before Move2Tree(),
+ * while the per-instruction data in I0[] is still valid.
+ */
+void jitcache_store(IMeta *I0, CodeBuf *cb, unsigned int cs, int mode,
+		    unsigned int env)
+{
+	struct jc_rec *rec;
+	struct jc_ent *e;
+	Addr2Pc *ap;
+	unsigned char *code;
+	int i, nap = I0->ncount + 1;
+	size_t len;
+
+	if (!__atomic_load_n(&jc_ready, __ATOMIC_ACQUIRE) ||
+	    jc_filesize > JITCACHE_MAX_SIZE)
+		return;
+	len = sizeof(*rec) + sizeof(Addr2Pc) * nap + I0->totlen;
+	rec = malloc(len);
+	rec->reclen = len;
+	rec->pc = I0->npc;
+	rec->cs = cs;
+	rec->mode = mode;
+	rec->env = env;
+	rec->seqbase = I0->seqbase;
+	rec->seqlen = I0->seqlen;
+	rec->srclen = guest_len(I0->seqbase, I0->seqlen);
+	rec->srchash = hash_guest(rec->seqbase, rec->srclen);
+	rec->ncount = I0->ncount;
+	rec->flags = I0->flags;
+	rec->totlen = I0->totlen;
+	rec->t_type = I0->clink.t_type;
+	if (I0->clink.t_type >= JMP_LINK)
+		rec->t_rel = I0->clink.t_link.rel;
+	else	/* tail code added by ProduceCode */
+		rec->t_rel = I0->totlen - TAILSIZE + TAILFIX;
+	rec->nt_rel = I0->clink.t_type > JMP_LINK ? I0->clink.nt_link.rel : 0;
+
+	/* same layout Move2Tree() builds for the node */
+	ap = (Addr2Pc *)(rec + 1);
+	for (i = 0; i < I0->ncount; i++) {
+		ap[i].daddr = I0[i].daddr;
+		ap[i].dnpc = I0[i].npc - I0->npc;
+	}
+	ap[i].daddr = I0[i-1].daddr + I0[i-1].len;
+	ap[i].dnpc = 0;
+	code = (unsigned char *)&ap[nap];
+	memcpy(code, &cb->meta[nap], I0->totlen);
+
+	/* don't duplicate what another instance already stored */
+	for (e = jc_hash[jc_hidx(rec->pc, cs, mode)]; e; e = e->next) {
+		if (e->rec->pc == rec->pc && e->rec->cs == cs &&
+		    e->rec->mode == mode && e->rec->env == env &&
+		    e->rec->srchash == rec->srchash &&
+		    e->rec->srclen == rec->srclen) {
+			free(rec);
+			return;
+		}
+	}
+
+	pthread_mutex_lock(&jc_wq_mtx);
+	if (jc_wq_head - jc_wq_tail >= JITCACHE_QUEUE_LEN) {
+		pthread_mutex_unlock(&jc_wq_mtx);
+		jc_dropped++;
+		free(rec);
+		return;
+	}
+	jc_wq[jc_wq_head++ % JITCACHE_QUEUE_LEN] = rec;
+	pthread_cond_signal(&jc_wq_cnd);
+	pthread_mutex_unlock(&jc_wq_mtx);
+	jc_filesize += len;
+	jc_stores++;
+	jc_add(rec, rec);
+}
+
+/* do the guest bytes still hash the same? Only hashed again if the
+ * pages may have been written since the last time */
+static int jc_src_ok(struct jc_ent *e)
+{
+	const struct jc_rec *rec = e->rec;
+
+	if (e->gen && e_mpunchanged(rec->seqbase, rec->srclen, e->gen))
+		return e->src_ok;
+	e->gen = e_mpgen();
+	e->src_ok = (hash_guest(rec->seqbase, rec->srclen) == rec->srchash);
+	return e->src_ok;
+}
+
+/*
+ * Look up a sequence starting at pc. On success a new CodeBuf is
+ * returned and I0[] is filled so that it can be passed to Move2Tree()
+ * exactly as if the sequence was just produced.
+ */
+CodeBuf *jitcache_fetch(unsigned int pc, unsigned int cs, int mode,
+			unsigned int env, IMeta *I0)
+{
+	struct jc_ent *e;
+	const struct jc_rec *rec;
+	const Addr2Pc *ap;
+	CodeBuf *cb;
+	unsigned char *code;
+	int i, nap;
+
+	if (!__atomic_load_n(&jc_ready, __ATOMIC_ACQUIRE))
+		return NULL;
+	for (e = jc_hash[jc_hidx(pc, cs, mode)]; e; e = e->next) {
+		rec = e->rec;
+		if (rec->pc != pc || rec->cs != cs || rec->mode != mode ||
+		    rec->env != env)
+			continue;
+		if (rec->ncount >= MAXINODES)
+			continue;
+		if (!jc_src_ok(e)) {
+			jc_stale++;
+			continue;
+		}
+		break;
+	}
+	if (!e) {
+		jc_misses++;
+		return NULL;
+	}
+
+	nap = rec->ncount + 1;
+	ap = (const Addr2Pc *)(rec + 1);
+	cb = dlmalloc(offsetof(CodeBuf, meta) + sizeof(Addr2Pc) * nap +
+		      rec->totlen);
+	code = (unsigned char *)&cb->meta[nap];
+	memcpy(code, &ap[nap], rec->totlen);
+
+	memset(I0, 0, sizeof(IMeta));
+	for (i = 0; i < rec->ncount; i++) {
+		I0[i].npc = pc + ap[i].dnpc;
+		I0[i].daddr = ap[i].daddr;
+		I0[i].len = ap[i+1].daddr - ap[i].daddr;
+	}
+	I0->seqbase = rec->seqbase;
+	I0->seqlen = rec->seqlen;
+	I0->ncount = rec->ncount;
+	I0->flags = rec->flags;
+	I0->totlen = rec->totlen;
+	I0->clink.t_type = rec->t_type;
+	if (rec->t_type >= JMP_LINK)
+		I0->clink.t_link.rel = rec->t_rel;
+	else
+		I0->clink.t_link.abs = (unsigned int *)(code + rec->t_rel);
+	if (rec->t_type > JMP_LINK)
+		I0->clink.nt_link.rel = rec->nt_rel;
+	jc_hits++;
+	return cb;
+}
+
+#endif
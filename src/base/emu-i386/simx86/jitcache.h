@@ -0,0 +1,20 @@
+/*
+ * (C) Copyright 1992, ..., 2014 the "DOSEMU-Development-Team".
+ *
+ * for details see file COPYING in the DOSEMU distribution
+ */
+
+#ifndef _EMU86_JITCACHE_H
+#define _EMU86_JITCACHE_H
+
+#ifdef HOST_ARCH_X86
+void jitcache_init(void);
+void jitcache_done(void);
+unsigned int jitcache_env(void);
+void jitcache_store(IMeta *I0, CodeBuf *cb, unsigned int cs, int mode,
+		    unsigned int env);
+CodeBuf *jitcache_fetch(unsigned int pc, unsigned int cs, int mode,
+			unsigned int env, IMeta *I0);
+#endif
+
+#endif
@@ -0,0 +1,227 @@
+/*
+ * (C) Copyright 1992, ..., 2014 the "DOSEMU-Development-Team".
+ *
+ * for details see file COPYING in the DOSEMU distribution
+ */
+
+/*
+ * Per-node profiler for the x86 JIT ($_cpuemu_profile).
+ *
+ * Every translated sequence gets an entry keyed by start PC, CS base
+ * and CPU mode, which survives the node itself, so that code that is
+ * retranslated again and again shows up with a high translation count.
+ * Entries count executions and host TSC cycles spent executing and
+ * translating; the time spent looking up nodes is kept globally.
+ *
+ * Node linking is disabled while profiling, as linked nodes would run
+ * into each other without returning to the counting code.
+ *
+ * Every JITPROF_PERIOD seconds, and at exit, two files are rewritten:
+ *  <file>		folded stacks weighted by cycles, as consumed by
+ *			flamegraph.pl and similar tools
+ *  <file>.blocks	one line per sequence, hottest first
+ * Real mode code is named after the nearest symbol from the debugger's
+ * symbol tables when there is one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "emu86.h"
+#include "codegen-arch.h"
+#include "dosemu_config.h"
+#include "utilities.h"
+#include "mhpdbg.h"
+#include "jitprof.h"
+
+#ifdef HOST_ARCH_X86
+
+#define JP_HASH_SIZE	4096
+
+int jitprof_on;
+
+static struct jitprof_ent *jp_hash[JP_HASH_SIZE];
+static int jp_count;
+static char *jp_path;
+static hitimer_t jp_lookup_tsc;
+static uint64_t jp_lookups;
+static hitimer_t jp_next_dump;
+static unsigned int jp_ticks;
+
+void jitprof_init(void)
+{
+	if (CONFIG_CPUSIM || !config.cpuemu_profile ||
+	    !config.cpuemu_profile[0])
+		return;
+	if (config.cpuemu_profile[0] == '/')
+		jp_path = strdup(config.cpuemu_profile);
+	else
+		jp_path = assemble_path(LOCALDIR, config.cpuemu_profile);
+	e_printf("simx86: writing jit profile to %s\n", jp_path);
+	jp_next_dump = GETusSYSTIME() + JITPROF_PERIOD * 1000000LL;
+	jitprof_on = 1;
+}
+
+static struct jitprof_ent *jp_find(TNode *G)
+{
+	unsigned int h = (G->key ^ (G->cs >> 4) ^ G->mode) % JP_HASH_SIZE;
+	struct jitprof_ent *e;
+
+	for (e = jp_hash[h]; e; e = e->next)
+		if (e->key == G->key && e->cs == G->cs && e->mode == G->mode)
+			return e;
+	e = calloc(1, sizeof(*e));
+	if (e == NULL)
+		return NULL;
+	e->key = G->key;
+	e->cs = G->cs;
+	e->mode = G->mode;
+	e->next = jp_hash[h];
+	jp_hash[h] = e;
+	jp_count++;
+	return e;
+}
+
+/* G was just translated in t cycles; it must have cs and mode set */
+void jitprof_gen(TNode *G, hitimer_t t)
+{
+	G->prof = jp_find(G);
+	if (G->prof) {
+		G->prof->gens++;
+		G->prof->gen_tsc += t;
+	}
+}
+
+static const char *jp_name(struct jitprof_ent *e, char *buf, size_t size)
+{
+	if (e->mode & MREALA) {
+		unsigned int seg = e->cs >> 4, off = e->key - e->cs;
+#ifdef USE_MHPDBG
+		unsigned int delta;
+		const char *s = mhp_getsym_near(seg, off, &delta);
+
+		if (s) {
+			if (delta)
+				snprintf(buf, size, "%s+%x", s, delta);
+			else
+				snprintf(buf, size, "%s", s);
+			return buf;
+		}
+#endif
+		snprintf(buf, size, "%04x:%04x", seg, off);
+	} else
+		snprintf(buf, size, "%08x+%x", e->cs, e->key - e->cs);
+	return buf;
+}
+
+static int jp_cmp(const void *a, const void *b)
+{
+	const struct jitprof_ent *e1 = *(struct jitprof_ent * const *)a;
+	const struct jitprof_ent *e2 = *(struct jitprof_ent * const *)b;
+	uint64_t t1 = e1->exec_tsc + e1->gen_tsc;
+	uint64_t t2 = e2->exec_tsc + e2->gen_tsc;
+
+	return t1 < t2 ? 1 : t1 > t2 ? -1 : 0;
+}
+
+static void jitprof_dump(void)
+{
+	struct jitprof_ent **v, *e;
+	char name[80];
+	char *bpath;
+	FILE *f, *fb;
+	int i, n = 0;
+
+	v = malloc(jp_count * sizeof(*v) + 1);
+	if (v == NULL)
+		return;
+	for (i = 0; i < JP_HASH_SIZE; i++)
+		for (e = jp_hash[i]; e; e = e->next)
+			v[n++] = e;
+	qsort(v, n, sizeof(*v), jp_cmp);
+
+	bpath = malloc(strlen(jp_path) + sizeof(".blocks"));
+	f = fopen(jp_path, "w");
+	fb = NULL;
+	if (bpath) {
+		strcpy(bpath, jp_path);
+		strcat(bpath, ".blocks");
+		fb = fopen(bpath, "w");
+		free(bpath);
+	}
+	if (f == NULL || fb == NULL) {
+		error("simx86: cannot write jit profile %s: %s\n", jp_path,
+		      strerror(errno));
+		goto out;
+	}
+	fprintf(fb, "# %-20s %12s %16s %8s %16s %8s\n", "block", "execs",
+		"exec_cycles", "gens", "gen_cycles", "pc");
+	for (i = 0; i < n; i++) {
+		e = v[i];
+		jp_name(e, name, sizeof(name));
+		if (e->exec_tsc)
+			fprintf(f, "dosemu;exec;%s %llu\n", name,
+				(unsigned long long)e->exec_tsc);
+		if (e->gen_tsc)
+			fprintf(f, "dosemu;translate;%s %llu\n", name,
+				(unsigned long long)e->gen_tsc);
+		fprintf(fb, "%-22s %12llu %16llu %8llu %16llu %08x\n", name,
+			(unsigned long long)e->execs,
+			(unsigned long long)e->exec_tsc,
+			(unsigned long long)e->gens,
+			(unsigned long long)e->gen_tsc, e->key);
+	}
+	if (jp_lookup_tsc)
+		fprintf(f, "dosemu;lookup %llu\n",
+			(unsigned long long)jp_lookup_tsc);
+	fprintf(fb, "# lookups %llu, lookup cycles %llu\n",
+		(unsigned long long)jp_lookups,
+		(unsigned long long)jp_lookup_tsc);
+out:
+	if (f)
+		fclose(f);
+	if (fb)
+		fclose(fb);
+	free(v);
+}
+
+/* called on every tree lookup; returns the start time of the lookup */
+hitimer_t jitprof_tick(void)
+{
+	if (!(++jp_ticks & 0xfff) && GETusSYSTIME() >= jp_next_dump) {
+		jitprof_dump();
+		jp_next_dump = GETusSYSTIME() + JITPROF_PERIOD * 1000000LL;
+	}
+	return GETTSC();
+}
+
+void jitprof_lookup(hitimer_t t0)
+{
+	jp_lookups++;
+	jp_lookup_tsc += GETTSC() - t0;
+}
+
+void jitprof_done(void)
+{
+	int i;
+
+	if (!jitprof_on)
+		return;
+	jitprof_dump();
+	jitprof_on = 0;
+	for (i = 0; i < JP_HASH_SIZE; i++) {
+		struct jitprof_ent *e = jp_hash[i];
+		while (e) {
+			struct jitprof_ent *e2 = e;
+			e = e->next;
+			free(e2);
+		}
+		jp_hash[i] = NULL;
+	}
+	jp_count = 0;
+	free(jp_path);
+	jp_path = NULL;
+}
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ * (C) Copyright 1992, ..., 2014 the "DOSEMU-Development-Team".
+ *
+ * for details see file COPYING in the DOSEMU distribution
+ */
+
+#ifndef _EMU86_JITPROF_H
+#define _EMU86_JITPROF_H
+
+#ifdef HOST_ARCH_X86
+#include "timers.h"
+
+struct jitprof_ent {
+	struct jitprof_ent *next;
+	unsigned int key, cs, mode;
+	uint64_t execs, exec_tsc;
+	uint64_t gens, gen_tsc;
+};
+
+extern int jitprof_on;
+
+void jitprof_init(void);
+void jitprof_done(void);
+void jitprof_gen(TNode *G, hitimer_t t);
+hitimer_t jitprof_tick(void);
+void jitprof_lookup(hitimer_t t0);
+
+static inline void jitprof_exec(TNode *G, hitimer_t t)
+{
+	G->prof->execs++;
+	G->prof->exec_tsc += t;
+}
+#endif
+
+#endif
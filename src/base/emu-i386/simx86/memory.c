@@ -55,16 +55,29 @@
 #endif
 
 typedef struct _mpmap {
-	struct _mpmap *next;
-	int mega;
 	unsigned char pagemap[32];	/* (32*8)=256 pages *4096 = 1M */
 	uint64_t subpage[(0x100000>>CGRAN)/UINT64_WIDTH];	/* 2^CGRAN-byte granularity, 1M/2^CGRAN bits */
+	uint64_t pagegen[256];		/* MpGen of the last change, see e_mpwrite() */
 } tMpMap;
 
-static tMpMap *MpH = NULL;
+/* Two-level table over the 4G linear space: the top level is indexed
+ * by the megabyte, unused megabytes all point to one shared empty
+ * chunk so that queries never have to check for holes. Nothing may
+ * write to MpEmpty: chunks are allocated on the first mark or protect
+ * inside their megabyte, and unmark/unprotect skip MpEmpty. */
+#define MP_MEGAS	(1 << (32-20))
+static tMpMap MpEmpty;
+static tMpMap *MpMap[MP_MEGAS] = { [0 ... MP_MEGAS-1] = &MpEmpty };
+
+/* Guest code can only change unnoticed while its page is not write
+ * protected. MpGen counts the events that can change a protected page:
+ * protecting or unprotecting it, and every write let through to it
+ * (e_mpwrite()). Each page keeps the count of its last such event. */
+static uint64_t MpGen = 1;
+
 unsigned int mMaxMem = 0;
 int PageFaults = 0;
-static tMpMap *LastMp = NULL;
+int PageFaultsAvoided = 0;
 
 static int e_munprotect(unsigned int addr, size_t len);
 
@@ -72,16 +85,16 @@ static int e_munprotect(unsigned int addr, size_t len);
 
 static inline tMpMap *FindM(unsigned int addr)
 {
-	register int a2l = addr >> (PAGE_SHIFT+8);
-	register tMpMap *M = LastMp;
-
-	if (M && (M->mega==a2l)) return M;
-	M = MpH;
-	while (M) {
-		if (M->mega==a2l) {
-		    LastMp = M; break;
-		}
-		M = M->next;
+	return MpMap[addr >> 20];
+}
+
+static tMpMap *AllocM(unsigned int addr)
+{
+	tMpMap *M = MpMap[addr >> 20];
+
+	if (M == &MpEmpty) {
+		M = (tMpMap *)calloc(1,sizeof(tMpMap));
+		MpMap[addr >> 20] = M;
 	}
 	return M;
 }
@@ -95,21 +108,16 @@ static int AddMpMap(unsigned int addr, unsigned int aend, int onoff)
 
 	do {
 	    page = addr >> PAGE_SHIFT;
-	    M = MpH;
-	    while (M) {
-		if (M->mega==(page>>8)) break;
-		M = M->next;
-	    }
-	    if (M==NULL) {
-		M = (tMpMap *)calloc(1,sizeof(tMpMap));
-		M->next = MpH; MpH = M;
-		M->mega = (page>>8);
-	    }
+	    /* nothing to unprotect in a megabyte without a chunk */
+	    M = onoff ? AllocM(addr) : FindM(addr);
 	    if (bp < 32) {
-		bs |= (((unsigned)(onoff? set_bit(page&255, M->pagemap) :
-			    clear_bit(page&255, M->pagemap)) & 1) << bp);
+		if (M != &MpEmpty)
+		    bs |= (((unsigned)(onoff? set_bit(page&255, M->pagemap) :
+				clear_bit(page&255, M->pagemap)) & 1) << bp);
 		bp++;
 	    }
+	    if (M != &MpEmpty)
+		M->pagegen[page&255] = ++MpGen;
 	    if (debug_level('e')>1) {
 		if (addr > mMaxMem) mMaxMem = addr;
 		if (onoff)
@@ -126,40 +134,74 @@ static int AddMpMap(unsigned int addr, unsigned int aend, int onoff)
 static inline int e_querymprot(unsigned int addr)
 {
 	register int a2 = addr >> PAGE_SHIFT;
-	tMpMap *M = FindM(addr);
 
-	if (M==NULL) return 0;
-	return test_bit(a2&255, M->pagemap);
+	return test_bit(a2&255, FindM(addr)->pagemap);
 }
 
 int e_querymprotrange(unsigned int addr, size_t len)
 {
-	int a2l, a2h;
+	unsigned int a2l, a2h;
 	tMpMap *M = FindM(addr);
 
 	a2l = addr >> PAGE_SHIFT;
 	a2h = (addr+len-1) >> PAGE_SHIFT;
 
-	while (M && a2l <= a2h) {
+	while (a2l <= a2h) {
 		if (test_bit(a2l&255, M->pagemap))
 			return 1;
 		a2l++;
 		if ((a2l&255)==0)
-			M = M->next;
+			M = FindM(a2l << PAGE_SHIFT);
 	}
 	return 0;
 }
 
 
+/* a write to addr..addr+len-1 was let through or is about to be */
+void e_mpwrite(unsigned int addr, size_t len)
+{
+	unsigned int a, aend;
+
+	aend = (addr+len-1) & PAGE_MASK;
+	for (a = addr & PAGE_MASK; a <= aend; a += PAGE_SIZE) {
+		if (e_querymprot(a))
+			FindM(a)->pagegen[(a >> PAGE_SHIFT)&255] = ++MpGen;
+		if (a == aend)
+			break;
+	}
+}
+
+uint64_t e_mpgen(void)
+{
+	return MpGen;
+}
+
+/* was addr..addr+len-1 protected all the time since e_mpgen() was gen? */
+int e_mpunchanged(unsigned int addr, size_t len, uint64_t gen)
+{
+	unsigned int a, aend;
+
+	aend = (addr+len-1) & PAGE_MASK;
+	for (a = addr & PAGE_MASK; a <= aend; a += PAGE_SIZE) {
+		if (!e_querymprot(a) ||
+		    FindM(a)->pagegen[(a >> PAGE_SHIFT)&255] > gen)
+			return 0;
+		if (a == aend)
+			break;
+	}
+	return 1;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 
 
 int e_markpage(unsigned int addr, size_t len)
 {
 	unsigned int abeg, aend;
-	tMpMap *M = FindM(addr);
+	tMpMap *M;
 
-	if (M == NULL || len == 0) return 0;
+	if (len == 0) return 0;
+	M = AllocM(addr);
 
 	abeg = addr >> CGRAN;
 	aend = (addr+len-1) >> CGRAN;
@@ -167,11 +209,11 @@ int e_markpage(unsigned int addr, size_t len)
 	if (debug_level('e')>1)
 		dbug_printf("MARK from %08x to %08x for %08x\n",
 			    abeg<<CGRAN,((aend+1)<<CGRAN)-1,addr);
-	while (M && abeg <= aend) {
+	while (abeg <= aend) {
 		set_bit(abeg&CGRMASK, M->subpage);
 		abeg++;
 		if ((abeg&CGRMASK) == 0)
-			M = M->next;
+			M = AllocM(abeg << CGRAN);
 	}
 	return 1;
 }
@@ -181,7 +223,7 @@ int e_unmarkpage(unsigned int addr, size_t len)
 	unsigned int abeg, aend;
 	tMpMap *M = FindM(addr);
 
-	if (M == NULL || len == 0) return 0;
+	if (len == 0) return 0;
 
 	abeg = addr >> CGRAN;
 	aend = (addr+len-1) >> CGRAN;
@@ -189,11 +231,12 @@ int e_unmarkpage(unsigned int addr, size_t len)
 	if (debug_level('e')>1)
 		dbug_printf("UNMARK from %08x to %08x for %08x\n",
 			    abeg<<CGRAN,((aend+1)<<CGRAN)-1,addr);
-	while (M && abeg <= aend) {
-		clear_bit(abeg&CGRMASK, M->subpage);
+	while (abeg <= aend) {
+		if (M != &MpEmpty)
+			clear_bit(abeg&CGRMASK, M->subpage);
 		abeg++;
 		if ((abeg&CGRMASK) == 0)
-			M = M->next;
+			M = FindM(abeg << CGRAN);
 	}
 
 	/* check if unmarked pages have no more code, and if so, unprotect */
@@ -218,8 +261,6 @@ int e_querymark(unsigned int addr, size_t len)
 	tMpMap *M = FindM(addr);
 	uint64_t mask;
 
-	if (M == NULL) return 0;
-
 	abeg = addr >> CGRAN;
 	aend = ((addr+len-1) >> CGRAN) + 1;
 
@@ -243,7 +284,7 @@ int e_querymark(unsigned int addr, size_t len)
 		idx++;
 		mask = ~0ULL;
 		if (idx == sizeof(M->subpage)/sizeof(M->subpage[0])) {
-			M = M->next;
+			M = FindM(abeg << CGRAN);
 			idx = 0;
 		}
 	}
@@ -271,17 +312,15 @@ int e_querymark_all(unsigned int addr, size_t len)
 	unsigned int abeg, aend;
 	tMpMap *M = FindM(addr);
 
-	if (M == NULL) return 0;
-
 	abeg = addr >> CGRAN;
 	aend = (addr+len-1) >> CGRAN;
 
-	while (M && abeg <= aend) {
+	while (abeg <= aend) {
 		if (!test_bit(abeg&CGRMASK, M->subpage))
 			return 0;
 		abeg++;
 		if ((abeg&CGRMASK) == 0)
-			M = M->next;
+			M = FindM(abeg << CGRAN);
 	}
 	return 1;
 }
@@ -363,6 +402,23 @@ static int e_munprotect(unsigned int addr, size_t len)
 	return ret;
 }
 
+/* Open (wr=1) or close (wr=0) a short write window on the protected
+ * pages holding addr..addr+len-1, for a data store that must not drop
+ * the code sharing the page. The MpMap state is left untouched. */
+void e_mwindow(unsigned int addr, size_t len, int wr)
+{
+	unsigned int a, aend;
+
+	aend = (addr+len-1) & PAGE_MASK;
+	for (a = addr & PAGE_MASK; a <= aend; a += PAGE_SIZE) {
+	    if (!e_querymprot(a))
+		continue;
+	    if (mprotect_mapping(MAPPING_CPUEMU, a, PAGE_SIZE, wr ?
+			PROT_READ|PROT_WRITE|PROT_EXEC : PROT_READ|PROT_EXEC) < 0)
+		e_printf("MPWIN: %s\n",strerror(errno));
+	}
+}
+
 #ifdef HOST_ARCH_X86
 int e_handle_pagefault(dosaddr_t addr, unsigned err, sigcontext_t *scp)
 {
@@ -477,21 +533,26 @@ int e_handle_fault(sigcontext_t *scp)
 
 void mprot_init(void)
 {
-	MpH = NULL;
-	AddMpMap(0,0,0);	/* first mega in first entry */
+	int m;
+
+	for (m=0; m<MP_MEGAS; m++)
+	    MpMap[m] = &MpEmpty;
 	PageFaults = 0;
+	PageFaultsAvoided = 0;
 }
 
 void mprot_end(void)
 {
-	tMpMap *M = MpH;
-	int i;
+	tMpMap *M;
+	int i, m;
 	unsigned char b;
 
-	while (M) {
-	    tMpMap *M2 = M;
+	for (m=0; m<MP_MEGAS; m++) {
+	    M = MpMap[m];
+	    if (M == &MpEmpty)
+		continue;
 	    for (i=0; i<32; i++) if ((b=M->pagemap[i])) {
-		unsigned int addr = (M->mega<<20) | (i<<15);
+		unsigned int addr = ((unsigned)m<<20) | (i<<15);
 		while (b) {
 		    if (b & 1) {
 			if (debug_level('e')>1)
@@ -502,10 +563,9 @@ void mprot_end(void)
 	 	    b >>= 1;
 		}
 	    }
-	    M = M->next;
-	    free(M2);
+	    free(M);
+	    MpMap[m] = &MpEmpty;
 	}
-	MpH = LastMp = NULL;
 }
 
 /////////////////////////////////////////////////////////////////////////////
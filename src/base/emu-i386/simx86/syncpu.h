@@ -111,6 +111,7 @@ typedef struct {
 	unsigned int tr[2];
 
 	int err;
+	unsigned int side_exit;	/* hint of the last side exit taken */
 	unsigned int mode;
 	unsigned int sreg1;
 	unsigned int dreg1;
@@ -238,6 +239,7 @@ extern union _SynCPU TheCPU_union;
 #define Ofs_stub_read_16	(unsigned int)(offsetof(SynCPU,stub_read_16)-SCBASE)
 #define Ofs_stub_read_32	(unsigned int)(offsetof(SynCPU,stub_read_32)-SCBASE)
 #define Ofs_ERR		(unsigned int)(offsetof(SynCPU,err)-SCBASE)
+#define Ofs_SIDEEXIT	(unsigned int)(offsetof(SynCPU,side_exit)-SCBASE)
 #define Ofs_int_revectored	(unsigned int)(offsetof(SynCPU,int_revectored)-SCBASE)
 
 #define rAX		CPUWORD(Ofs_AX)
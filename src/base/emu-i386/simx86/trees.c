@@ -49,6 +49,8 @@
 #include "emu86.h"
 #include "dlmalloc.h"
 #include "codegen-arch.h"
+#include "jitcache.h"
+#include "jitprof.h"
 
 IMeta	*InstrMeta;
 int	CurrIMeta = -1;
@@ -58,11 +60,9 @@ avltr_tree CollectTree;
 avltr_traverser Traverser;
 int ninodes = 0;
 
-int NodesCleaned = 0;
 int NodesParsed = 0;
 int NodesExecd = 0;
-int CleanFreq = 8;
-int CreationIndex = 0;
+int NodesEvicted = 0;
 
 #ifdef PROFILE
 int MaxDepth = 0;
@@ -71,18 +71,37 @@ int MaxNodeSize = 0;
 int TotalNodesParsed = 0;
 int TotalNodesExecd = 0;
 int NodesFound = 0;
-int NodesFastFound = 0;
 int NodesNotFound = 0;
 int TreeCleanups = 0;
 #endif
 
 #ifdef HOST_ARCH_X86
 
-#define FINDTREE_CACHE_HASH_MASK 0xfff
-static TNode *findtree_cache[FINDTREE_CACHE_HASH_MASK+1];
+/* Open-addressing (linear probing) hash of linear PC -> TNode. This is
+ * the primary index used by FindTree(); the AVL tree is only walked for
+ * range queries like InvalidateNodeRange(). */
+#define NODEHASH_SIZE	(1<<NODEHASH_BITS)
+#define NODEHASH_MASK	(NODEHASH_SIZE-1)
+
+typedef struct {
+	int key;
+	TNode *node;
+} hashslot;
+
+static hashslot *NodeHash;
+int HashHits = 0;
+int HashMisses = 0;
+int TracesBuilt = 0;
+int TracesDropped = 0;
 
 TNode *TNodePool;
-int NodeLimit = 10000;
+
+/* The code buffers of all nodes in the tree, dead ones included, form a
+ * ring swept by the eviction clock. New buffers go in just behind the
+ * hand. CodeBytes is the memory they take, CodeBudget its limit. */
+static CodeBuf ClockRing;
+static CodeBuf *ClockHand;
+static size_t CodeBytes, CodeBudget;
 
 #define RANGE_IN_RANGE(al,ah,l,h)	({int _l2=(al);\
 	int _h2=(ah); ((_h2 >= (l)) && (_l2 < (h))); })
@@ -100,7 +119,8 @@ static inline TNode *Tmalloc(void)
 {
   TNode *G  = TNodePool->link[0];
   TNode *G1 = G->link[0];
-  if (G1==TNodePool) leavedos_main(0x4c4c); // return NULL;
+  /* Move2Tree() always evicts enough nodes to leave one free */
+  assert(G1 != TNodePool);
   TNodePool->link[0] = G1; G->link[0]=NULL;
   memset(G, 0, sizeof(TNode));	// "bug covering"
   return G;
@@ -116,6 +136,97 @@ static inline void Tfree(TNode *G)
 
 /////////////////////////////////////////////////////////////////////////////
 
+static inline size_t CodeBufSize(int seqnum, int len)
+{
+  return offsetof(CodeBuf, meta) + sizeof(Addr2Pc) * (seqnum + 1) + len;
+}
+
+static inline void ClockInsert(CodeBuf *cb, int seqnum, int len)
+{
+  cb->cnext = ClockHand;
+  cb->cprev = ClockHand->cprev;
+  ClockHand->cprev->cnext = cb;
+  ClockHand->cprev = cb;
+  CodeBytes += CodeBufSize(seqnum, len);
+}
+
+/* free the code buffer of a node being deleted or replaced */
+static void FreeCodeBuf(TNode *G)
+{
+  CodeBuf *cb = G->mblock;
+
+  if (cb == NULL)
+    return;
+  if (ClockHand == cb)
+    ClockHand = cb->cnext;
+  cb->cprev->cnext = cb->cnext;
+  cb->cnext->cprev = cb->cprev;
+  CodeBytes -= CodeBufSize(G->seqnum, G->len);
+  dlfree(cb);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned NodeHashIdx(int key)
+{
+  return ((unsigned)key * 0x9e3779b1u) >> (32-NODEHASH_BITS);
+}
+
+static inline TNode *NodeHashFind(int key)
+{
+  unsigned i = NodeHashIdx(key);
+  hashslot *h;
+
+  while ((h = &NodeHash[i])->node != NULL) {
+      if (h->key == key) return h->node;
+      i = (i+1) & NODEHASH_MASK;
+  }
+  return NULL;
+}
+
+/* insert a new key or update the node pointer of an existing one */
+static void NodeHashSet(int key, TNode *G)
+{
+  unsigned i = NodeHashIdx(key);
+  hashslot *h;
+
+  while ((h = &NodeHash[i])->node != NULL) {
+      if (h->key == key) break;
+      i = (i+1) & NODEHASH_MASK;
+  }
+  h->key = key;
+  h->node = G;
+}
+
+/* remove a key, shifting back the following entries of its cluster
+ * so that no tombstones are needed */
+static void NodeHashDel(int key)
+{
+  unsigned i = NodeHashIdx(key);
+  unsigned j, k;
+
+  while (NodeHash[i].node != NULL) {
+      if (NodeHash[i].key == key) break;
+      i = (i+1) & NODEHASH_MASK;
+  }
+  if (NodeHash[i].node == NULL) return;
+
+  j = i;
+  for (;;) {
+      j = (j+1) & NODEHASH_MASK;
+      if (NodeHash[j].node == NULL) break;
+      k = NodeHashIdx(NodeHash[j].key);
+      /* move the entry only if its home slot is not in (i,j] */
+      if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j)))
+	  continue;
+      NodeHash[i] = NodeHash[j];
+      i = j;
+  }
+  NodeHash[i].node = NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
 static inline void datacopy(TNode *nd, TNode *ns)
 {
   char *s = (char *)&(ns->key);
@@ -325,6 +436,7 @@ void avltr_delete (const int key)
 #endif
   tree->count--;
   ninodes = tree->count;
+  NodeHashDel(key);
 
   {
     TNode *t = p;
@@ -377,12 +489,13 @@ void avltr_delete (const int key)
 		pa[k++] = r;
 	    }
 
-	    if (t->mblock) dlfree(t->mblock);
+	    FreeCodeBuf(t);
 /* e_printf("<03 node exchange %p->%p>\n",s,t); */
 	    datacopy(t, s);
 /**/	    if (t->addr==NULL) leavedos_main(0x8130);
 	    /* keep the node reference to itself */
 	    t->mblock->bkptr = t;
+	    NodeHashSet(t->key, t);
 	    s->addr = NULL;
 	    s->mblock = NULL;
 	    memset(&s->clink, 0, sizeof(linkdesc));
@@ -413,7 +526,7 @@ void avltr_delete (const int key)
 	    leavedos_main(0x9142);
 	}
 #endif
-  if (p->mblock) dlfree(p->mblock);
+  FreeCodeBuf(p);
   Tfree(p);
 
   while (--k) {
@@ -551,11 +664,15 @@ static void avltr_init(void)
 
   InstrMeta = malloc(sizeof(IMeta) * MAXINODES);
   memset(InstrMeta, 0, sizeof(IMeta));
+
+  ClockRing.cnext = ClockRing.cprev = &ClockRing;
+  ClockHand = &ClockRing;
+  CodeBytes = 0;
+  CodeBudget = (size_t)config.cpuemu_codesize * 1024;
  }
 #endif
   g_printf("avltr_init\n");
   CurrIMeta = -1;
-  NodesCleaned = 0;
   ninodes = 0;
 }
 
@@ -858,60 +975,46 @@ void DumpTree (FILE *fd)
 
 #endif // DEBUG_TREE
 
-static int TraverseAndClean(void)
+/*
+ * Advance the clock until one node is evicted: nodes used since the hand
+ * last passed are aged and skipped, dead ones are removed right away.
+ * Returns 0 if the tree is empty.
+ */
+static int ClockEvict(void)
 {
-  int cnt = 0;
+  CodeBuf *cb;
   TNode *G;
-  static hitimer_t bT = 0;
 #ifdef PROFILE
   hitimer_t t0 = 0;
 
   if (debug_level('e')) t0 = GETTSC();
 #endif
-  if (Traverser.init == 0) {
-      Traverser.p = G = &CollectTree.root;
-      Traverser.init = 1;
-      if (debug_level('e')>2) bT = GETTSC();
-  }
-  else
-      G = Traverser.p;
-
-  /* walk to next node */
-  G = NEXTNODE(G);
-  if (G == &CollectTree.root) {
-      if (debug_level('e')>2) {
-          hitimer_t bt1 = GETTSC();
-          dbug_printf("*\tRestart traversing n=%d %16lld\n",ninodes,(long long)(bt1-bT));
-          bT = bt1;
+  for (;;) {
+      cb = ClockHand;
+      ClockHand = cb->cnext;
+      if (cb == &ClockRing) {
+	  if (ClockHand == &ClockRing)
+	      return 0;
+	  continue;
       }
-      G = NEXTNODE(G);
-      if (G == &CollectTree.root)
-          return 0;
-  }
-
-  if ((G->addr != NULL) && (G->alive>0)) {
-      G->alive -= AGENODE;
-      if (G->alive <= 0) {
-	if (debug_level('e')>2) e_printf("TraverseAndClean: node at %08x decayed\n",G->key);
-	e_unmarkpage(G->seqbase, G->seqlen);
-	NodeUnlinker(G);
+      G = cb->bkptr;
+      if (G->alive > NODE_AGED) {
+	  G->alive = NODE_AGED;
+	  continue;
       }
+      break;
   }
-  if ((G->addr == NULL) || (G->alive<=0)) {
-      if (debug_level('e')>2) e_printf("Delete node %08x\n",G->key);
-      avltr_delete(G->key);
-      cnt++;
-  }
-  else {
-      if (debug_level('e')>3)
-	e_printf("TraverseAndClean: node at %08x of %d life=%d\n",
-		G->key,ninodes,G->alive);
-      Traverser.p = G;
+  if (G->alive > 0) {
+      if (debug_level('e')>2) e_printf("ClockEvict: node at %08x evicted\n",G->key);
+      e_unmarkpage(G->seqbase, G->seqlen);
+      NodeUnlinker(G);
   }
+  avltr_delete(G->key);
+  NodesEvicted++;
 #ifdef PROFILE
   if (debug_level('e')) CleanupTime += (GETTSC() - t0);
 #endif
-  return cnt;
+  return 1;
 }
 
 /*
@@ -938,10 +1041,13 @@ TNode *Move2Tree(IMeta *I0, CodeBuf *GenCodeBuf)
   CodeBuf *mallmb;
   void **cp;
 
-  /* try to keep a limit to the number of nodes in the tree. 3000-4000
-   * nodes are probably enough before performance starts to suffer */
-  if (ninodes > NodeLimit) {
-	for (i=0; i<CreationIndex; i++) TraverseAndClean();
+  /* make room in the node pool and the code budget; the pool head and
+   * the node avltr_probe() may allocate must stay free */
+  len = CodeBufSize(I0->ncount, I0->totlen);
+  while (ninodes >= NODES_IN_POOL - 3 ||
+	 (CodeBudget && CodeBytes + len > CodeBudget)) {
+	if (!ClockEvict())
+	    break;
   }
 
   key = I0->npc;
@@ -958,7 +1064,7 @@ TNode *Move2Tree(IMeta *I0, CodeBuf *GenCodeBuf)
 	/* ->REPLACE the code of the node found with the latest
 	   compiled version */
 	NodeUnlinker(nG);
-	if (nG->mblock) dlfree(nG->mblock);
+	FreeCodeBuf(nG);
   }
   else {
 #if !defined(SINGLESTEP)&&!defined(SINGLEBLOCK)
@@ -982,8 +1088,10 @@ TNode *Move2Tree(IMeta *I0, CodeBuf *GenCodeBuf)
 #endif
   nG->len = len = I0->totlen;
   nG->flags = I0->flags;
-  nG->alive = NODELIFE(nG);
-  findtree_cache[key&FINDTREE_CACHE_HASH_MASK] = nG;
+  nG->alive = NODE_USED;
+  nG->tr_t = nG->tr_nt = 0;
+  nG->prof = NULL;
+  NodeHashSet(key, nG);
 
   /* allocate the extra memory used by the node. This includes the
    * translated code plus the table of correspondances between source
@@ -999,6 +1107,7 @@ TNode *Move2Tree(IMeta *I0, CodeBuf *GenCodeBuf)
   mallmb = GenCodeBuf;
   nG->mblock = GenCodeBuf;
   nG->mblock->bkptr = nG;
+  ClockInsert(GenCodeBuf, nG->seqnum, len);
   cp = &nG->mblock->selfptr;
   *cp = cp;
   nG->pmeta = mallmb->meta;
@@ -1057,7 +1166,7 @@ TNode *Move2Tree(IMeta *I0, CodeBuf *GenCodeBuf)
 TNode *FindTree(int key)
 {
   TNode *I;
-  static int tccount=0;
+  hitimer_t tp = 0;
 #ifdef PROFILE
   hitimer_t t0 = 0;
 #endif
@@ -1066,75 +1175,49 @@ TNode *FindTree(int key)
 	CollectStat();
 	TheCPU.sigprof_pending = 0;
   }
-
-  /* fast path: using cache indexed by low 12 bits of PC:
-     ~99.99% success rate */
-  I = findtree_cache[key&FINDTREE_CACHE_HASH_MASK];
-  if (I && (I->alive>0) && (I->key==key)) {
-	if (debug_level('e')) {
-	    if (debug_level('e')>4)
-		e_printf("Found key %08x via cache\n", key);
-#ifdef PROFILE
-	    NodesFastFound++;
-#endif
-	}
-	I->alive = NODELIFE(I);
-	return I;
-  }
-  if (!e_querymark(key, 1))
-	return NULL;
+  if (jitprof_on)
+	tp = jitprof_tick();
 
 #ifdef PROFILE
   if (debug_level('e')) t0 = GETTSC();
 #endif
-  I = CollectTree.root.link[0];
-  if (I == NULL) return NULL;	/* always NULL the first time! */
-
-  for (;;) {
-      int diff = (key - I->key);
-
-      if (diff < 0) {
-	  I = I->link[0];
-	  if (I == NULL) goto endsrch;
-      }
-      else if (diff > 0) {
-	  if (I->rtag == MINUS) goto endsrch;
-	  I = I->link[1];
-      }
-      else break;
-  }
-
+  I = NodeHashFind(key);
   if (I && I->addr && (I->alive>0)) {
 	if (debug_level('e')>3) e_printf("Found key %08x\n",key);
-	I->alive = NODELIFE(I);
-	findtree_cache[key&FINDTREE_CACHE_HASH_MASK] = I;
+	I->alive = NODE_USED;
+	HashHits++;
 #ifdef PROFILE
 	if (debug_level('e')) {
 	    NodesFound++;
 	    SearchTime += (GETTSC() - t0);
 	}
 #endif
+	if (tp) jitprof_lookup(tp);
 	return I;
   }
+  HashMisses++;
 
-endsrch:
 #ifdef PROFILE
   if (debug_level('e')) SearchTime += (GETTSC() - t0);
 #endif
-  if ((ninodes>500) && (((++tccount) >= CleanFreq) || NodesCleaned)) {
-	while (NodesCleaned > 0) {
-	    (void)TraverseAndClean();
-	    if (NodesCleaned) NodesCleaned--;
-	}
-	tccount=0;
-  }
-
   if (debug_level('e')) {
     if (debug_level('e')>4) e_printf("Not found key %08x\n",key);
 #ifdef PROFILE
     NodesNotFound++;
 #endif
   }
+  if (tp) jitprof_lookup(tp);
+  return NULL;
+}
+
+/* like FindTree() but without side effects on the tree, so that it can
+ * be used while other node pointers are being held */
+TNode *PeekTree(int key)
+{
+  TNode *I = NodeHashFind(key);
+
+  if (I && I->addr && (I->alive>0))
+	return I;
   return NULL;
 }
 
@@ -1182,6 +1265,16 @@ static void BreakNode(TNode *G, unsigned char *eip)
   e_printf("============ Node %08x break failed\n",G->key);
 }
 
+/* drop a single node; it is removed from the tree when the eviction
+ * clock or an invalidation reaches it */
+void KillNode(TNode *G)
+{
+  if (debug_level('e')>1) dbug_printf("Kill node %p at %08x\n",G,G->key);
+  G->alive = 0;
+  e_unmarkpage(G->seqbase, G->seqlen);
+  NodeUnlinker(G);
+}
+
 static TNode *DoDelNode(int key)
 {
   avltr_delete(key);
@@ -1201,6 +1294,8 @@ int InvalidateNodeRange(int al, int len, unsigned char *eip)
 #endif
   ah = al + len;
   if (debug_level('e')>1) dbug_printf("Invalidate area %08x..%08x\n",al,ah);
+  if (len > 0)
+    e_mpwrite(al, len);
 
   G = CollectTree.root.link[0];
   if (G == NULL) goto quit;
@@ -1249,7 +1344,6 @@ int InvalidateNodeRange(int al, int len, unsigned char *eip)
 	    e_unmarkpage(G->seqbase, G->seqlen);
 	    NodeUnlinker(G);
 	    cleaned++;
-	    NodesCleaned++;
 	    /* if the current eip is in *any* chunk of code that is deleted
 	        (not just the one written to)
 	       then we need to break the node immediately to go back to
@@ -1293,6 +1387,7 @@ void e_invalidate(unsigned data, int cnt)
 	/* for low mappings only invalidate if code, not if data */
 	if (LINEAR2UNIX(data) != MEM_BASE32(data)) {
 #ifdef HOST_ARCH_X86
+		e_mpwrite(data, cnt);
 		if (!CONFIG_CPUSIM && e_querymark(data, cnt))
 			// no need to invalidate the whole page here,
 			// as the page does not need to be unprotected
@@ -1421,18 +1516,15 @@ static struct {
 	long long a;
 	int b,c,m,d,s;
 } xCST[CST_SIZE];
-#else
-#define CST_SIZE	4
-static int xCST[CST_SIZE];
-#endif
 
 static int cstx = 0;
 static int xCS1 = 0;
+#endif
 
 void CollectStat (void)
 {
-	int i, m = 0;
 #ifdef SHOW_STAT
+	int i, m = 0;
 	int csm = config.CPUSpeedInMhz*1000;
 	xCST[cstx].a = TheCPU.EMUtime;
 	xCST[cstx].s = TheCPU.sigprof_pending;
@@ -1444,7 +1536,7 @@ void CollectStat (void)
 		m += xCST[i].c;
 	}
 	m >>= 2;
-	xCST[cstx].m = CLEAN_SPEED(FastLog2(m));
+	xCST[cstx].m = FastLog2(m);
 	i = cstx;
 	if (debug_level('e')>1)
 		e_printf("SIGPROF %04d %8d %8d(%3d) %8d %d\n",i,
@@ -1459,25 +1551,15 @@ void CollectStat (void)
 	    cstx=0;
 	}
 #else
-	xCST[cstx++] = NodesParsed;
-	if (cstx==CST_SIZE) {
-	    if (!xCS1) xCS1=1;
-	    cstx=0;
-	}
-	if (xCS1) {
-	    for (i=0; i<CST_SIZE; i++) m += xCST[i];	/* moving average */
-	    m /= CST_SIZE;
-	    m = FastLog2(m);	/* take leftmost bit index */
-	    CreationIndex = CLEAN_SPEED(m);
-	    CleanFreq = (8-m); if (CleanFreq<1) CleanFreq=1;
-	}
 	if (debug_level('e')>1)
-		e_printf("SIGPROF %d n=%8d p=%8d x=%8d ix=%3d cln=%2d\n",
+		e_printf("SIGPROF %d n=%8d p=%8d x=%8d ev=%8d kb=%6zu hit=%8d miss=%8d trc=%d/%d\n",
 			TheCPU.sigprof_pending,
-			ninodes,NodesParsed,NodesExecd,CreationIndex,
-			CleanFreq);
+			ninodes,NodesParsed,NodesExecd,NodesEvicted,
+			CodeBytes>>10,HashHits,HashMisses,TracesBuilt,
+			TracesDropped);
 #endif
 	NodesParsed = NodesExecd = 0;
+	HashHits = HashMisses = 0;
 }
 
 
@@ -1487,8 +1569,10 @@ void InitTrees(void)
 {
 	g_printf("InitTrees\n");
 #ifdef HOST_ARCH_X86
-	if (!CONFIG_CPUSIM)
+	if (!CONFIG_CPUSIM) {
 	    TNodePool = calloc(NODES_IN_POOL, sizeof(TNode));
+	    NodeHash = calloc(NODEHASH_SIZE, sizeof(hashslot));
+	}
 #endif
 
 	avltr_init();
@@ -1500,14 +1584,15 @@ void InitTrees(void)
 	}
 #endif
 	NodesParsed = NodesExecd = 0;
-	CleanFreq = 8;
+	NodesEvicted = 0;
+#ifdef SHOW_STAT
 	cstx = xCS1 = 0;
-	CreationIndex = 0;
+#endif
 #ifdef PROFILE
 	if (debug_level('e')) {
 	    MaxDepth = MaxNodes = MaxNodeSize = 0;
 	    TotalNodesParsed = TotalNodesExecd = 0;
-	    NodesFound = NodesFastFound = NodesNotFound = 0;
+	    NodesFound = NodesNotFound = 0;
 	    TreeCleanups = 0;
 	}
 #endif
@@ -1526,8 +1611,12 @@ void EndGen(void)
 	CurrIMeta = -1;
 #ifdef HOST_ARCH_X86
 	if (!CONFIG_CPUSIM) {
+	    BgTraceDone();
+	    jitcache_done();
+	    jitprof_done();
 	    avltr_destroy();
 	    free(TNodePool); TNodePool=NULL;
+	    free(NodeHash); NodeHash=NULL;
 	}
 #endif
 #ifdef SHOW_STAT
@@ -97,6 +97,7 @@ typedef struct _imeta {
 typedef struct _codebufhdr {
 	struct avltr_node *bkptr;
 	void *selfptr;
+	struct _codebufhdr *cnext, *cprev;	/* eviction clock ring */
 	Addr2Pc meta[0]; /* there are nap of these */
 	/* behind these follows the code */
 } CodeBuf;
@@ -111,10 +112,14 @@ extern int MaxNodes;
 extern int MaxNodeSize;
 extern int MaxDepth;
 extern int NodesNotFound;
-extern int NodesFastFound;
 extern int EmuSignals;
 extern int NodesFound;
 extern int TreeCleanups;
+extern int HashHits;
+extern int HashMisses;
+extern int TracesBuilt;
+extern int TracesDropped;
+extern int NodesEvicted;
 
 typedef struct avltr_node
 {
@@ -136,6 +141,8 @@ typedef struct avltr_node
 	linkdesc clink;
 	unsigned cs;
 	unsigned mode;
+	unsigned short tr_t, tr_nt;	/* exit counts while F_TRACE */
+	struct jitprof_ent *prof;	/* only with $_cpuemu_profile */
 } TNode;
 
 /* Used for traversing a right-threaded AVL tree. */
@@ -162,6 +169,8 @@ extern avltr_tree CollectTree;
 void avltr_delete (const int key);
 //
 TNode *FindTree(int key);
+TNode *PeekTree(int key);
+void KillNode(TNode *G);
 TNode *Move2Tree(IMeta *I0, CodeBuf *GenCodeBuf);
 //
 #endif
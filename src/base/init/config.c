@@ -217,6 +217,10 @@ void dump_config_status(void (*printfunc)(const char *, ...))
         config.vesamode_list, config.X_lfb, config.X_pm_interface);
     (*print)("X_font \"%s\"\n", config.X_font);
     (*print)("vga_fonts %i\n", config.vga_fonts);
+    (*print)("render_threads %i\n", config.render_threads);
+    (*print)("render_fps %i\n", config.render_fps);
+    (*print)("video_capture \"%s\"\n", config.video_capture ?: "");
+    (*print)("vga_diff_modes \"%s\"\n", config.vga_diff_modes ?: "");
     (*print)("X_mgrab_key \"%s\"\n",  config.X_mgrab_key);
     (*print)("X_background_pause %d\n", config.X_background_pause);
 
@@ -255,6 +259,7 @@ void dump_config_status(void (*printfunc)(const char *, ...))
         config.tty_lockdir, config.tty_lockfile, config.tty_lockbinary);
     (*print)("num_ser %d\nnum_lpt %d\nfastfloppy %d\nfile_lock_limit %d\n",
         config.num_ser, config.num_lpt, config.fastfloppy, config.file_lock_limit);
+    (*print)("mfs_buffer %d\n", config.mfs_buffer);
     (*print)("emusys \"%s\"\n",
         (config.emusys ? config.emusys : ""));
     (*print)("vbios_post %d\ndetach %d\n",
@@ -309,8 +314,8 @@ void dump_config_status(void (*printfunc)(const char *, ...))
 	"mpu401_base 0x%x\nmpu401_irq %i\nsound_driver \"%s\"\n",
         config.sound, config.sb_base, config.sb_dma, config.sb_hdma, config.sb_irq,
 	config.mpu401_base, config.mpu401_irq, config.sound_driver);
-    (*print)("pcm_hpf %i\nmidi_file %s\nwav_file %s\n",
-	config.pcm_hpf, config.midi_file, config.wav_file);
+    (*print)("pcm_hpf %i\nmidi_file %s\nwav_file %s\nopl_file %s\n",
+	config.pcm_hpf, config.midi_file, config.wav_file, config.opl_file);
     (*print)("\ncli_timeout %d\n", config.cli_timeout);
     (*print)("\ntimer_tweaks %d\n", config.timer_tweaks);
     (*print)("\nJOYSTICK:\njoy_device0 \"%s\"\njoy_device1 \"%s\"\njoy_dos_min %i\njoy_dos_max %i\njoy_granularity %i\njoy_latency %i\n",
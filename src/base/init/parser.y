@@ -240,7 +240,7 @@ enum {
 %token PORTS DISK DOSMEM EXT_MEM
 %token L_EMS UMB_A0 UMB_B0 UMB_F0 DOS_UP
 %token EMS_SIZE EMS_FRAME EMS_UMA_PAGES EMS_CONV_PAGES
-%token TTYLOCKS L_SOUND L_SND_OSS L_JOYSTICK FILE_LOCK_LIMIT
+%token TTYLOCKS L_SOUND L_SND_OSS L_JOYSTICK FILE_LOCK_LIMIT MFS_BUFFER
 %token ABORT WARN ERROR
 %token L_FLOPPY EMUSYS L_X L_SDL
 %token DOSEMUMAP LOGBUFSIZE LOGFILESIZE MAPPINGDRIVER
@@ -248,7 +248,7 @@ enum {
 	/* speaker */
 %token EMULATED NATIVE
 	/* cpuemu */
-%token CPUEMU CPU_VM CPU_VM_DPMI VM86 KVM
+%token CPUEMU CPUEMU_CACHE CPUEMU_PROFILE CPUEMU_CODESIZE CPUEMU_BGCOMPILE CPU_VM CPU_VM_DPMI VM86 KVM
 	/* keyboard */
 %token RAWKEYBOARD
 %token PRESTROKE
@@ -273,7 +273,8 @@ enum {
 %token VGA MGA CGA EGA NONE CONSOLE GRAPHICS CHIPSET FULLREST PARTREST
 %token MEMSIZE VBIOS_SIZE_TOK VBIOS_SEG VGAEMUBIOS_FILE VBIOS_FILE 
 %token VBIOS_COPY VBIOS_MMAP DUALMON
-%token VBIOS_POST VGA_FONTS
+%token VBIOS_POST VGA_FONTS RENDER_THREADS VGA_DIFF_MODES RENDER_FPS
+%token VIDEO_CAPTURE
 
 %token FORCE_VT_SWITCH PCI
 	/* terminal */
@@ -303,7 +304,7 @@ enum {
 %token SB_BASE SB_IRQ SB_DMA SB_HDMA MPU_BASE MPU_IRQ MPU_IRQ_MT32 MIDI_SYNTH
 %token SOUND_DRIVER MIDI_DRIVER FLUID_SFONT FLUID_VOLUME
 %token MUNT_ROMS OPL2LPT_DEV OPL2LPT_TYPE
-%token SND_PLUGIN_PARAMS PCM_HPF MIDI_FILE WAV_FILE
+%token SND_PLUGIN_PARAMS PCM_HPF MIDI_FILE WAV_FILE OPL_FILE
 	/* CD-ROM */
 %token CDROM
 	/* ASPI driver */
@@ -432,6 +433,10 @@ line:		CHARSET '{' charset_flags '}' {}
 		    {
 		    config.file_lock_limit = $2;
 		    }
+		| MFS_BUFFER INTEGER
+		    {
+		    config.mfs_buffer = $2;
+		    }
 		| LFN_SUPPORT bool
 		    {
 		    config.lfn = ($2!=0);
@@ -484,6 +489,43 @@ line:		CHARSET '{' charset_flags '}' {}
 			config.cpusim = $2;
 			c_printf("CONF: CPUEMU set to %s\n",
 				CONFIG_CPUSIM ? "sim" : "jit");
+#endif
+			}
+		| CPUEMU_CACHE string_expr
+			{
+#ifdef X86_EMULATOR
+			free(config.cpuemu_cache);
+			config.cpuemu_cache = $2;
+			c_printf("CONF: CPUEMU code cache = '%s'\n", $2);
+#else
+			free($2);
+#endif
+			}
+		| CPUEMU_PROFILE string_expr
+			{
+#ifdef X86_EMULATOR
+			free(config.cpuemu_profile);
+			config.cpuemu_profile = $2;
+			c_printf("CONF: CPUEMU profile = '%s'\n", $2);
+#else
+			free($2);
+#endif
+			}
+		| CPUEMU_CODESIZE expression
+			{
+#ifdef X86_EMULATOR
+			if ($2 >= 0)
+				config.cpuemu_codesize = $2;
+			c_printf("CONF: CPUEMU code budget %dk\n",
+				config.cpuemu_codesize);
+#endif
+			}
+		| CPUEMU_BGCOMPILE bool
+			{
+#ifdef X86_EMULATOR
+			config.cpuemu_bgcompile = ($2!=0);
+			c_printf("CONF: CPUEMU background trace compile %s\n",
+				config.cpuemu_bgcompile ? "on" : "off");
 #endif
 			}
 		| CPUSPEED real_expression
@@ -695,6 +737,14 @@ line:		CHARSET '{' charset_flags '}' {}
 		    { stop_video(); }
 		| VGA_FONTS bool
 		    { config.vga_fonts = ($2!=0); }
+		| RENDER_THREADS expression
+		    { config.render_threads = $2; }
+		| RENDER_FPS expression
+		    { config.render_fps = $2; }
+		| VIDEO_CAPTURE string_expr
+		    { free(config.video_capture); config.video_capture = $2; }
+		| VGA_DIFF_MODES string_expr
+		    { free(config.vga_diff_modes); config.vga_diff_modes = $2; }
 		| XTERM_TITLE string_expr { free(config.xterm_title); config.xterm_title = $2; }
 		| TERMINAL
                   '{' term_flags '}'
@@ -1156,6 +1206,7 @@ sound_flag	: SB_BASE expression	{ config.sb_base = $2; }
 		| PCM_HPF bool		{ config.pcm_hpf = ($2!=0); }
 		| MIDI_FILE string_expr	{ free(config.midi_file); config.midi_file = $2; }
 		| WAV_FILE string_expr	{ free(config.wav_file); config.wav_file = $2; }
+		| OPL_FILE string_expr	{ free(config.opl_file); config.opl_file = $2; }
 		;
 
 	/* joystick emulation */
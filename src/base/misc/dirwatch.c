@@ -0,0 +1,179 @@
+/*
+ * (C) Copyright 1992, ..., 2014 the "DOSEMU-Development-Team".
+ *
+ * for details see file COPYING in the DOSEMU distribution
+ */
+
+/*
+ * Host directory change tracker, see dirwatch.h.
+ *
+ * All watches share one inotify instance, which is in the io_select()
+ * set, so the events are handled asynchronously. A cache that must not
+ * use anything stale calls dirwatch_sync() before a lookup: inotify
+ * queues the events when the change is done, so reading the queue then
+ * gives all changes that happened before.
+ *
+ * inotify has one watch per inode, so two watches of the same directory
+ * share the watch descriptor, and the mask of the watch is the union of
+ * theirs.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include "emu.h"
+#include "dirwatch.h"
+
+#define DIRWATCH_HASH 64
+
+struct dirwatch {
+  int wd;
+  int dead;			/* got IN_IGNORED */
+  uint32_t mask;
+  void (*func)(void *, uint32_t);
+  void *arg;
+  struct dirwatch *next;
+};
+
+static struct dirwatch *watch_hash[DIRWATCH_HASH];
+static int watch_fd = -1;
+static int watch_failed;
+
+static void dirwatch_event(const struct inotify_event *ev)
+{
+  struct dirwatch *w;
+  int i;
+
+  if (ev->mask & IN_Q_OVERFLOW) {
+    d_printf("dirwatch: event queue overflow\n");
+    for (i = 0; i < DIRWATCH_HASH; i++)
+      for (w = watch_hash[i]; w; w = w->next)
+        w->func(w->arg, IN_Q_OVERFLOW);
+    return;
+  }
+  for (w = watch_hash[ev->wd % DIRWATCH_HASH]; w; w = w->next) {
+    if (w->wd != ev->wd || w->dead)
+      continue;
+    if (ev->mask & IN_IGNORED) {
+      w->dead = 1;
+      w->func(w->arg, IN_IGNORED);
+    } else if (ev->mask & w->mask) {
+      w->func(w->arg, ev->mask & w->mask);
+    }
+  }
+}
+
+void dirwatch_sync(void)
+{
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+  char *p;
+
+  if (watch_fd == -1)
+    return;
+  while ((len = read(watch_fd, buf, sizeof(buf))) > 0) {
+    for (p = buf; p < buf + len; ) {
+      const struct inotify_event *ev = (const struct inotify_event *)p;
+      dirwatch_event(ev);
+      p += sizeof(*ev) + ev->len;
+    }
+  }
+  if (len == -1 && errno != EAGAIN && errno != EINTR)
+    error("dirwatch: read failed: %s\n", strerror(errno));
+}
+
+static void dirwatch_async(int fd, void *arg)
+{
+  dirwatch_sync();
+}
+
+/* inotify only sees the changes made through this kernel */
+static int dirwatch_local(const char *path)
+{
+  struct statfs buf;
+
+  if (statfs(path, &buf) != 0)
+    return 0;
+  switch (buf.f_type) {
+  case NFS_SUPER_MAGIC:
+  case SMB_SUPER_MAGIC:
+  case CIFS_SUPER_MAGIC:
+#ifdef SMB2_SUPER_MAGIC
+  case SMB2_SUPER_MAGIC:
+#endif
+  case FUSE_SUPER_MAGIC:
+  case V9FS_MAGIC:
+  case CEPH_SUPER_MAGIC:
+  case AFS_FS_MAGIC:
+  case CODA_SUPER_MAGIC:
+    return 0;
+  }
+  return 1;
+}
+
+struct dirwatch *dirwatch_add(const char *path, uint32_t mask,
+    void (*func)(void *, uint32_t), void *arg)
+{
+  struct dirwatch *w;
+  int wd;
+
+  if (watch_failed || !dirwatch_local(path))
+    return NULL;
+  w = malloc(sizeof(*w));
+  if (!w)
+    return NULL;
+  if (watch_fd == -1) {
+    watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch_fd == -1) {
+      d_printf("dirwatch: inotify not available: %s\n", strerror(errno));
+      watch_failed = 1;
+      free(w);
+      return NULL;
+    }
+    add_to_io_select(watch_fd, dirwatch_async, NULL);
+  }
+  wd = inotify_add_watch(watch_fd, path,
+      mask | IN_MASK_ADD | IN_ONLYDIR | IN_EXCL_UNLINK);
+  if (wd == -1) {
+    /* ENOSPC: out of watches, see fs.inotify.max_user_watches */
+    d_printf("dirwatch: can't watch %s: %s\n", path, strerror(errno));
+    free(w);
+    return NULL;
+  }
+  w->wd = wd;
+  w->dead = 0;
+  w->mask = mask;
+  w->func = func;
+  w->arg = arg;
+  w->next = watch_hash[wd % DIRWATCH_HASH];
+  watch_hash[wd % DIRWATCH_HASH] = w;
+  d_printf("dirwatch: watching %s, wd %d\n", path, wd);
+  return w;
+}
+
+void dirwatch_remove(struct dirwatch *w)
+{
+  struct dirwatch **pp, *o;
+  int wd, dead;
+
+  if (!w)
+    return;
+  wd = w->wd;
+  dead = w->dead;
+  for (pp = &watch_hash[wd % DIRWATCH_HASH]; *pp; pp = &(*pp)->next) {
+    if (*pp == w) {
+      *pp = w->next;
+      break;
+    }
+  }
+  free(w);
+  if (dead)
+    return;
+  for (o = watch_hash[wd % DIRWATCH_HASH]; o; o = o->next)
+    if (o->wd == wd && !o->dead)
+      return;
+  inotify_rm_watch(watch_fd, wd);
+}
@@ -928,6 +928,43 @@ int dos_write(int fd, unsigned data, int cnt)
   return (ret);
 }
 
+/* as dos_read()/dos_write(), but at pos and without moving the file offset */
+int dos_pread(int fd, unsigned data, int cnt, off_t pos)
+{
+  int ret;
+  if (vga.inst_emu && data >= 0xa0000 && data < 0xc0000) {
+    char buf[cnt];
+    ret = RPT_SYSCALL(pread(fd, buf, cnt, pos));
+    if (ret >= 0)
+      memcpy_to_vga(data, buf, ret);
+  }
+  else
+    ret = RPT_SYSCALL(pread(fd, LINEAR2UNIX(data), cnt, pos));
+  if (ret > 0)
+	e_invalidate(data, ret);
+  return (ret);
+}
+
+int dos_pwrite(int fd, unsigned data, int cnt, off_t pos)
+{
+  int ret;
+  const unsigned char *d;
+  unsigned char *buf;
+
+  if (!cnt)
+    return 0;
+  buf = alloca(cnt);
+  if (vga.inst_emu && data >= 0xa0000 && data < 0xc0000) {
+    memcpy_from_vga(buf, data, cnt);
+    d = buf;
+  } else {
+    d = LINEAR2UNIX(data);
+  }
+  ret = RPT_SYSCALL(pwrite(fd, d, cnt, pos));
+  g_printf("Wrote %10.10s\n", d);
+  return (ret);
+}
+
 #define BUF_SIZE 1024
 int com_vsnprintf(char *str, size_t msize, const char *format, va_list ap)
 {
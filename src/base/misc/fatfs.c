@@ -71,6 +71,7 @@
 #include "utilities.h"
 #include "fatfs.h"
 #include "fatfs_priv.h"
+#include "dirwatch.h"
 
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
@@ -95,6 +96,8 @@ static int read_dir(fatfs_t *, unsigned, unsigned, unsigned,
 	unsigned char *buf);
 static unsigned next_cluster(fatfs_t *, unsigned);
 static void build_boot_blk(fatfs_t *m, unsigned char *b);
+static void load_boot_blk(fatfs_t *f);
+static int read_file_secs(fatfs_t *, unsigned, unsigned, int);
 
 static uint64_t sys_type;
 static int sys_done;
@@ -262,6 +265,15 @@ void fatfs_init(struct disk *dp)
               f->total_secs, f->cluster_secs);
 
   }
+  f->dp.sectors = dp->sectors;
+  f->dp.heads = dp->heads;
+  f->dp.tracks = dp->tracks;
+  f->dp.start = dp->start;
+  f->dp.serial = dp->serial;
+  f->dp.floppy = dp->floppy;
+  f->dp.default_cmos = dp->default_cmos;
+  f->dp.drive_num = dp->drive_num;
+
   f->serial = dp->serial;
   f->secs_track = dp->sectors;
   f->bytes_per_sect = SECTOR_SIZE;
@@ -319,6 +331,10 @@ void fatfs_done(struct disk *dp)
 
   if(!(f = dp->fatfs)) return;
 
+  for(u = 0; u < f->watches; u++)
+    dirwatch_remove(f->watch[u]);
+  free(f->watch);
+
   for(u = 1 ; u < f->objs; u++) {
     if(f->obj[u].name)
       free(f->obj[u].name);
@@ -329,11 +345,38 @@ void fatfs_done(struct disk *dp)
   if(f->ffn) free(f->ffn);
   if(f->boot_sec) free(f->boot_sec);
   if(f->obj) free(f->obj);
+  free(f->clu_obj);
 
   free(dp->fatfs); dp->fatfs = NULL;
 }
 
 
+/*
+ * The FAT view of a directory is built as DOS reads it, and is rebuilt
+ * from scratch on reboot. If inotify saw no change in any host dir read
+ * so far and the disk is the same, the old view is still valid.
+ */
+void fatfs_reset(struct disk *dp)
+{
+  fatfs_t *f = dp->fatfs;
+
+  dirwatch_sync();
+  if(f && f->ok && !f->unwatched && !f->changed &&
+     f->dp.sectors == dp->sectors && f->dp.heads == dp->heads &&
+     f->dp.tracks == dp->tracks && f->dp.start == dp->start &&
+     f->dp.serial == dp->serial && f->dp.floppy == dp->floppy &&
+     f->dp.default_cmos == dp->default_cmos &&
+     f->dp.drive_num == dp->drive_num) {
+    fatfs_msg("reset: %s unchanged, %u objects kept\n", dp->dev_name, f->objs);
+    /* the boot hooks patch the boot block */
+    if(f->boot_sec)
+      load_boot_blk(f);
+    return;
+  }
+  fatfs_init(dp);
+}
+
+
 /*
  * Returns # of read sectors, -1 = sector not found, -2 = read error.
  */
@@ -347,6 +390,12 @@ int fatfs_read(fatfs_t *f, unsigned buf, unsigned pos, int len)
   if(!f->ok) return -1;
 
   while(l) {
+    /* file data goes directly to DOS memory, up to the end of the file */
+    if((i = read_file_secs(f, buf, pos, l))) {
+      if(i < 0) return i;
+      buf += i << 9; pos += i; l -= i;
+      continue;
+    }
     if((i = read_sec(f, pos, b))) return i;
     MEMCPY_2DOS(buf, b, 0x200);
     e_invalidate(buf, 0x200);
@@ -901,6 +950,68 @@ static void set_vol_and_len(fatfs_t *f, unsigned oi)
   o->len = (o->size + u - 1) / u;
 }
 
+/*
+ * Load boot block from "boot.blk" file or generate Dosemu's own.
+ */
+static void load_boot_blk(fatfs_t *f)
+{
+  struct stat sb;
+  char *s;
+  int fd, read_bb;
+
+  s = full_name(f, 0, "boot.blk");
+  read_bb = 0;
+  if (s && (fd = open(s, O_RDONLY)) != -1) {
+    if (
+        fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size == 0x200 &&
+        read(fd, f->boot_sec, 0x200) == 0x200) {
+      read_bb = 1;
+      fatfs_msg("fatfs: boot block taken from boot.blk\n");
+      update_geometry(f, f->boot_sec);
+    }
+    close(fd);
+  }
+  if (!read_bb) {
+    fatfs_msg("fatfs: boot block generated\n");
+    build_boot_blk(f, f->boot_sec);
+  }
+}
+
+static void watch_changed(void *arg, uint32_t mask)
+{
+  fatfs_t *f = arg;
+
+  if(!f->changed)
+    fatfs_msg("%s changed on the host, rebuilt on the next reboot\n", f->dir);
+  f->changed = 1;
+}
+
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+    IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF)
+
+static void watch_dir(fatfs_t *f, const char *name)
+{
+  struct dirwatch *w;
+
+  if(f->unwatched) return;
+  if(f->watches >= f->alloc_watches) {
+    unsigned n = f->alloc_watches ? f->alloc_watches * 2 : 16;
+    void *p = realloc(f->watch, n * sizeof *f->watch);
+    if(!p) {
+      f->unwatched = 1;
+      return;
+    }
+    f->watch = p;
+    f->alloc_watches = n;
+  }
+  w = dirwatch_add(name, WATCH_EVENTS, watch_changed, f);
+  if(!w) {
+    f->unwatched = 1;
+    return;
+  }
+  f->watch[f->watches++] = w;
+}
+
 /*
  * Reads the directory entries and assigns the object ids.
  */
@@ -913,7 +1024,6 @@ void scan_dir(fatfs_t *f, unsigned oi)
   int i;
   struct dirent **dlist;
   int num;
-  int read_bb;
 
   // just checking...
   if(!o->is.dir || o->size || !o->name || o->is.scanned) {
@@ -936,6 +1046,7 @@ void scan_dir(fatfs_t *f, unsigned oi)
     f->sys_objs = 0;
   }
   name = strdup(name);
+  watch_dir(f, name);
   cur_d = f;
   num = scandir(name, &dlist, d_filter, d_compar);
   free(name);
@@ -1077,24 +1188,8 @@ void scan_dir(fatfs_t *f, unsigned oi)
                 system_type(f->sys_type), f->sys_type);
     }
 
-    /* load boot block from "boot.blk" file or generate Dosemu's own */
     f->boot_sec = malloc(0x200);
-    s = full_name(f, oi, "boot.blk");
-    read_bb = 0;
-    if (s && (fd = open(s, O_RDONLY)) != -1) {
-      if (
-          fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size == 0x200 &&
-          read(fd, f->boot_sec, 0x200) == 0x200) {
-        read_bb = 1;
-        fatfs_msg("fatfs: boot block taken from boot.blk\n");
-        update_geometry(f, f->boot_sec);
-      }
-      close(fd);
-    }
-    if (!read_bb) {
-      fatfs_msg("fatfs: boot block generated\n");
-      build_boot_blk(f, f->boot_sec);
-    }
+    load_boot_blk(f);
   }
 
   for (i = 0; i < num; i++) {
@@ -1174,9 +1269,10 @@ static void _add_object(fatfs_t *f, unsigned parent, char *s, const char *name)
   struct stat sb;
   obj_t tmp_o = {{0}, 0};
   unsigned u;
+  int is_link;
 
   fatfs_deb("trying to add \"%s\":\n", s);
-  if(stat(s, &sb)) {
+  if(lstat(s, &sb) || ((is_link = S_ISLNK(sb.st_mode)) && stat(s, &sb))) {
       fatfs_deb("file not found\n");
       return;
   }
@@ -1186,6 +1282,13 @@ static void _add_object(fatfs_t *f, unsigned parent, char *s, const char *name)
     return;
   }
 
+  /* the dir watch only sees writes made through this dir, not those
+   * to a symlink target or through another hard link */
+  if(S_ISREG(sb.st_mode) && (is_link || sb.st_nlink > 1) && !f->unwatched) {
+    fatfs_msg("%s is linked, host changes are not tracked\n", s);
+    f->unwatched = 1;
+  }
+
   if(S_ISREG(sb.st_mode)) {
     tmp_o.size = sb.st_size;
     u = f->cluster_secs << 9;
@@ -1373,23 +1476,31 @@ unsigned make_dos_entry(fatfs_t *f, const obj_t *o, unsigned char **e)
 }
 
 
+/*
+ * Objects get their clusters in ascending order, so clu_obj[] is sorted
+ * by start cluster and the object of a cluster is found by bisection.
+ */
 unsigned find_obj(fatfs_t *f, unsigned clu)
 {
-  unsigned u;
+  unsigned lo = 0, hi = f->clu_objs, mid;
+  obj_t *o;
 
   if(clu >= f->first_free_cluster) return 0;
 
-  for(u = 0; u < f->objs; u++) {
-    if(
-      !f->obj[u].is.not_real &&
-      clu >= f->obj[u].start &&
-      clu < f->obj[u].start + f->obj[u].len
-    ) break;
+  /* find the last object that starts at or before clu */
+  while(hi - lo > 1) {
+    mid = (lo + hi) / 2;
+    if(f->obj[f->clu_obj[mid]].start <= clu)
+      lo = mid;
+    else
+      hi = mid;
   }
+  if(lo == hi) return 0;
 
-  if(u == f->objs) return 0;
+  o = f->obj + f->clu_obj[lo];
+  if(clu < o->start || clu >= o->start + o->len) return 0;
 
-  return u;
+  return f->clu_obj[lo];
 }
 
 
@@ -1407,8 +1518,20 @@ void assign_clusters(fatfs_t *f, unsigned max_clu, unsigned max_obj)
     if(f->obj[u].is.not_real) continue;
     if(f->obj[u].start) continue;
     if(f->obj[u].is.dir && !f->obj[u].is.scanned) scan_dir(f, u);
+    if(f->clu_objs >= f->alloc_clu_objs) {
+      unsigned n = f->alloc_clu_objs ? f->alloc_clu_objs * 2 : 64;
+      void *p = realloc(f->clu_obj, n * sizeof *f->clu_obj);
+      if(p == NULL) {
+        fatfs_msg("assign_clusters: out of memory\n");
+        break;
+      }
+      f->clu_obj = p;
+      f->alloc_clu_objs = n;
+    }
     f->obj[u].start = f->first_free_cluster;
     f->first_free_cluster += f->obj[u].len;
+    if(f->first_free_cluster <= f->last_cluster)
+      f->clu_obj[f->clu_objs++] = u;
     if(f->first_free_cluster > f->last_cluster) {
       f->obj[u].start = 0;
       f->obj[u].is.not_real = 1;
@@ -1460,20 +1583,83 @@ int read_cluster(fatfs_t *f, unsigned clu, unsigned pos, unsigned char *buf)
 }
 
 
-int read_file(fatfs_t *f, unsigned oi, unsigned clu, unsigned pos,
-	unsigned char *buf)
+/*
+ * Open the host file of object oi, keeping one file open.
+ */
+static int open_obj(fatfs_t *f, unsigned oi)
 {
-  obj_t *o = f->obj + oi;
-  char *s;
-  off_t ofs;
-
   if(f->fd_obj && oi != f->fd_obj) {
      close(f->fd);
      f->fd = -1;
      f->fd_obj = 0;
   }
 
-  fatfs_deb2("read_file: obj %u, cluster %u, sec %u%s\n", oi, clu, pos, f->fd_obj ? " (fd cached)" : "");
+  if(f->fd_obj == 0) {
+    if((f->fd = open(f->obj[oi].full_name, O_RDONLY | O_CLOEXEC)) == -1) {
+      fatfs_deb("fatfs: open %s failed\n", f->obj[oi].full_name);
+      return -1;
+    }
+    f->fd_obj = oi;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Read the data sectors from pos on that belong to one file, at most len,
+ * directly into DOS memory at buf, with one pread().
+ * Returns # of read sectors, 0 if pos is not in a file, -1 = sector not
+ * found, -2 = read error.
+ */
+static int read_file_secs(fatfs_t *f, unsigned buf, unsigned pos, int len)
+{
+  unsigned data_start, clu, sec, oi, n;
+  obj_t *o;
+  off_t ofs;
+  int size, ret;
+
+  data_start = f->reserved_secs + f->fat_secs * f->fats + f->root_secs;
+  if(pos < data_start || pos >= f->total_secs) return 0;
+
+  clu = (pos - data_start) / f->cluster_secs + 2;
+  sec = (pos - data_start) % f->cluster_secs;
+  if(!f->got_all_objs && clu >= f->first_free_cluster) assign_clusters(f, clu, 0);
+  if(!(oi = find_obj(f, clu)) || f->obj[oi].is.dir) return 0;
+  o = f->obj + oi;
+
+  n = (o->start + o->len - clu) * f->cluster_secs - sec;
+  if(n > len) n = len;
+  if(n > f->total_secs - pos) n = f->total_secs - pos;
+
+  ofs = (off_t)((clu - o->start) * f->cluster_secs + sec) << 9;
+  size = 0;
+  if(ofs < o->size) {
+    size = _min(o->size - ofs, n << 9);
+    fatfs_deb2("read_file_secs: obj %u, %u sectors, 0x%x bytes at 0x%llx\n",
+	oi, n, size, (unsigned long long)ofs);
+    if(open_obj(f, oi)) return -1;
+    if((ret = dos_pread(f->fd, buf, size, ofs)) == -1) return -2;
+    /* the file got shorter on the host */
+    size = ret;
+  }
+  if(size < n << 9) {
+    MEMSET_DOS(buf + size, 0, (n << 9) - size);
+    e_invalidate(buf + size, (n << 9) - size);
+  }
+
+  return n;
+}
+
+
+int read_file(fatfs_t *f, unsigned oi, unsigned clu, unsigned pos,
+	unsigned char *buf)
+{
+  obj_t *o = f->obj + oi;
+  char *s;
+  int ret;
+
+  fatfs_deb2("read_file: obj %u, cluster %u, sec %u%s\n", oi, clu, pos, f->fd_obj == oi ? " (fd cached)" : "");
 
   if(clu && o->start == 0) return -1;
   if(clu < o->start) return -1;
@@ -1488,19 +1674,10 @@ int read_file(fatfs_t *f, unsigned oi, unsigned clu, unsigned pos,
   s = o->full_name;
   fatfs_deb2("going to read 0x200 bytes from file \"%s\", ofs 0x%x \n", s, pos);
 
-  if(f->fd_obj == 0) {
-    if((f->fd = open(s, O_RDONLY | O_CLOEXEC)) == -1) {
-      fatfs_deb("fatfs: open %s failed\n", s);
-      return -1;
-    }
-    f->fd_obj = oi;
-  }
-
-  if((ofs = lseek(f->fd, pos, SEEK_SET)) == -1) return -1;
-
-  if(ofs != pos) return -1;
+  if(open_obj(f, oi)) return -1;
 
-  if(read(f->fd, buf, 0x200) == -1) return -2;
+  if((ret = RPT_SYSCALL(pread(f->fd, buf, 0x200, pos))) == -1) return -2;
+  if(ret < 0x200) memset(buf + ret, 0, 0x200 - ret);
 
   return 0;
 }
@@ -58,6 +58,8 @@ struct fatfs_s {
   unsigned objs, alloc_objs;
   unsigned sys_objs;
   obj_t *obj;
+  unsigned *clu_obj;			/* objs with clusters, by start */
+  unsigned clu_objs, alloc_clu_objs;
 
   char *ffn, *ffn_ptr;			/* buffer for file names */
   unsigned ffn_obj;
@@ -69,6 +71,15 @@ struct fatfs_s {
 
   int sys_found[MAX_SYS_IDX];
   struct sys_dsc sfiles[MAX_SYS_IDX];
+
+  struct dirwatch **watch;		/* host dirs read so far */
+  unsigned watches, alloc_watches;
+  unsigned unwatched;			/* a dir or file could not be watched */
+  volatile int changed;			/* the host tree changed */
+  struct {				/* disk parameters at init */
+    int sectors, heads, tracks, floppy, default_cmos, drive_num;
+    unsigned long start, serial;
+  } dp;
 };
 
 #endif
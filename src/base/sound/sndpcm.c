@@ -37,15 +37,25 @@
 #include <assert.h>
 #include "emu.h"
 #include "utilities.h"
-#include "ringbuf.h"
 #include "timers.h"
 #include "sound/sound.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 
 #define pcm_printf(...) do { \
     if (debug_level('S') >= 9) S_printf(__VA_ARGS__); \
 } while (0)
-#define SND_BUFFER_SIZE 100000	/* enough to hold 1.1s of 44100/stereo */
+#define SND_BUFFER_FRAMES 65536	/* power of 2, holds 1.4s of 44100 */
+#define SND_MAX_BLOCKS 256
+#define MIX_CHUNK 256
+#define RS_TAPS 16		/* input frames per output frame, even */
+#define RS_PHASES 256
+#define RS_ROLLOFF 0.9
+/* filter cutoffs are 2% apart, down to 1/64 of the input rate */
+#define RS_FC_STEP 1.02
+#define MAX_RS_FILTERS 210
 #define BUFFER_DELAY 40000.0
 
 #define MIN_BUFFER_DELAY (BUFFER_DELAY)
@@ -90,21 +100,28 @@ enum {
     SNDBUF_STATE_STALLED,
 };
 
-struct sample {
-    int format;
+/* Frames written at one rate with contiguous timestamps share a block:
+ * the timestamp of frame f is tstamp + (f - start) * period. */
+struct frame_blk {
+    long long start;
     double tstamp;
-    unsigned char data[2];
+    double period;
 };
 
 struct stream {
     int channels;
-    struct rng_s buffer;
-    /* buf_cnt is a flat counter, never decrements. We have to use
-     * something really "long" for it, because "int" can overflow in
-     * about 6.7 hours of playing stereo sound at rate 44100.
-     * Surprisingly @runderwoo have actually hit such overflow when
-     * buf_cnt was "int". Lets use "long long". */
-    long long buf_cnt;
+    /* samples, one array per channel, already converted to S16 */
+    sndbuf_t *data[SNDBUF_CHANS];
+    struct frame_blk blk[SND_MAX_BLOCKS];
+    int blk_first;
+    int blk_num;
+    /* The buffer holds the frames [head, tail). Both are flat counters
+     * that never decrement. We have to use something really "long" for
+     * them, because "int" can overflow in about 6.7 hours of playing
+     * stereo sound at rate 44100. Surprisingly @runderwoo have actually
+     * hit such overflow when the counter was "int". Lets use "long long". */
+    long long head;
+    long long tail;
     int state;
     int flags;
     int stretch:1;
@@ -136,12 +153,24 @@ struct efp_link {
 
 struct pcm_player_wr {
     double time;
-    long long last_cnt[MAX_STREAMS];
-    int last_idx[MAX_STREAMS];
+    long long last_pos[MAX_STREAMS];
     double last_tstamp[MAX_STREAMS];
     struct efp_link efpl[MAX_EFP_LINKS];
     int num_efp_links;
+    int resample;
+};
+
+enum { RESAMPLE_LINEAR, RESAMPLE_SINC };
+
+/* windowed sinc, one set of RS_TAPS coefficients per fractional phase */
+struct rs_filter {
+    double fc;
+    float coef[RS_PHASES + 1][RS_TAPS];
 };
+static struct rs_filter *rs_filters[MAX_RS_FILTERS];
+/* frames kept below the timestamp: the sinc resampler needs RS_TAPS / 2
+   frames of history, the linear one 1 */
+static int guard_frames = 1;
 
 
 #define HPF_CTL 10
@@ -208,6 +237,7 @@ static int pcm_get_cfg(const char *name)
 
 int pcm_init(void)
 {
+    int i;
 #ifdef USE_DL_PLUGINS
     int ca = -1, cs = -1;
 #endif
@@ -263,15 +293,103 @@ int pcm_init(void)
       pcm_printf("no PCM effect processors initialized\n");
     if (!pcm_init_plugins(pcm.players, pcm.num_players))
       pcm_printf("ERROR: no PCM output plugins initialized\n");
+    for (i = 0; i < pcm.num_players; i++) {
+	struct pcm_holder *p = &pcm.players[i];
+	char *rs = pcm_parse_params(config.snd_plugin_params,
+		p->plugin->name, "resample");
+	if (!rs)
+	    continue;
+	if (!strcmp(rs, "sinc")) {
+	    PL_PRIV(p)->resample = RESAMPLE_SINC;
+	    guard_frames = RS_TAPS / 2;
+	}
+	else if (strcmp(rs, "linear"))
+	    error("PCM: unknown resampler \"%s\" for %s\n", rs,
+		    p->plugin->name);
+	free(rs);
+    }
     if (!pcm_init_plugins(pcm.recorders, pcm.num_recorders))
       pcm_printf("ERROR: no PCM input plugins initialized\n");
     return 1;
 }
 
+#define FRAME_IDX(f) ((f) & (SND_BUFFER_FRAMES - 1))
+
+static int strm_count(struct stream *s)
+{
+    return s->tail - s->head;
+}
+
+static struct frame_blk *strm_blk(struct stream *s, int n)
+{
+    return &s->blk[(s->blk_first + n) % SND_MAX_BLOCKS];
+}
+
+/* first frame past block n */
+static long long strm_blk_end(struct stream *s, int n)
+{
+    return n + 1 < s->blk_num ? strm_blk(s, n + 1)->start : s->tail;
+}
+
+static double blk_ts(const struct frame_blk *b, long long f)
+{
+    return b->tstamp + (f - b->start) * b->period;
+}
+
+/* block holding frame f, head <= f < tail */
+static int strm_find_blk(struct stream *s, long long f)
+{
+    int n;
+    for (n = 0; n + 1 < s->blk_num && strm_blk(s, n + 1)->start <= f; n++);
+    return n;
+}
+
+static double strm_ts(struct stream *s, long long f)
+{
+    return blk_ts(strm_blk(s, strm_find_blk(s, f)), f);
+}
+
+/* timestamp the next frame gets if it continues the last block */
+static double strm_next_ts(struct stream *s)
+{
+    return blk_ts(strm_blk(s, s->blk_num - 1), s->tail);
+}
+
+/* make room for the frame at tail, starting a new block if needed */
+static int strm_put_frame(struct stream *s, double tstamp, double period)
+{
+    struct frame_blk *b;
+    if (strm_count(s) >= SND_BUFFER_FRAMES)
+	return 0;
+    if (s->blk_num) {
+	b = strm_blk(s, s->blk_num - 1);
+	if (b->period == period && blk_ts(b, s->tail) == tstamp)
+	    return 1;
+	if (s->blk_num >= SND_MAX_BLOCKS)
+	    return 0;
+    }
+    b = strm_blk(s, s->blk_num++);
+    b->start = s->tail;
+    b->tstamp = tstamp;
+    b->period = period;
+    return 1;
+}
+
+static void strm_drop_frames(struct stream *s, int num)
+{
+    s->head += num;
+    while (s->blk_num > 1 && strm_blk(s, 1)->start <= s->head) {
+	s->blk_first = (s->blk_first + 1) % SND_MAX_BLOCKS;
+	s->blk_num--;
+    }
+    if (s->head == s->tail)
+	s->blk_num = 0;
+}
+
 static void pcm_clear_stream(int strm_idx)
 {
-    pcm.stream[strm_idx].buf_cnt += rng_count(&pcm.stream[strm_idx].buffer);
-    rng_clear(&pcm.stream[strm_idx].buffer);
+    struct stream *s = &pcm.stream[strm_idx];
+    strm_drop_frames(s, strm_count(s));
 }
 
 static void pcm_reset_stream(int strm_idx)
@@ -286,20 +404,22 @@ static void pcm_reset_stream(int strm_idx)
 
 int pcm_allocate_stream(int channels, const char *name, void *vol_arg)
 {
-    int index;
+    int index, i;
     if (pcm.num_streams >= MAX_STREAMS) {
 	error("PCM: stream pool exhausted, max=%i\n", MAX_STREAMS);
 	return -1;
     }
+    assert(channels <= SNDBUF_CHANS);
     pthread_mutex_lock(&pcm.strm_mtx);
     index = pcm.num_streams++;
-    rng_init(&pcm.stream[index].buffer, SND_BUFFER_SIZE,
-	     sizeof(struct sample));
-    /* to keep timestamps contiguous, we disable overwrites */
-    rng_allow_ovw(&pcm.stream[index].buffer, 0);
+    /* to keep timestamps contiguous, the buffer is never overwritten */
+    for (i = 0; i < channels; i++)
+	pcm.stream[index].data[i] = malloc(SND_BUFFER_FRAMES *
+		sizeof(sndbuf_t));
     pcm.stream[index].channels = channels;
     pcm.stream[index].name = name;
-    pcm.stream[index].buf_cnt = 0;
+    pcm.stream[index].head = pcm.stream[index].tail = 0;
+    pcm.stream[index].blk_num = 0;
     pcm.stream[index].vol_arg = vol_arg;
     pcm_reset_stream(index);
     pthread_mutex_unlock(&pcm.strm_mtx);
@@ -461,14 +581,6 @@ int pcm_frag_size(double period, struct player_params *params)
     return nsamps * pcm_format_size(params->format);
 }
 
-static int peek_last_sample(int strm_idx, struct sample *samp)
-{
-    int idx = rng_count(&pcm.stream[strm_idx].buffer);
-    if (!idx)
-	return 0;
-    return rng_peek(&pcm.stream[strm_idx].buffer, idx - 1, samp);
-}
-
 void pcm_prepare_stream(int strm_idx)
 {
     long long now = GETusTIME(0);
@@ -628,8 +740,8 @@ static void pcm_handle_get(int strm_idx, double time)
     case SNDBUF_STATE_PLAYING:
 	if (pcm.stream[strm_idx].flags & PCM_FLAG_RAW)
 	    handle_raw_adj(strm_idx, fillup, stop_time);
-	if (rng_count(&pcm.stream[strm_idx].buffer) <
-	    pcm.stream[strm_idx].channels * 2 && fillup == 0) {
+	if (strm_count(&pcm.stream[strm_idx]) < guard_frames + 1 &&
+		fillup == 0) {
 	    pcm_printf("PCM: ERROR: buffer on stream %i exhausted (%s)\n",
 		      strm_idx, pcm.stream[strm_idx].name);
 	    /* ditch the last sample here, if it is the only remaining */
@@ -646,13 +758,13 @@ static void pcm_handle_get(int strm_idx, double time)
 		fillup < WR_BUFFER_LW) {
 	    pcm_printf("PCM: buffer fillup %f is too low, %s %i %f\n",
 		    fillup, pcm.stream[strm_idx].name,
-		    rng_count(&pcm.stream[strm_idx].buffer), stop_time);
+		    strm_count(&pcm.stream[strm_idx]), stop_time);
 	}
 	break;
 
     case SNDBUF_STATE_FLUSHING:
-	if (rng_count(&pcm.stream[strm_idx].buffer) <
-		pcm.stream[strm_idx].channels * 2 && fillup == 0) {
+	if (strm_count(&pcm.stream[strm_idx]) < guard_frames + 1 &&
+		fillup == 0) {
 	    pcm_reset_stream(strm_idx);
 	    pcm_printf("PCM: stream %s stopped\n", pcm.stream[strm_idx].name);
 	} else if (fillup == 0 && !pcm.stream[strm_idx].stretch) {
@@ -820,8 +932,7 @@ void pcm_write_interleaved(sndbuf_t ptr[][SNDBUF_CHANS], int frames,
 	int rate, int format, int nchans, int strm_idx)
 {
     int i, j;
-    struct sample samp;
-    double frame_per;
+    double frame_per, tstamp;
     struct stream *strm;
 
     strm = &pcm.stream[strm_idx];
@@ -829,37 +940,34 @@ void pcm_write_interleaved(sndbuf_t ptr[][SNDBUF_CHANS], int frames,
     if (strm->flags & PCM_FLAG_RAW)
 	rate /= strm->raw_speed_adj;
 
-    samp.format = format;
-    samp.tstamp = 0;
     frame_per = pcm_frame_period_us(rate);
     pthread_mutex_lock(&pcm.strm_mtx);
     for (i = 0; i < frames; i++) {
-	int l;
-	struct sample s2;
+	long long f;
 retry:
-	samp.tstamp = pcm_calc_tstamp(strm_idx);
-	l = peek_last_sample(strm_idx, &s2);
-	assert(!(l && samp.tstamp < s2.tstamp));
-	for (j = 0; j < strm->channels; j++) {
-	    int ch = j % nchans;
-	    memcpy(samp.data, &ptr[i][ch], pcm_format_size(format));
-	    l = rng_put(&strm->buffer, &samp);
-	    if (!l) {
-		if (!(strm->flags & PCM_FLAG_RAW)) {
-		    error("Sound buffer %i overflowed (%s)\n", strm_idx,
-			    strm->name);
-		    pcm_reset_stream(strm_idx);
-		    goto retry;
-		} else {
-		    pcm_printf("Sound buffer %i overflowed (%s)\n", strm_idx,
-			    strm->name);
-		    strm->adj_time_delay = 0;
-		    goto cont;
-		}
+	tstamp = pcm_calc_tstamp(strm_idx);
+	assert(!(strm_count(strm) && tstamp < blk_ts(strm_blk(strm,
+		strm->blk_num - 1), strm->tail - 1)));
+	if (!strm_put_frame(strm, tstamp, frame_per)) {
+	    if (!(strm->flags & PCM_FLAG_RAW)) {
+		error("Sound buffer %i overflowed (%s)\n", strm_idx,
+			strm->name);
+		pcm_reset_stream(strm_idx);
+		goto retry;
+	    } else {
+		pcm_printf("Sound buffer %i overflowed (%s)\n", strm_idx,
+			strm->name);
+		strm->adj_time_delay = 0;
+		goto cont;
 	    }
 	}
-	pcm_handle_write(strm_idx, samp.tstamp);
-	strm->stop_time = samp.tstamp + frame_per;
+	f = FRAME_IDX(strm->tail);
+	for (j = 0; j < strm->channels; j++)
+	    strm->data[j][f] = sample_to_S16(&ptr[i][j % nchans], format);
+	strm->tail++;
+	pcm_handle_write(strm_idx, tstamp);
+	/* the next frame continues the block if it gets this timestamp */
+	strm->stop_time = strm_next_ts(strm);
     }
 
 cont:
@@ -875,145 +983,295 @@ cont:
 
 static void pcm_remove_samples(double time)
 {
-    #define GUARD_SAMPS 1
     int i;
-    struct sample s;
     for (i = 0; i < pcm.num_streams; i++) {
-	if (pcm.stream[i].state == SNDBUF_STATE_INACTIVE)
+	struct stream *s = &pcm.stream[i];
+	if (s->state == SNDBUF_STATE_INACTIVE)
 	    continue;
-	while (rng_count(&pcm.stream[i].buffer) >= pcm.stream[i].channels *
-		(GUARD_SAMPS + 1)) {
-	    /* we leave GUARD_SAMPS samples below the timestamp untouched */
-	    rng_peek(&pcm.stream[i].buffer, pcm.stream[i].channels *
-		    GUARD_SAMPS, &s);
-	    if (s.tstamp > time)
-		break;
-	    pcm.stream[i].buf_cnt += pcm.stream[i].channels;
-	    rng_remove(&pcm.stream[i].buffer, pcm.stream[i].channels, NULL);
+	/* we leave guard_frames frames below the timestamp untouched */
+	while (strm_count(s) >= guard_frames + 1 &&
+		strm_ts(s, s->head + guard_frames) <= time)
+	    strm_drop_frames(s, 1);
+    }
+}
+
+/*
+ * Get the filter for resampling with out_rate / in_rate = ratio.
+ * When downsampling, the cutoff goes down with the output rate.
+ * The cutoff is rounded to one of MAX_RS_FILTERS steps, and the filter
+ * of a step is built once, when it is first used, and then kept, so a
+ * table is never rebuilt on the audio path.
+ */
+static const struct rs_filter *rs_get_filter(double ratio)
+{
+    int idx = ratio < 1 ? lround(-log(ratio) / log(RS_FC_STEP)) : 0;
+    double fc;
+    struct rs_filter *f;
+    int i, k;
+
+    if (idx >= MAX_RS_FILTERS)
+	idx = MAX_RS_FILTERS - 1;
+    f = rs_filters[idx];
+    if (f)
+	return f;
+    f = malloc(sizeof(*f));
+    if (!f)
+	return NULL;
+    rs_filters[idx] = f;
+    fc = 0.5 * RS_ROLLOFF * pow(RS_FC_STEP, -idx);
+    pcm_printf("PCM: resampling filter for fc=%f\n", fc);
+    f->fc = fc;
+    for (i = 0; i <= RS_PHASES; i++) {
+	double sum = 0, c[RS_TAPS];
+	for (k = 0; k < RS_TAPS; k++) {
+	    /* distance of tap k from the output point, in input frames */
+	    double d = k - (RS_TAPS / 2 - 1) - (double)i / RS_PHASES;
+	    double x = M_PI * d / (RS_TAPS / 2);
+	    double w = fabs(d) >= RS_TAPS / 2 ? 0 :
+		    0.42 + 0.5 * cos(x) + 0.08 * cos(2 * x);	/* Blackman */
+	    double sinc = d == 0 ? 1 : sin(2 * M_PI * fc * d) / (2 * M_PI * fc * d);
+	    c[k] = sinc * w;
+	    sum += c[k];
 	}
+	/* unity gain at DC */
+	for (k = 0; k < RS_TAPS; k++)
+	    f->coef[i][k] = c[k] / sum;
+    }
+    return f;
+}
+
+/* RS_TAPS frames of one channel from frame first on, as floats */
+static void rs_load(const struct stream *s, const sndbuf_t *d,
+	long long first, float *x)
+{
+    int k;
+#ifdef __SSE2__
+    if (first >= s->head && first + RS_TAPS <= s->tail &&
+	    FRAME_IDX(first) + RS_TAPS <= SND_BUFFER_FRAMES) {
+	const sndbuf_t *src = d + FRAME_IDX(first);
+	for (k = 0; k < RS_TAPS; k += 8) {
+	    __m128i v = _mm_loadu_si128((const __m128i *)(src + k));
+	    _mm_storeu_ps(x + k, _mm_cvtepi32_ps(
+		    _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)));
+	    _mm_storeu_ps(x + k + 4, _mm_cvtepi32_ps(
+		    _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)));
+	}
+	return;
+    }
+#endif
+    /* frames that are not (or no longer) there are silence */
+    for (k = 0; k < RS_TAPS; k++) {
+	long long f = first + k;
+	x[k] = f >= s->head && f < s->tail ? d[FRAME_IDX(f)] : 0;
     }
 }
 
-static sndbuf_t pcm_interpolate(struct sample s1, struct sample s2,
-		double time)
+static float rs_dot(const float *c, const float *x)
 {
-    sndbuf_t v1 = sample_to_S16(s1.data, s1.format);
-    sndbuf_t v2 = sample_to_S16(s2.data, s2.format);
-    if (s2.tstamp <= s1.tstamp)
-	return v1;
-    /* simple linear interpolation for now */
-    return (v1 + (time - s1.tstamp) * (v2 - v1) / (s2.tstamp - s1.tstamp));
+    int k = 0;
+    float sum = 0;
+#ifdef __SSE2__
+    __m128 acc = _mm_setzero_ps();
+    float a[4];
+    for (; k + 4 <= RS_TAPS; k += 4)
+	acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(c + k),
+		_mm_loadu_ps(x + k)));
+    _mm_storeu_ps(a, acc);
+    sum = (a[0] + a[1]) + (a[2] + a[3]);
+#endif
+    for (; k < RS_TAPS; k++)
+	sum += c[k] * x[k];
+    return sum;
 }
 
-static void pcm_get_samples(double time,
-		sndbuf_t samp[MAX_STREAMS][SNDBUF_CHANS], int *idxs,
-		int out_channels, int id)
+/* coefficients for the fractional position frac, between two phases */
+static void rs_coef(const struct rs_filter *f, float frac, float *c)
 {
-    int i, j;
-    int started;
-    int have_prev;
-    struct sample s[SNDBUF_CHANS], prev_s[SNDBUF_CHANS];
+    float ph = frac * RS_PHASES;
+    int i = ph, k;
+    float t;
 
-    for (i = 0; i < pcm.num_streams; i++) {
-	for (j = 0; j < SNDBUF_CHANS; j++)
-	    samp[i][j] = 0;
-	if (pcm.stream[i].state == SNDBUF_STATE_INACTIVE ||
-		!pcm.is_connected(id, pcm.stream[i].vol_arg))
-	    continue;
+    if (i >= RS_PHASES)
+	i = RS_PHASES - 1;
+    t = ph - i;
+    for (k = 0; k < RS_TAPS; k++)
+	c[k] = f->coef[i][k] + t * (f->coef[i + 1][k] - f->coef[i][k]);
+}
 
-	have_prev = 0;
-	started = 0;
-	if (idxs[i] >= pcm.stream[i].channels) {
-	    idxs[i] -= pcm.stream[i].channels;
-	    have_prev = 1;
+/*
+ * Resample nframes of stream s starting at time into out[][].
+ * *pos is the first frame past the last output time; it is advanced.
+ */
+static void pcm_get_stream(struct stream *s, double time, double period,
+		int nframes, int out_channels, float out[][MIX_CHUNK],
+		long long *pos, int resample)
+{
+    long long p = *pos, end = 0;
+    struct frame_blk *b = NULL;
+    const struct rs_filter *filt = NULL;
+    int i, j, n = 0;
+
+    if (p < s->tail) {
+	n = strm_find_blk(s, p);
+	b = strm_blk(s, n);
+	end = strm_blk_end(s, n);
+	if (resample == RESAMPLE_SINC)
+	    filt = rs_get_filter(b->period / period);
+    }
+    for (i = 0; i < nframes; i++, time += period) {
+	double ts1, ts2;
+	float frac;
+	long long f1, f2;
+
+	while (p < s->tail) {
+	    if (p >= end) {
+		b = strm_blk(s, ++n);
+		end = strm_blk_end(s, n);
+		if (resample == RESAMPLE_SINC)
+		    filt = rs_get_filter(b->period / period);
+	    }
+	    if (blk_ts(b, p) > time)
+		break;
+	    p++;
 	}
-	while (rng_count(&pcm.stream[i].buffer) - idxs[i] >=
-	       pcm.stream[i].channels) {
-	    for (j = 0; j < pcm.stream[i].channels; j++)
-		rng_peek(&pcm.stream[i].buffer, idxs[i] + j, &s[j]);
-	    if (out_channels == 2 && pcm.stream[i].channels == 1)
-		s[1] = s[0];
-	    if (s[0].tstamp > time) {
-		if (!started) {
-		    /* assert on idxs in sync with time */
-		    assert(!have_prev);
-		    break;
+	if (p == s->head || p == s->tail) {
+	    for (j = 0; j < out_channels; j++)
+		out[j][i] = 0;
+	    continue;
+	}
+	ts2 = blk_ts(b, p);
+	ts1 = p - 1 >= b->start ? blk_ts(b, p - 1) : strm_ts(s, p - 1);
+	frac = ts2 > ts1 ? (time - ts1) / (ts2 - ts1) : 0;
+	if (filt) {
+	    float c[RS_TAPS], x[RS_TAPS];
+	    rs_coef(filt, frac, c);
+	    for (j = 0; j < out_channels; j++) {
+		if (j && j >= s->channels) {
+		    out[j][i] = out[0][i];
+		    continue;
 		}
-		for (j = 0; j < out_channels; j++)
-		    samp[i][j] = pcm_interpolate(prev_s[j], s[j], time);
-		break;
+		rs_load(s, s->data[j], p - RS_TAPS / 2, x);
+		out[j][i] = rs_dot(c, x);
 	    }
-	    memcpy(prev_s, s, sizeof(struct sample) * out_channels);
-	    idxs[i] += pcm.stream[i].channels;
-	    started = 1;
+	    continue;
+	}
+	f1 = FRAME_IDX(p - 1);
+	f2 = FRAME_IDX(p);
+	for (j = 0; j < out_channels; j++) {
+	    /* mono streams go to both channels */
+	    sndbuf_t *d = s->data[j < s->channels ? j : 0];
+	    out[j][i] = d[f1] + frac * (d[f2] - d[f1]);
 	}
     }
+    *pos = p;
 }
 
-static void pcm_mix_samples(sndbuf_t in[][SNDBUF_CHANS],
-	sndbuf_t out[SNDBUF_CHANS], int channels, int format,
-	double volume[][SNDBUF_CHANS][SNDBUF_CHANS])
+/* dst[] += src[] * vol */
+static void mix_add(float *dst, const float *src, float vol, int n)
 {
+    int i = 0;
+#ifdef __SSE2__
+    __m128 v = _mm_set1_ps(vol);
+    for (; i + 4 <= n; i += 4)
+	_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i),
+		_mm_mul_ps(_mm_loadu_ps(src + i), v)));
+#endif
+    for (; i < n; i++)
+	dst[i] += src[i] * vol;
+}
+
+/* clip the mixed channels to S16 and store them interleaved */
+static void mix_out(float mix[][MIX_CHUNK], sndbuf_t out[][SNDBUF_CHANS],
+	int n, int channels, int format)
+{
+    int i = 0, j;
+#ifdef __SSE2__
+    if (format == PCM_FORMAT_S16_LE && channels == 2) {
+	for (; i + 8 <= n; i += 8) {
+	    __m128i l = _mm_packs_epi32(
+		    _mm_cvtps_epi32(_mm_loadu_ps(mix[0] + i)),
+		    _mm_cvtps_epi32(_mm_loadu_ps(mix[0] + i + 4)));
+	    __m128i r = _mm_packs_epi32(
+		    _mm_cvtps_epi32(_mm_loadu_ps(mix[1] + i)),
+		    _mm_cvtps_epi32(_mm_loadu_ps(mix[1] + i + 4)));
+	    _mm_storeu_si128((__m128i *)out[i], _mm_unpacklo_epi16(l, r));
+	    _mm_storeu_si128((__m128i *)out[i + 4], _mm_unpackhi_epi16(l, r));
+	}
+    }
+#endif
+    for (; i < n; i++) {
+	for (j = 0; j < channels; j++) {
+	    float v = mix[j][i];
+	    if (v > SHRT_MAX)
+		v = SHRT_MAX;
+	    if (v < SHRT_MIN)
+		v = SHRT_MIN;
+	    S16_to_sample(lrintf(v), &out[i][j], format);
+	}
+    }
+}
+
+static void pcm_mix_samples(double time, double period, int nframes,
+	long long pos[MAX_STREAMS], sndbuf_t out[][SNDBUF_CHANS],
+	int channels, int format, int id, int resample,
+	float volume[][SNDBUF_CHANS][SNDBUF_CHANS])
+{
+    float in[SNDBUF_CHANS][MIX_CHUNK];
+    float mix[SNDBUF_CHANS][MIX_CHUNK];
     int i, j, k;
-    int value[SNDBUF_CHANS] = { 0 };
 
-    for (j = 0; j < SNDBUF_CHANS; j++) {
-	for (i = 0; i < pcm.num_streams; i++) {
-	    if (pcm.stream[i].state == SNDBUF_STATE_INACTIVE)
-		continue;
-	    for (k = 0; k < SNDBUF_CHANS; k++) {
+    memset(mix, 0, sizeof(mix));
+    for (i = 0; i < pcm.num_streams; i++) {
+	if (pcm.stream[i].state == SNDBUF_STATE_INACTIVE ||
+		!pcm.is_connected(id, pcm.stream[i].vol_arg))
+	    continue;
+	pcm_get_stream(&pcm.stream[i], time, period, nframes, channels,
+		in, &pos[i], resample);
+	for (j = 0; j < SNDBUF_CHANS; j++) {
+	    for (k = 0; k < channels; k++) {
 		if (volume[i][j][k] == 0)
 		    continue;
-		value[j] += in[i][k] * volume[i][j][k];
+		/* surplus channels are folded into the first one */
+		mix_add(mix[j < channels ? j : 0], in[k], volume[i][j][k],
+			nframes);
 	    }
 	}
     }
-    for (i = channels; i < SNDBUF_CHANS; i++)
-	value[0] += value[i];
-    for (i = 0; i < channels; i++) {
-	S16_to_sample(pcm_samp_cutoff(value[i], PCM_FORMAT_S16_LE),
-		&out[i], format);
-    }
+    mix_out(mix, out, nframes, channels, format);
 }
 
-static void calc_idxs(struct pcm_player_wr *pl, int idxs[MAX_STREAMS])
+static void calc_pos(struct pcm_player_wr *pl, long long pos[MAX_STREAMS])
 {
     int i;
     for (i = 0; i < pcm.num_streams; i++) {
-	if (pcm.stream[i].state == SNDBUF_STATE_INACTIVE)
+	struct stream *s = &pcm.stream[i];
+	if (s->state == SNDBUF_STATE_INACTIVE)
 	    continue;
-	assert(pcm.stream[i].buf_cnt >= pl->last_cnt[i]);
-	if (pl->last_idx[i] > pcm.stream[i].buf_cnt - pl->last_cnt[i]) {
-	    struct sample s;
-	    idxs[i] = pl->last_idx[i] - (pcm.stream[i].buf_cnt -
-		    pl->last_cnt[i]);
-	    assert(idxs[i] <= rng_count(&pcm.stream[i].buffer));
-	    rng_peek(&pcm.stream[i].buffer, idxs[i] - 1, &s);
-	    assert(pl->last_tstamp[i] == s.tstamp);
+	if (pl->last_pos[i] > s->head) {
+	    pos[i] = pl->last_pos[i];
+	    assert(pos[i] <= s->tail);
+	    assert(pl->last_tstamp[i] == strm_ts(s, pos[i] - 1));
 	} else {
-	    idxs[i] = 0;
+	    pos[i] = s->head;
 	}
     }
 }
 
-static void save_idxs(struct pcm_player_wr *pl, int idxs[MAX_STREAMS])
+static void save_pos(struct pcm_player_wr *pl, long long pos[MAX_STREAMS])
 {
     int i;
     for (i = 0; i < pcm.num_streams; i++) {
-	if (pcm.stream[i].state == SNDBUF_STATE_INACTIVE)
+	struct stream *s = &pcm.stream[i];
+	if (s->state == SNDBUF_STATE_INACTIVE)
 	    continue;
-	assert(idxs[i] <= rng_count(&pcm.stream[i].buffer));
-	if (idxs[i] > 0) {
-	    struct sample s;
-	    rng_peek(&pcm.stream[i].buffer, idxs[i] - 1, &s);
-	    pl->last_tstamp[i] = s.tstamp;
-	}
-	pl->last_cnt[i] = pcm.stream[i].buf_cnt;
-	pl->last_idx[i] = idxs[i];
+	assert(pos[i] <= s->tail);
+	if (pos[i] > s->head)
+	    pl->last_tstamp[i] = strm_ts(s, pos[i] - 1);
+	pl->last_pos[i] = pos[i];
     }
 }
 
-static void get_volumes(int id, double volume[][SNDBUF_CHANS][SNDBUF_CHANS])
+static void get_volumes(int id, float volume[][SNDBUF_CHANS][SNDBUF_CHANS])
 {
     int i, j, k;
     for (i = 0; i < pcm.num_streams; i++) {
@@ -1029,11 +1287,10 @@ static void get_volumes(int id, double volume[][SNDBUF_CHANS][SNDBUF_CHANS])
 int pcm_data_get_interleaved(sndbuf_t buf[][SNDBUF_CHANS], int nframes,
 			   struct player_params *params)
 {
-    int idxs[MAX_STREAMS], out_idx, handle, i;
-    long long now;
+    int out_idx, handle, i;
+    long long now, pos[MAX_STREAMS];
     double start_time, stop_time, frame_period, frag_period, time;
-    sndbuf_t samp[MAX_STREAMS][SNDBUF_CHANS];
-    double volume[MAX_STREAMS][SNDBUF_CHANS][SNDBUF_CHANS];
+    float volume[MAX_STREAMS][SNDBUF_CHANS][SNDBUF_CHANS];
     struct pcm_holder *p;
 
     now = GETusTIME(0);
@@ -1081,19 +1338,21 @@ int pcm_data_get_interleaved(sndbuf_t buf[][SNDBUF_CHANS], int nframes,
     }
     frame_period = pcm_frame_period_us(params->rate);
     time = start_time;
-    calc_idxs(PL_PRIV(p), idxs);
+    calc_pos(PL_PRIV(p), pos);
     get_volumes(PLAYER(p)->id, volume);
-    for (out_idx = 0; out_idx < nframes; out_idx++) {
-	pcm_get_samples(time, samp, idxs, params->channels, PLAYER(p)->id);
-	pcm_mix_samples(samp, buf[out_idx], params->channels, params->format,
-		volume);
-	time += frame_period;
+    for (out_idx = 0; out_idx < nframes; ) {
+	int n = _min(nframes - out_idx, MIX_CHUNK);
+	pcm_mix_samples(time, frame_period, n, pos, buf + out_idx,
+		params->channels, params->format, PLAYER(p)->id,
+		PL_PRIV(p)->resample, volume);
+	out_idx += n;
+	time += n * frame_period;
     }
     if (fabs(time - stop_time) > frame_period)
 	error("PCM: time=%f stop_time=%f p=%f\n",
 		    time, stop_time, frame_period);
     PL_PRIV(p)->time = stop_time;
-    save_idxs(PL_PRIV(p), idxs);
+    save_pos(PL_PRIV(p), pos);
     pthread_mutex_unlock(&pcm.strm_mtx);
 
     for (i = 0; i < PL_PRIV(p)->num_efp_links; i++) {
@@ -1138,7 +1397,7 @@ static void pcm_advance_time(double time)
 	    continue;
 	if (debug_level('S') >= 9)
 	    pcm_printf("PCM: stream %i fillup2: %i\n", i,
-		 rng_count(&pcm.stream[i].buffer));
+		 strm_count(&pcm.stream[i]));
 	pcm_handle_get(i, time);
     }
 
@@ -1202,8 +1461,7 @@ void pcm_reset_player(int handle)
     struct pcm_holder *p = &pcm.players[handle];
     struct pcm_player_wr *pl = PL_PRIV(p);
     pl->time = now - INIT_BUFFER_DELAY;
-    memset(pl->last_idx, 0, sizeof(pl->last_idx));
-    memset(pl->last_cnt, 0, sizeof(pl->last_cnt));
+    memset(pl->last_pos, 0, sizeof(pl->last_pos));
 }
 
 void pcm_timer(void)
@@ -1240,8 +1498,11 @@ void pcm_done(void)
     pcm_deinit_plugins(pcm.players, pcm.num_players);
     pcm_deinit_plugins(pcm.efps, pcm.num_efps);
 
-    for (i = 0; i < pcm.num_streams; i++)
-	rng_destroy(&pcm.stream[i].buffer);
+    for (i = 0; i < pcm.num_streams; i++) {
+	int j;
+	for (j = 0; j < pcm.stream[i].channels; j++)
+	    free(pcm.stream[i].data[j]);
+    }
     pthread_mutex_destroy(&pcm.strm_mtx);
     pthread_mutex_destroy(&pcm.time_mtx);
 
@@ -1257,6 +1518,8 @@ void pcm_done(void)
 	free(pcm.recorders[i].priv);
     for (i = 0; i < pcm.num_efps; i++)
 	free(pcm.efps[i].priv);
+    for (i = 0; i < MAX_RS_FILTERS; i++)
+	free(rs_filters[i]);
 }
 
 int pcm_init_plugins(struct pcm_holder *plu, int num)
@@ -100,6 +100,9 @@ void gamma_correct(RemapObject *, RGBColor *, unsigned *);
 /* remap_pent.c */
 RemapFuncDesc *remap_opt(void);
 
+/* remap_simd.c */
+RemapFuncDesc *remap_simd(void);
+
 #else /* __ASSEMBLER__ */
 /* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
 		.macro RO_Struct _str_
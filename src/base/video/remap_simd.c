@@ -0,0 +1,570 @@
+/*
+ * SSE2/AVX2 versions of the hot gen_* remap functions.
+ *
+ * The descriptors are flagged RFF_OPT_PENTIUM so find_best_remap_func()
+ * prefers them over the generic ones in remap.c. The instruction set is
+ * chosen once at startup; remap_simd() returns NULL if the CPU has
+ * neither SSE2 nor AVX2, leaving only the generic list.
+ *
+ * Covered:
+ *   8 -> 32 bit:  palette lookup (AVX2 gather, unrolled SSE2 otherwise),
+ *                 with dedicated 1x, 2x and 3x horizontal scaling loops
+ *   15/16/32 -> 32 bit: channel conversion for true color displays
+ *                 (i.e. color spaces described by r/g/b masks)
+ *
+ * All scaling functions copy a destination line instead of converting it
+ * again when it comes from the same source line as the previous one.
+ */
+
+#include "emu.h"
+#include <string.h>
+
+#include "vgaemu.h"
+#include "render.h"
+#include "remap_priv.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define SSE2	__attribute__((target("sse2")))
+#define AVX2	__attribute__((target("avx2")))
+
+void gen_8to32_all(RemapObject *);
+void gen_8to32_1(RemapObject *);
+void gen_15to32_all(RemapObject *);
+void gen_15to32_1(RemapObject *);
+void gen_16to32_all(RemapObject *);
+void gen_16to32_1(RemapObject *);
+void gen_32to32_all(RemapObject *);
+
+/*
+ * one color channel: extract from the source pixel, then
+ * scale to the destination width and move it into place
+ * (same arithmetic as rgb_color_reduce() + rgb_color_reduced_2int())
+ */
+struct chan_cvt {
+  unsigned src_shift, src_mask;
+  unsigned rsh, lsh;
+};
+
+struct pix_cvt {
+  struct chan_cvt c[3];
+};
+
+static void (*lut_row)(unsigned *, const unsigned char *, int, const unsigned *);
+static void (*lut_row2)(unsigned *, const unsigned char *, int, const unsigned *);
+static void (*lut_row3)(unsigned *, const unsigned char *, int, const unsigned *);
+static void (*cvt_row16)(unsigned *, const unsigned short *, int, const struct pix_cvt *);
+static void (*cvt_row32)(unsigned *, const unsigned *, int, const struct pix_cvt *);
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
+
+static int chan_setup(struct chan_cvt *cc, unsigned src_shift, unsigned sbits,
+    unsigned dbits, unsigned dshift)
+{
+  if(dbits == 0 || dbits > 16) return 0;
+  cc->src_shift = src_shift;
+  cc->src_mask = (1 << sbits) - 1;
+  if(dbits >= sbits) {
+    cc->rsh = 0;
+    cc->lsh = dbits - sbits + dshift;
+  }
+  else {
+    cc->rsh = sbits - dbits;
+    cc->lsh = dshift;
+  }
+  return 1;
+}
+
+/*
+ * Set up a pixel converter for a 5/6/8 bit per channel BGR source;
+ * returns 0 if the display has no mask based color space.
+ */
+static int pix_setup(struct pix_cvt *pc, const ColorSpaceDesc *csd,
+    unsigned rbits, unsigned gbits, unsigned bbits)
+{
+  if(!(csd->r_mask || csd->g_mask || csd->b_mask)) return 0;
+  return
+    chan_setup(&pc->c[0], gbits + bbits, rbits, csd->r_bits, csd->r_shift) &&
+    chan_setup(&pc->c[1], bbits, gbits, csd->g_bits, csd->g_shift) &&
+    chan_setup(&pc->c[2], 0, bbits, csd->b_bits, csd->b_shift);
+}
+
+static inline unsigned pix_cvt1(const struct pix_cvt *pc, unsigned p)
+{
+  unsigned u = 0;
+  int i;
+
+  for(i = 0; i < 3; i++) {
+    const struct chan_cvt *cc = &pc->c[i];
+    u |= (((p >> cc->src_shift) & cc->src_mask) >> cc->rsh) << cc->lsh;
+  }
+  return u;
+}
+
+/*
+ * Returns n if bre_x describes an exact horizontal scaling by n
+ * (n - 1 zero steps followed by a one), 0 otherwise.
+ */
+static int bre_int_scale(const int *bre_x, int len)
+{
+  int i, n;
+
+  for(n = 1; n <= len && bre_x[n - 1] == 0; n++);
+  if(n > len) return 0;
+  for(i = 0; i < len; i++) {
+    if(bre_x[i] != (i % n == n - 1)) return 0;
+  }
+  return n;
+}
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ * SSE2
+ */
+
+static SSE2 void lut_row_sse2(unsigned *dst, const unsigned char *src, int len,
+    const unsigned *lut)
+{
+  int i;
+
+  for(i = 0; i + 4 <= len; i += 4) {
+    __m128i v = _mm_set_epi32(lut[src[i + 3]], lut[src[i + 2]],
+                              lut[src[i + 1]], lut[src[i]]);
+    _mm_storeu_si128((__m128i *) (dst + i), v);
+  }
+  for(; i < len; i++) dst[i] = lut[src[i]];
+}
+
+/* len is in destination pixels */
+static SSE2 void lut_row2_sse2(unsigned *dst, const unsigned char *src, int len,
+    const unsigned *lut)
+{
+  int i, s;
+
+  for(i = s = 0; i + 8 <= len; i += 8, s += 4) {
+    __m128i v = _mm_set_epi32(lut[src[s + 3]], lut[src[s + 2]],
+                              lut[src[s + 1]], lut[src[s]]);
+    _mm_storeu_si128((__m128i *) (dst + i), _mm_unpacklo_epi32(v, v));
+    _mm_storeu_si128((__m128i *) (dst + i + 4), _mm_unpackhi_epi32(v, v));
+  }
+  for(; i < len; i++) dst[i] = lut[src[i >> 1]];
+}
+
+static SSE2 void lut_row3_sse2(unsigned *dst, const unsigned char *src, int len,
+    const unsigned *lut)
+{
+  int i, s;
+
+  for(i = s = 0; i + 12 <= len; i += 12, s += 4) {
+    __m128i v = _mm_set_epi32(lut[src[s + 3]], lut[src[s + 2]],
+                              lut[src[s + 1]], lut[src[s]]);
+    /* abcd -> aaab bbcc cddd */
+    _mm_storeu_si128((__m128i *) (dst + i), _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 0, 0)));
+    _mm_storeu_si128((__m128i *) (dst + i + 4), _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 1, 1)));
+    _mm_storeu_si128((__m128i *) (dst + i + 8), _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 2)));
+  }
+  for(; i < len; i++) dst[i] = lut[src[i / 3]];
+}
+
+static SSE2 inline __m128i cvt_sse2(__m128i p, const struct pix_cvt *pc)
+{
+  __m128i u = _mm_setzero_si128();
+  int i;
+
+  for(i = 0; i < 3; i++) {
+    const struct chan_cvt *cc = &pc->c[i];
+    __m128i t = _mm_srl_epi32(p, _mm_cvtsi32_si128(cc->src_shift));
+    t = _mm_and_si128(t, _mm_set1_epi32(cc->src_mask));
+    t = _mm_srl_epi32(t, _mm_cvtsi32_si128(cc->rsh));
+    u = _mm_or_si128(u, _mm_sll_epi32(t, _mm_cvtsi32_si128(cc->lsh)));
+  }
+  return u;
+}
+
+static SSE2 void cvt_row16_sse2(unsigned *dst, const unsigned short *src, int len,
+    const struct pix_cvt *pc)
+{
+  int i;
+
+  for(i = 0; i + 4 <= len; i += 4) {
+    __m128i p = _mm_loadl_epi64((const __m128i *) (src + i));
+    p = _mm_unpacklo_epi16(p, _mm_setzero_si128());
+    _mm_storeu_si128((__m128i *) (dst + i), cvt_sse2(p, pc));
+  }
+  for(; i < len; i++) dst[i] = pix_cvt1(pc, src[i]);
+}
+
+static SSE2 void cvt_row32_sse2(unsigned *dst, const unsigned *src, int len,
+    const struct pix_cvt *pc)
+{
+  int i;
+
+  for(i = 0; i + 4 <= len; i += 4) {
+    __m128i p = _mm_loadu_si128((const __m128i *) (src + i));
+    _mm_storeu_si128((__m128i *) (dst + i), cvt_sse2(p, pc));
+  }
+  for(; i < len; i++) dst[i] = pix_cvt1(pc, src[i]);
+}
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ * AVX2
+ */
+
+static AVX2 inline __m256i lut_gather8(const unsigned char *src, const unsigned *lut)
+{
+  __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) src));
+  return _mm256_i32gather_epi32((const int *) lut, idx, 4);
+}
+
+static AVX2 void lut_row_avx2(unsigned *dst, const unsigned char *src, int len,
+    const unsigned *lut)
+{
+  int i;
+
+  for(i = 0; i + 8 <= len; i += 8)
+    _mm256_storeu_si256((__m256i *) (dst + i), lut_gather8(src + i, lut));
+  for(; i < len; i++) dst[i] = lut[src[i]];
+}
+
+static AVX2 void lut_row2_avx2(unsigned *dst, const unsigned char *src, int len,
+    const unsigned *lut)
+{
+  int i, s;
+
+  for(i = s = 0; i + 16 <= len; i += 16, s += 8) {
+    __m256i v = lut_gather8(src + s, lut);
+    __m256i lo = _mm256_unpacklo_epi32(v, v);	/* aabb eeff */
+    __m256i hi = _mm256_unpackhi_epi32(v, v);	/* ccdd gghh */
+    _mm256_storeu_si256((__m256i *) (dst + i), _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i *) (dst + i + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+  }
+  for(; i < len; i++) dst[i] = lut[src[i >> 1]];
+}
+
+static AVX2 void lut_row3_avx2(unsigned *dst, const unsigned char *src, int len,
+    const unsigned *lut)
+{
+  const __m256i p0 = _mm256_setr_epi32(0, 0, 0, 1, 1, 1, 2, 2);
+  const __m256i p1 = _mm256_setr_epi32(2, 3, 3, 3, 4, 4, 4, 5);
+  const __m256i p2 = _mm256_setr_epi32(5, 5, 6, 6, 6, 7, 7, 7);
+  int i, s;
+
+  for(i = s = 0; i + 24 <= len; i += 24, s += 8) {
+    __m256i v = lut_gather8(src + s, lut);
+    _mm256_storeu_si256((__m256i *) (dst + i), _mm256_permutevar8x32_epi32(v, p0));
+    _mm256_storeu_si256((__m256i *) (dst + i + 8), _mm256_permutevar8x32_epi32(v, p1));
+    _mm256_storeu_si256((__m256i *) (dst + i + 16), _mm256_permutevar8x32_epi32(v, p2));
+  }
+  for(; i < len; i++) dst[i] = lut[src[i / 3]];
+}
+
+static AVX2 inline __m256i cvt_avx2(__m256i p, const struct pix_cvt *pc)
+{
+  __m256i u = _mm256_setzero_si256();
+  int i;
+
+  for(i = 0; i < 3; i++) {
+    const struct chan_cvt *cc = &pc->c[i];
+    __m256i t = _mm256_srl_epi32(p, _mm_cvtsi32_si128(cc->src_shift));
+    t = _mm256_and_si256(t, _mm256_set1_epi32(cc->src_mask));
+    t = _mm256_srl_epi32(t, _mm_cvtsi32_si128(cc->rsh));
+    u = _mm256_or_si256(u, _mm256_sll_epi32(t, _mm_cvtsi32_si128(cc->lsh)));
+  }
+  return u;
+}
+
+static AVX2 void cvt_row16_avx2(unsigned *dst, const unsigned short *src, int len,
+    const struct pix_cvt *pc)
+{
+  int i;
+
+  for(i = 0; i + 8 <= len; i += 8) {
+    __m256i p = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (src + i)));
+    _mm256_storeu_si256((__m256i *) (dst + i), cvt_avx2(p, pc));
+  }
+  for(; i < len; i++) dst[i] = pix_cvt1(pc, src[i]);
+}
+
+static AVX2 void cvt_row32_avx2(unsigned *dst, const unsigned *src, int len,
+    const struct pix_cvt *pc)
+{
+  int i;
+
+  for(i = 0; i + 8 <= len; i += 8) {
+    __m256i p = _mm256_loadu_si256((const __m256i *) (src + i));
+    _mm256_storeu_si256((__m256i *) (dst + i), cvt_avx2(p, pc));
+  }
+  for(; i < len; i++) dst[i] = pix_cvt1(pc, src[i]);
+}
+
+/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+ * the remap functions
+ */
+
+/*
+ * 8 bit pseudo color --> 32 bit true color
+ */
+static void simd_8to32_1(RemapObject *ro)
+{
+  int j, l;
+  const unsigned char *src;
+  unsigned char *dst;
+
+  src = ro->src_image + ro->src_start + ro->src_offset;
+  dst = ro->dst_image + ro->dst_start + ro->dst_offset;
+  l = ro->src_x1 - ro->src_x0;
+
+  for(j = ro->src_y0; j < ro->src_y1; j++) {
+    lut_row((unsigned *) dst, src, l, ro->true_color_lut);
+    dst += ro->dst_scan_len;
+    src += ro->src_scan_len;
+  }
+}
+
+/*
+ * 8 bit pseudo color --> 32 bit true color
+ * supports arbitrary scaling; 1x, 2x and 3x horizontally are vectorized
+ */
+static void simd_8to32_all(RemapObject *ro)
+{
+  void (*row)(unsigned *, const unsigned char *, int, const unsigned *);
+  int d_x_len = ro->dst_width;
+  int d_y, s_y, last_s_y = -1;
+  const unsigned char *src0;
+  unsigned char *dst, *last_dst = NULL;
+
+  switch(bre_int_scale(ro->bre_x, d_x_len)) {
+    case 1: row = lut_row; break;
+    case 2: row = lut_row2; break;
+    case 3: row = lut_row3; break;
+    default: gen_8to32_all(ro); return;
+  }
+
+  src0 = ro->src_image + ro->src_start;
+  dst = ro->dst_image + ro->dst_start + ro->dst_offset;
+
+  for(d_y = ro->dst_y0; d_y < ro->dst_y1; d_y++, dst += ro->dst_scan_len) {
+    s_y = ro->bre_y[d_y];
+    if(s_y == last_s_y)
+      memcpy(dst, last_dst, d_x_len << 2);
+    else
+      row((unsigned *) dst, src0 + s_y, d_x_len, ro->true_color_lut);
+    last_s_y = s_y;
+    last_dst = dst;
+  }
+}
+
+/*
+ * 15/16/32 bit true color --> 32 bit true color, unscaled
+ */
+static void true_to32_1(RemapObject *ro, const struct pix_cvt *pc, int bpp)
+{
+  int i;
+  const unsigned char *src;
+  unsigned char *dst;
+
+  src = ro->src_image + ro->src_start + ro->src_offset;
+  dst = ro->dst_image + ro->dst_start + ro->dst_offset;
+
+  for(i = ro->src_y0; i < ro->src_y1; i++) {
+    if(bpp == 2)
+      cvt_row16((unsigned *) dst, (const unsigned short *) src, ro->dst_width, pc);
+    else
+      cvt_row32((unsigned *) dst, (const unsigned *) src, ro->dst_width, pc);
+    src += ro->src_scan_len;
+    dst += ro->dst_scan_len;
+  }
+}
+
+/*
+ * 15/16/32 bit true color --> 32 bit true color
+ * supports arbitrary scaling; only 1x horizontally is vectorized
+ */
+static void true_to32_all(RemapObject *ro, const struct pix_cvt *pc, int bpp)
+{
+  int d_x_len = ro->dst_width;
+  int unscaled = bre_int_scale(ro->bre_x, d_x_len) == 1;
+  int d_x, s_x, d_y, s_y, last_s_y = -1;
+  const unsigned char *src, *src0;
+  unsigned char *dst, *last_dst = NULL;
+  const int *bre_x;
+  unsigned *dst_4;
+
+  src0 = ro->src_image + ro->src_start;
+  dst = ro->dst_image + ro->dst_start + ro->dst_offset;
+
+  for(d_y = ro->dst_y0; d_y < ro->dst_y1; d_y++, dst += ro->dst_scan_len) {
+    s_y = ro->bre_y[d_y];
+    src = src0 + s_y;
+    dst_4 = (unsigned *) dst;
+    if(s_y == last_s_y) {
+      memcpy(dst, last_dst, d_x_len << 2);
+    }
+    else if(unscaled) {
+      if(bpp == 2)
+        cvt_row16(dst_4, (const unsigned short *) src, d_x_len, pc);
+      else
+        cvt_row32(dst_4, (const unsigned *) src, d_x_len, pc);
+    }
+    else if(bpp == 2) {
+      const unsigned short *src_2 = (const unsigned short *) src;
+      for(s_x = d_x = 0, bre_x = ro->bre_x; d_x < d_x_len; ) {
+        dst_4[d_x++] = pix_cvt1(pc, src_2[s_x]);
+        s_x += *(bre_x++);
+      }
+    }
+    else {
+      const unsigned *src_4 = (const unsigned *) src;
+      for(s_x = d_x = 0, bre_x = ro->bre_x; d_x < d_x_len; ) {
+        dst_4[d_x++] = pix_cvt1(pc, src_4[s_x]);
+        s_x += *(bre_x++);
+      }
+    }
+    last_s_y = s_y;
+    last_dst = dst;
+  }
+}
+
+static void simd_15to32_1(RemapObject *ro)
+{
+  struct pix_cvt pc;
+
+  if(pix_setup(&pc, ro->dst_color_space, 5, 5, 5))
+    true_to32_1(ro, &pc, 2);
+  else
+    gen_15to32_1(ro);
+}
+
+static void simd_15to32_all(RemapObject *ro)
+{
+  struct pix_cvt pc;
+
+  if(pix_setup(&pc, ro->dst_color_space, 5, 5, 5))
+    true_to32_all(ro, &pc, 2);
+  else
+    gen_15to32_all(ro);
+}
+
+static void simd_16to32_1(RemapObject *ro)
+{
+  struct pix_cvt pc;
+
+  if(pix_setup(&pc, ro->dst_color_space, 5, 6, 5))
+    true_to32_1(ro, &pc, 2);
+  else
+    gen_16to32_1(ro);
+}
+
+static void simd_16to32_all(RemapObject *ro)
+{
+  struct pix_cvt pc;
+
+  if(pix_setup(&pc, ro->dst_color_space, 5, 6, 5))
+    true_to32_all(ro, &pc, 2);
+  else
+    gen_16to32_all(ro);
+}
+
+static void simd_32to32_all(RemapObject *ro)
+{
+  struct pix_cvt pc;
+
+  if(pix_setup(&pc, ro->dst_color_space, 8, 8, 8))
+    true_to32_all(ro, &pc, 4);
+  else
+    gen_32to32_all(ro);
+}
+
+static RemapFuncDesc remap_simd_list[] = {
+
+  REMAP_DESC(
+    RFF_SCALE_ALL | RFF_REMAP_LINES | RFF_OPT_PENTIUM,
+    MODE_VGA_X | MODE_PSEUDO_8,
+    MODE_TRUE_32,
+    simd_8to32_all,
+    NULL
+  ),
+
+  REMAP_DESC(
+    RFF_SCALE_1 | RFF_REMAP_RECT | RFF_OPT_PENTIUM,
+    MODE_PSEUDO_8,
+    MODE_TRUE_32,
+    simd_8to32_1,
+    NULL
+  ),
+
+  REMAP_DESC(
+    RFF_SCALE_ALL | RFF_REMAP_LINES | RFF_OPT_PENTIUM,
+    MODE_TRUE_15,
+    MODE_TRUE_32,
+    simd_15to32_all,
+    NULL
+  ),
+
+  REMAP_DESC(
+    RFF_SCALE_1 | RFF_REMAP_LINES | RFF_OPT_PENTIUM,
+    MODE_TRUE_15,
+    MODE_TRUE_32,
+    simd_15to32_1,
+    NULL
+  ),
+
+  REMAP_DESC(
+    RFF_SCALE_ALL | RFF_REMAP_LINES | RFF_OPT_PENTIUM,
+    MODE_TRUE_16,
+    MODE_TRUE_32,
+    simd_16to32_all,
+    NULL
+  ),
+
+  REMAP_DESC(
+    RFF_SCALE_1 | RFF_REMAP_LINES | RFF_OPT_PENTIUM,
+    MODE_TRUE_16,
+    MODE_TRUE_32,
+    simd_16to32_1,
+    NULL
+  ),
+
+  REMAP_DESC(
+    RFF_SCALE_ALL | RFF_REMAP_LINES | RFF_OPT_PENTIUM,
+    MODE_TRUE_32,
+    MODE_TRUE_32,
+    simd_32to32_all,
+    NULL
+  ),
+
+};
+
+RemapFuncDesc *remap_simd(void)
+{
+  int i;
+
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")) {
+    lut_row = lut_row_avx2;
+    lut_row2 = lut_row2_avx2;
+    lut_row3 = lut_row3_avx2;
+    cvt_row16 = cvt_row16_avx2;
+    cvt_row32 = cvt_row32_avx2;
+    v_printf("remap: using AVX2 functions\n");
+  }
+  else if(__builtin_cpu_supports("sse2")) {
+    lut_row = lut_row_sse2;
+    lut_row2 = lut_row2_sse2;
+    lut_row3 = lut_row3_sse2;
+    cvt_row16 = cvt_row16_sse2;
+    cvt_row32 = cvt_row32_sse2;
+    v_printf("remap: using SSE2 functions\n");
+  }
+  else {
+    return NULL;
+  }
+
+  for(i = 0; i < sizeof(remap_simd_list) / sizeof(*remap_simd_list) - 1; i++) {
+    remap_simd_list[i].next = remap_simd_list + i + 1;
+  }
+
+  return remap_simd_list;
+}
+
+#endif
@@ -5,6 +5,8 @@
  */
 
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <semaphore.h>
@@ -16,6 +18,7 @@
 #include "render.h"
 #include "video.h"
 #include "render_priv.h"
+#include "timers.h"
 
 #define RENDER_THREADED 1
 #define TEXT_THREADED 1
@@ -55,11 +58,62 @@ struct render_wrp {
     struct remap_object *gfx_remap;
     struct remap_object *text_remap;
     struct bitmap_desc dst_image[MAX_RENDERS];
+    ColorSpaceDesc csd;
 };
 static struct render_wrp Render;
 static int initialized;
 static int cur_mode_class;
 
+/*
+ * Optional pool of remap workers ($_render_threads). The screen is cut
+ * into horizontal bands on source line boundaries; each worker has its
+ * own remap object and converts the dirty ranges that fall into its
+ * band. The render thread queues the ranges, runs the pool and waits
+ * for it before render_unlock().
+ */
+#define MAX_RENDER_BANDS 8
+#define MAX_BAND_JOBS 64
+struct band_job {
+  struct bitmap_desc src_img;
+  int src_start;
+  int offset;
+  int len;
+  RectArea ra[MAX_RENDERS];
+};
+struct render_band {
+  pthread_t thr;
+  struct remap_object *remap;
+  int num_jobs;
+  struct band_job job[MAX_BAND_JOBS];
+};
+static struct render_band bands[MAX_RENDER_BANDS];
+static int num_bands;
+static int band_mode;
+static unsigned band_gen;
+static int bands_busy;
+static int bands_quit;
+static pthread_mutex_t band_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t band_start_cnd = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t band_done_cnd = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Frame pacing. update_screen() runs on every timer tick, but only
+ * wakes the render thread once per frame period: that of the emulated
+ * vertical retrace, or 1/$_render_fps. Dirty pages simply accumulate
+ * in between. A frame that falls due while the render thread is still
+ * busy is dropped rather than queued.
+ */
+#define RENDER_STATS_PERIOD 10	/* seconds */
+static hitimer_t next_frame;
+static hitimer_t next_stats;
+/* frame statistics, logged with -Dv every RENDER_STATS_PERIOD */
+static struct {
+  unsigned frames;		/* frames rendered */
+  unsigned dropped;		/* frames skipped because the renderer lagged */
+  unsigned t_min, t_avg, t_max;	/* render time per frame, usecs */
+} stats;
+static hitimer_t frame_time_sum;
+
 __attribute__((warn_unused_result))
 static int render_lock(void)
 {
@@ -145,6 +199,142 @@ static void render_rect_add(int rend_idx, RectArea rect)
  * Draw a text string for bitmap fonts.
  * The attribute is the VGA color/mono text attribute.
  */
+static void band_remap(struct render_band *b)
+{
+  struct remap_object *ro = b->remap;
+  int i, j;
+
+  for (j = 0; j < b->num_jobs; j++) {
+    struct band_job *job = &b->job[j];
+    for (i = 0; i < Render.num_renders; i++) {
+      job->ra[i].width = 0;
+      if (!Render.wrp[i].locked)
+        continue;
+      job->ra[i] = ro->calls->remap_mem(ro->priv, job->src_img, band_mode,
+          job->src_start, job->offset, job->len, Render.dst_image[i]);
+    }
+  }
+}
+
+static void *band_thread(void *arg)
+{
+  struct render_band *b = arg;
+  unsigned gen = 0;
+
+  pthread_mutex_lock(&band_mtx);
+  while (1) {
+    while (band_gen == gen && !bands_quit)
+      pthread_cond_wait(&band_start_cnd, &band_mtx);
+    if (bands_quit)
+      break;
+    gen = band_gen;
+    pthread_mutex_unlock(&band_mtx);
+    band_remap(b);
+    pthread_mutex_lock(&band_mtx);
+    if (--bands_busy == 0)
+      pthread_cond_signal(&band_done_cnd);
+  }
+  pthread_mutex_unlock(&band_mtx);
+  return NULL;
+}
+
+/* run the queued jobs on all workers and wait for them */
+static void bands_run(void)
+{
+  int i, j, k;
+
+  for (k = 0; k < num_bands && !bands[k].num_jobs; k++);
+  if (k == num_bands)
+    return;
+  pthread_mutex_lock(&render_mtx);
+  check_locked();
+  pthread_mutex_lock(&band_mtx);
+  bands_busy = num_bands;
+  band_gen++;
+  pthread_cond_broadcast(&band_start_cnd);
+  while (bands_busy)
+    pthread_cond_wait(&band_done_cnd, &band_mtx);
+  pthread_mutex_unlock(&band_mtx);
+
+  for (k = 0; k < num_bands; k++) {
+    for (j = 0; j < bands[k].num_jobs; j++) {
+      for (i = 0; i < Render.num_renders; i++) {
+        RectArea r = bands[k].job[j].ra[i];
+        if (r.width)
+          render_rect_add(i, r);
+      }
+    }
+    bands[k].num_jobs = 0;
+  }
+  pthread_mutex_unlock(&render_mtx);
+}
+
+/* split a dirty range of the display at the band boundaries */
+static void bands_add(struct bitmap_desc src_img, int src_start,
+    int offset, int len)
+{
+  int k, full = 0;
+
+  for (k = 0; k < num_bands; k++) {
+    struct render_band *b = &bands[k];
+    int lo = k ? vga.height * k / num_bands * vga.scan_len : INT_MIN;
+    int hi = k < num_bands - 1 ?
+        vga.height * (k + 1) / num_bands * vga.scan_len : INT_MAX;
+    int s = _max(offset, lo);
+    int e = _min(offset + len, hi);
+    struct band_job *job;
+
+    if (s >= e)
+      continue;
+    job = &b->job[b->num_jobs++];
+    job->src_img = src_img;
+    job->src_start = src_start;
+    job->offset = s;
+    job->len = e - s;
+    if (b->num_jobs == MAX_BAND_JOBS)
+      full = 1;
+  }
+  if (full)
+    bands_run();
+}
+
+static void bands_init(int ximage_mode, int features, ColorSpaceDesc *csd)
+{
+  int i, err;
+
+  num_bands = _min(config.render_threads, MAX_RENDER_BANDS);
+  if (num_bands <= 0) {
+    num_bands = 0;
+    return;
+  }
+  for (i = 0; i < num_bands; i++) {
+    bands[i].remap = remap_init(ximage_mode, features, csd);
+    err = pthread_create(&bands[i].thr, NULL, band_thread, &bands[i]);
+    assert(!err);
+#if defined(HAVE_PTHREAD_SETNAME_NP) && defined(__GLIBC__)
+    pthread_setname_np(bands[i].thr, "dosemu: rband");
+#endif
+  }
+  v_printf("render: %i remap threads\n", num_bands);
+}
+
+static void bands_done(void)
+{
+  int i;
+
+  if (!num_bands)
+    return;
+  pthread_mutex_lock(&band_mtx);
+  bands_quit = 1;
+  pthread_cond_broadcast(&band_start_cnd);
+  pthread_mutex_unlock(&band_mtx);
+  for (i = 0; i < num_bands; i++) {
+    pthread_join(bands[i].thr, NULL);
+    remap_done(bands[i].remap);
+  }
+  num_bands = 0;
+}
+
 static void bitmap_draw_string(void *opaque, int x, int y,
     const char *text, int len, Bit8u attr)
 {
@@ -229,23 +419,76 @@ int remapper_init(int have_true_color, int have_shmap, int features,
   }
 
   remap_src_modes = find_supported_modes(ximage_mode);
+  Render.csd = *csd;
   Render.gfx_remap = remap_init(ximage_mode, features, csd);
   /* linear 1 byte per pixel */
   Render.text_remap = remap_init(ximage_mode, features, csd);
   register_text_system(&Text_bitmap);
   init_text_mapper(ximage_mode, features, csd);
+  bands_init(ximage_mode, features, csd);
 
   return vga_emu_init(remap_src_modes, csd);
 }
 
+unsigned render_frame_period(void)
+{
+  if (config.render_fps > 0)
+    return 1000000 / config.render_fps;
+  return VGA_VRETRACE_US;
+}
+
+/* returns 1 if the next frame is due; must be called with upd_mtx held */
+static int frame_due(hitimer_t now)
+{
+  unsigned period = render_frame_period();
+
+  if (now < next_frame)
+    return 0;
+  if (now - next_frame >= period) {
+    /* fell behind: skip the lost frames instead of catching up */
+    stats.dropped += (now - next_frame) / period;
+    next_frame = now + period;
+  } else {
+    next_frame += period;
+  }
+  return 1;
+}
+
+/* account one rendered frame; must be called with upd_mtx held */
+static void frame_done(hitimer_t t0, hitimer_t t1)
+{
+  unsigned ft = t1 - t0;
+
+  if (!stats.frames || ft < stats.t_min)
+    stats.t_min = ft;
+  if (ft > stats.t_max)
+    stats.t_max = ft;
+  frame_time_sum += ft;
+  stats.frames++;
+  if (t1 < next_stats)
+    return;
+  if (stats.frames)
+    stats.t_avg = frame_time_sum / stats.frames;
+  if (next_stats)
+    v_printf("render: %u frames, %u dropped in %is, "
+        "frame time min/avg/max %u/%u/%u us\n",
+        stats.frames, stats.dropped, RENDER_STATS_PERIOD,
+        stats.t_min, stats.t_avg, stats.t_max);
+  memset(&stats, 0, sizeof(stats));
+  frame_time_sum = 0;
+  next_stats = t1 + RENDER_STATS_PERIOD * 1000000LL;
+}
+
 #if RENDER_THREADED
 static void *render_thread(void *arg)
 {
   while (1) {
+    hitimer_t t0;
     sem_wait(&render_sem);
     pthread_mutex_lock(&upd_mtx);
     is_updating = 1;
     pthread_mutex_unlock(&upd_mtx);
+    t0 = GETusSYSTIME();
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
     do_rend_gfx();
 #if TEXT_THREADED
@@ -253,6 +496,7 @@ static void *render_thread(void *arg)
 #endif
     pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
     pthread_mutex_lock(&upd_mtx);
+    frame_done(t0, GETusSYSTIME());
     is_updating = 0;
     pthread_mutex_unlock(&upd_mtx);
   }
@@ -291,8 +535,21 @@ void render_done(void)
 #endif
 }
 
+/*
+ * Color space the front end gave to remapper_init(); returns 0 if
+ * there is no remapper yet.
+ */
+int remapper_get_csd(ColorSpaceDesc *csd)
+{
+  if (!Render.gfx_remap)
+    return 0;
+  *csd = Render.csd;
+  return 1;
+}
+
 void remapper_done(void)
 {
+  bands_done();
   done_text_mapper();
   if (Render.text_remap)
     remap_done(Render.text_remap);
@@ -316,11 +573,21 @@ static void refresh_truecolor(DAC_entry *col, int index, void *udata)
   remap_palette_update(ro, index, vga.dac.bits, col->r, col->g, col->b);
 }
 
+/* the band workers keep their own copies of the palette */
+static void refresh_gfx_truecolor(DAC_entry *col, int index, void *udata)
+{
+  int i;
+
+  refresh_truecolor(col, index, udata);
+  for (i = 0; i < num_bands; i++)
+    refresh_truecolor(col, index, bands[i].remap);
+}
+
 /* returns True if the screen needs to be redrawn */
 static Boolean refresh_palette(void *opaque)
 {
   struct remap_object **obj = opaque;
-  return changed_vga_colors(refresh_truecolor, *obj);
+  return changed_vga_colors(refresh_gfx_truecolor, *obj);
 }
 
 /*
@@ -448,6 +715,14 @@ static void update_graphics_loop(unsigned display_start,
 
   while ((i = vga_emu_update(veut, display_start + src_offset + update_offset,
       display_end, i)) != -1) {
+    if (num_bands) {
+      bands_add(BMP(vga.mem.base + display_start,
+                    vga.width, vga.height, vga.scan_len),
+                src_offset, update_offset +
+                veut->update_start - display_start,
+                veut->update_len);
+      continue;
+    }
     remap_remap_mem(Render.gfx_remap, BMP(vga.mem.base + display_start,
                              vga.width, vga.height, vga.scan_len),
                              remap_mode(),
@@ -463,6 +738,7 @@ static void update_graphics_screen(void)
   unsigned display_end, wrap;
 
   refresh_graphics_palette();
+  band_mode = remap_mode();
 
   display_end = vga.display_start + vga.scan_len * vga.height;
   if (vga.line_compare < vga.height) {
@@ -495,6 +771,8 @@ static void update_graphics_screen(void)
       align = vga.scan_len - rem;
     update_graphics_loop(0, display_end - wrap, -len, len + align, &veut);
   }
+  if (num_bands)
+    bands_run();
 }
 
 int render_is_updating(void)
@@ -610,7 +888,14 @@ int render_update_vidmode(void)
  */
 int update_screen(void)
 {
-  int upd = render_is_updating();
+  int upd, due;
+
+  pthread_mutex_lock(&upd_mtx);
+  upd = is_updating;
+  due = frame_due(GETusSYSTIME());
+  if (due && upd)
+    stats.dropped++;
+  pthread_mutex_unlock(&upd_mtx);
 
   /* update vidmode before doing any rendering. */
   if(vga.reconfig.display || (cur_mode_class == TEXT && font_is_changed()) ||
@@ -630,8 +915,14 @@ int update_screen(void)
   }
 
 #if !RENDER_THREADED
-  do_rend_gfx();
-  do_rend_text();
+  if (due) {
+    hitimer_t t0 = GETusSYSTIME();
+    do_rend_gfx();
+    do_rend_text();
+    pthread_mutex_lock(&upd_mtx);
+    frame_done(t0, GETusSYSTIME());
+    pthread_mutex_unlock(&upd_mtx);
+  }
 #else
 #if !TEXT_THREADED
   do_rend_text();
@@ -649,7 +940,7 @@ int update_screen(void)
     v_printf("update_screen: nothing done (video_off = 0x%x)\n", vga.config.video_off);
     return 1;
   }
-  if (upd)
+  if (upd || !due)
     return 1;
 
   sem_post(&render_sem);
@@ -0,0 +1,362 @@
+/*
+ * (C) Copyright 1992, ..., 2014 the "DOSEMU-Development-Team".
+ *
+ * for details see file COPYING in the DOSEMU distribution
+ */
+
+/*
+ * Video capture: a render system that gets the same remapped frames
+ * as the SDL or X front end and streams them to a file or pipe
+ * ($_video_capture).
+ *
+ * The render thread draws into a private canvas. On unlock() it copies
+ * a changed canvas into a free slot of a small single producer, single
+ * consumer ring and wakes the writer thread. If all slots are in use,
+ * the frame is dropped, so the render thread never waits for the disk
+ * or for the encoder. The writer converts the frames to the output
+ * format and keeps a constant frame rate, repeating the last frame
+ * while the screen doesn't change.
+ *
+ * Output formats:
+ *   "|cmd"        YUV4MPEG2 (4:4:4) piped to cmd, e.g. "|ffmpeg -i - x.mkv"
+ *   "name.y4m"    YUV4MPEG2 (4:4:4) file
+ *   anything else raw RGB24 file
+ * The stream size is that of the first frame; later frames of another
+ * size are centered and cropped or padded with black.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "emu.h"
+#include "utilities.h"
+#include "vgaemu.h"
+#include "render.h"
+#include "timers.h"
+
+#define VIDCAP_SLOTS 4
+
+struct vidcap_slot {
+  unsigned char *buf;
+  size_t size;
+  int width, height, scan_len;
+  hitimer_t ts;
+};
+
+static struct vidcap_slot slots[VIDCAP_SLOTS];
+static unsigned slot_head;	/* written by the render thread only */
+static unsigned slot_tail;	/* written by the writer thread only */
+static unsigned cap_dropped;
+
+static unsigned char *canvas;
+static size_t canvas_size;
+static int cv_width, cv_height, cv_scan_len;
+static int cv_dirty;
+static ColorSpaceDesc cap_csd;
+static int cap_bpp;
+
+static FILE *cap_file;
+static int cap_pipe;
+static int cap_y4m;
+static int cap_failed;
+static int cap_quit;
+static int cap_active;
+static sem_t cap_sem;
+static pthread_t cap_thr;
+
+static int out_width, out_height;
+static unsigned char *out_buf;
+static size_t out_len;
+static unsigned frames_written, frames_merged;
+
+static struct bitmap_desc vidcap_lock(void)
+{
+  int w = vga.width, h = vga.height;
+  size_t size;
+
+  if (w <= 0 || h <= 0) {
+    w = 1;
+    h = 1;
+  }
+  if (w != cv_width || h != cv_height) {
+    size = (size_t)w * cap_bpp * h;
+    if (size > canvas_size) {
+      free(canvas);
+      canvas = malloc(size);
+      if (!canvas) {
+        canvas_size = 0;
+        cv_width = cv_height = 0;
+        return BMP(NULL, 0, 0, 0);
+      }
+      canvas_size = size;
+    }
+    memset(canvas, 0, size);
+    cv_width = w;
+    cv_height = h;
+    cv_scan_len = w * cap_bpp;
+  }
+  return BMP(canvas, cv_width, cv_height, cv_scan_len);
+}
+
+static void vidcap_refresh_rect(int x, int y, unsigned width, unsigned height)
+{
+  cv_dirty = 1;
+}
+
+static void vidcap_unlock(void)
+{
+  struct vidcap_slot *s;
+  unsigned tail;
+  size_t size;
+
+  if (!cv_dirty)
+    return;
+  cv_dirty = 0;
+  tail = __atomic_load_n(&slot_tail, __ATOMIC_ACQUIRE);
+  if (slot_head - tail >= VIDCAP_SLOTS) {
+    __atomic_add_fetch(&cap_dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  s = &slots[slot_head % VIDCAP_SLOTS];
+  size = (size_t)cv_scan_len * cv_height;
+  if (size > s->size) {
+    free(s->buf);
+    s->buf = malloc(size);
+    s->size = s->buf ? size : 0;
+    if (!s->buf) {
+      __atomic_add_fetch(&cap_dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  }
+  memcpy(s->buf, canvas, size);
+  s->width = cv_width;
+  s->height = cv_height;
+  s->scan_len = cv_scan_len;
+  s->ts = GETusSYSTIME();
+  __atomic_store_n(&slot_head, slot_head + 1, __ATOMIC_RELEASE);
+  sem_post(&cap_sem);
+}
+
+static struct render_system Render_vidcap = {
+  .refresh_rect = vidcap_refresh_rect,
+  .lock = vidcap_lock,
+  .unlock = vidcap_unlock,
+  .name = "vidcap",
+};
+
+static void vidcap_rgb(const unsigned char *p, int *r, int *g, int *b)
+{
+  unsigned pix = p[0] | (p[1] << 8) | (p[2] << 16);
+
+  if (cap_bpp == 4)
+    pix |= (unsigned)p[3] << 24;
+  *r = (pix & cap_csd.r_mask) >> cap_csd.r_shift;
+  *g = (pix & cap_csd.g_mask) >> cap_csd.g_shift;
+  *b = (pix & cap_csd.b_mask) >> cap_csd.b_shift;
+}
+
+/* convert a slot into out_buf, centered in the output size */
+static void vidcap_convert(const struct vidcap_slot *s)
+{
+  int dx = (out_width - s->width) / 2;
+  int dy = (out_height - s->height) / 2;
+  size_t plane = (size_t)out_width * out_height;
+  unsigned char *o = out_buf;
+  int x, y, r, g, b;
+
+  if (cap_y4m) {
+    memcpy(o, "FRAME\n", 6);
+    o += 6;
+    memset(o, 16, plane);
+    memset(o + plane, 128, plane * 2);
+  } else {
+    memset(o, 0, plane * 3);
+  }
+  for (y = 0; y < out_height; y++) {
+    int sy = y - dy;
+    const unsigned char *src;
+    if (sy < 0 || sy >= s->height)
+      continue;
+    src = s->buf + (size_t)sy * s->scan_len;
+    for (x = 0; x < out_width; x++) {
+      int sx = x - dx;
+      size_t i = (size_t)y * out_width + x;
+      if (sx < 0 || sx >= s->width)
+        continue;
+      vidcap_rgb(src + sx * cap_bpp, &r, &g, &b);
+      if (cap_y4m) {
+        /* ITU-R BT.601, limited range */
+        o[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+        o[plane + i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+        o[plane * 2 + i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+      } else {
+        o[i * 3] = r;
+        o[i * 3 + 1] = g;
+        o[i * 3 + 2] = b;
+      }
+    }
+  }
+}
+
+static void vidcap_write(void)
+{
+  if (cap_failed)
+    return;
+  if (fwrite(out_buf, out_len, 1, cap_file) != 1) {
+    error("vidcap: write failed, capture stopped\n");
+    cap_failed = 1;
+    return;
+  }
+  frames_written++;
+}
+
+static int vidcap_start(const struct vidcap_slot *s)
+{
+  unsigned period = render_frame_period();
+
+  out_width = s->width;
+  out_height = s->height;
+  out_len = (size_t)out_width * out_height * 3 + (cap_y4m ? 6 : 0);
+  out_buf = malloc(out_len);
+  if (!out_buf) {
+    error("vidcap: out of memory\n");
+    return -1;
+  }
+  if (cap_y4m && fprintf(cap_file, "YUV4MPEG2 W%d H%d F1000000:%u Ip A1:1 C444\n",
+      out_width, out_height, period) < 0) {
+    error("vidcap: write failed, capture stopped\n");
+    return -1;
+  }
+  v_printf("vidcap: %dx%d %s at 1000000/%u fps\n", out_width, out_height,
+      cap_y4m ? "yuv4mpeg2" : "rgb24", period);
+  return 0;
+}
+
+static void *vidcap_thread(void *arg)
+{
+  hitimer_t t0 = 0;
+  long long n, pend_n = 0;
+  int pending = 0;
+  unsigned period = render_frame_period();
+
+  while (1) {
+    struct vidcap_slot *s;
+    unsigned head;
+
+    sem_wait(&cap_sem);
+    head = __atomic_load_n(&slot_head, __ATOMIC_ACQUIRE);
+    while (slot_tail != head) {
+      s = &slots[slot_tail % VIDCAP_SLOTS];
+      if (!out_buf && !cap_failed) {
+        t0 = s->ts;
+        if (vidcap_start(s))
+          cap_failed = 1;
+      }
+      if (!cap_failed) {
+        n = (s->ts - t0 + period / 2) / period;
+        if (!pending)
+          pend_n = n;
+        else if (n > pend_n)
+          for (; pend_n < n && !cap_failed; pend_n++)
+            vidcap_write();
+        else
+          frames_merged++;
+        vidcap_convert(s);
+        pending = 1;
+      }
+      __atomic_store_n(&slot_tail, slot_tail + 1, __ATOMIC_RELEASE);
+    }
+    if (__atomic_load_n(&cap_quit, __ATOMIC_ACQUIRE))
+      break;
+  }
+  if (pending)
+    vidcap_write();
+  return NULL;
+}
+
+/*
+ * Register the capture render system. With a front end that has no
+ * remapper (no video), set one up that draws 32bpp frames for us.
+ */
+int vidcap_init(void)
+{
+  const char *dst = config.video_capture;
+
+  if (!dst || !dst[0])
+    return 0;
+  if (!remapper_get_csd(&cap_csd)) {
+    if (!config.dumb_video) {
+      error("vidcap: video capture needs SDL, X or no video\n");
+      return -1;
+    }
+    memset(&cap_csd, 0, sizeof(cap_csd));
+    cap_csd.bits = 32;
+    cap_csd.r_mask = 0xff0000;
+    cap_csd.g_mask = 0x00ff00;
+    cap_csd.b_mask = 0x0000ff;
+    color_space_complete(&cap_csd);
+    if (remapper_init(1, 1, 0, &cap_csd)) {
+      error("vidcap: VGAEmu init failed\n");
+      return -1;
+    }
+  }
+  cap_bpp = (cap_csd.bits + 7) / 8;
+  if ((cap_bpp != 3 && cap_bpp != 4) || cap_csd.r_bits != 8 ||
+      cap_csd.g_bits != 8 || cap_csd.b_bits != 8) {
+    error("vidcap: can't capture a %u bpp display\n", cap_csd.bits);
+    return -1;
+  }
+
+  if (dst[0] == '|') {
+    cap_file = popen(dst + 1, "w");
+    cap_pipe = 1;
+    cap_y4m = 1;
+  } else {
+    size_t len = strlen(dst);
+    cap_file = fopen(dst, "w");
+    cap_y4m = len > 4 && strcasecmp(dst + len - 4, ".y4m") == 0;
+  }
+  if (!cap_file) {
+    error("vidcap: can't open %s: %s\n", dst, strerror(errno));
+    return -1;
+  }
+  setvbuf(cap_file, NULL, _IOFBF, 1 << 20);
+
+  sem_init(&cap_sem, 0, 0);
+  pthread_create(&cap_thr, NULL, vidcap_thread, NULL);
+#if defined(HAVE_PTHREAD_SETNAME_NP) && defined(__GLIBC__)
+  pthread_setname_np(cap_thr, "dosemu: vidcap");
+#endif
+  register_render_system(&Render_vidcap);
+  cap_active = 1;
+  v_printf("vidcap: capturing to %s\n", dst);
+  return 0;
+}
+
+/* must be called after render_done(), when no more frames can come */
+void vidcap_done(void)
+{
+  int i;
+
+  if (!cap_active)
+    return;
+  cap_active = 0;
+  render_disable(&Render_vidcap);
+  __atomic_store_n(&cap_quit, 1, __ATOMIC_RELEASE);
+  sem_post(&cap_sem);
+  pthread_join(cap_thr, NULL);
+  sem_destroy(&cap_sem);
+  if (cap_pipe)
+    pclose(cap_file);
+  else
+    fclose(cap_file);
+  v_printf("vidcap: %u frames written, %u merged, %u dropped\n",
+      frames_written, frames_merged, cap_dropped);
+  free(out_buf);
+  for (i = 0; i < VIDCAP_SLOTS; i++)
+    free(slots[i].buf);
+}
@@ -43,6 +43,7 @@ static void v_empty_void (void) {}
 
 static int video_none_init(void)
 {
+  vidcap_init();
   vga_emu_setmode(video_mode, CO, LI);
   return 0;
 }
@@ -297,6 +298,7 @@ void video_close(void)
 {
   v_printf("VID: video_close() called\n");
   render_done();
+  vidcap_done();
   if (Video && Video->close) {
     Video->close();
     v_printf("VID: video_close()->Video->close() called\n");
@@ -494,6 +496,8 @@ void video_post_init(void)
     return;
   }
 
+  if (Video != &Video_none)
+    vidcap_init();
   if (!config.vga) {
     vga_emu_pre_init();
     render_init();
@@ -1189,6 +1189,7 @@ int mfs_lfn(void)
 		return 0;
 	}
 
+	mfs_flush_buffers();
 	carry = isset_CF();
 	ret = mfs_lfn_();
 	/* preserve carry if we forward the LFN request */
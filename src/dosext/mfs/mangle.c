@@ -41,7 +41,6 @@ Modified by O.V.Zhirov, July 1998
 #include "loadparm.h"
 #endif
 
-static void mangle_name_83(char *s, char *MangledMap);
 
 /****************************************************************************
 provide a checksum on a string
@@ -268,7 +267,7 @@ static void create_mangled_stack(int size)
 /****************************************************************************
 push a mangled name onto the stack
 ****************************************************************************/
-static void push_mangled_name(char *s)
+void push_mangled_name(const char *s)
 {
   int i;
   char *p;
@@ -411,7 +410,7 @@ BOOL is_mangled(const char *s)
  * the buffer must be able to hold 13 characters (including the null)
  *****************************************************************************
  */
-static void mangle_name_83(char *s, char *MangledMap)
+void mangle_name_83(char *s, char *MangledMap)
 {
   int csum = str_checksum(s);
   char *p;
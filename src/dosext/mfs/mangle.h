@@ -45,6 +45,8 @@ extern BOOL do_fwd_mangled_map(char *s, char *MangledMap);
 extern BOOL name_convert(char *Name,BOOL mangle);
 extern BOOL is_mangled(const char *s);
 extern BOOL check_mangled_stack(char *s, char *MangledMap);
+extern void push_mangled_name(const char *s);
+extern void mangle_name_83(char *s, char *MangledMap);
 
 /* prototypes, found in util.c */
 #include "keyboard/keystate.h"
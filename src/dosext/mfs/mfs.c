@@ -202,10 +202,13 @@ TODO:
 #include "utilities.h"
 #include "coopth.h"
 #include "lpt.h"
+#include "sig.h"
+#include "dirwatch.h"
 #endif
 
 #ifdef __linux__
 #include <linux/msdos_fs.h>
+#include <linux/magic.h>
 #endif
 
 #define Addr_8086(x,y)  MK_FP32((x),(y) & 0xffff)
@@ -272,6 +275,10 @@ static int emufs_loaded = FALSE;
 enum {DRV_NOT_FOUND, DRV_FOUND, DRV_NOT_ASSOCIATED};
 
 enum { TYPE_NONE, TYPE_DISK, TYPE_PRINTER };
+enum { LEASE_NEVER, LEASE_NONE, LEASE_HELD };
+#define LEASE_RETRY 256
+#define MAX_OWN_LOCKS 4
+#define RA_MIN 2048
 struct file_fd
 {
   char *name;
@@ -287,6 +294,20 @@ struct file_fd
   uint64_t seek;
   uint64_t size;
   int lock_cnt;
+  int lease;
+  int lease_retry;
+  /* regions write-locked through this handle */
+  int own_lk_num;
+  struct { uint64_t start, end; } own_lk[MAX_OWN_LOCKS];
+  /* read-ahead/write-behind buffer, see buf_pread() */
+  unsigned char *buf;
+  unsigned buf_size;
+  unsigned buf_len;
+  uint64_t buf_pos;
+  unsigned dirty_start, dirty_end;	/* nothing dirty if dirty_end is 0 */
+  unsigned ra_size;
+  uint64_t ra_next;
+  int buf_off;
 };
 
 /* Need to know how many drives are redirected */
@@ -384,6 +405,154 @@ static void lock_get(int fd, struct flock *fl)
   }
 }
 
+/* write back the dirty part of the buffer */
+static int buf_flush(struct file_fd *f)
+{
+  unsigned len = f->dirty_end - f->dirty_start;
+  int ret;
+
+  if (!f->dirty_end)
+    return 0;
+  ret = RPT_SYSCALL(pwrite(f->fd, f->buf + f->dirty_start, len,
+      f->buf_pos + f->dirty_start));
+  f->dirty_start = f->dirty_end = 0;
+  return (ret == len ? 0 : -1);
+}
+
+static void buf_drop(struct file_fd *f)
+{
+  f->buf_len = 0;
+}
+
+/*
+ * Every READ_FILE/WRITE_FILE has to check that no other process has
+ * the region locked, and that takes flock(), F_OFD_GETLK and flock()
+ * again. Other processes can only lock the file through an fd of
+ * their own, so while we hold a write lease on it (nobody else has it
+ * open) the check is skipped. Another process's open() of the file
+ * waits until mfs_lease_break() gives the lease up, and the handle
+ * goes back to checking. Our own open() would wait for ourselves,
+ * so every open of a file here calls lease_drop_*() first.
+ * A handle without a lease retries every LEASE_RETRY checks, so it
+ * gets the fast path back once the other opener has gone.
+ */
+static void lease_release(struct file_fd *f)
+{
+  fcntl(f->fd, F_SETLEASE, F_UNLCK);
+  f->lease_retry = LEASE_RETRY;
+  f->lease = LEASE_NONE;
+}
+
+static void lease_try(struct file_fd *f)
+{
+  /* set the state first, as the break can come right away */
+  f->lease = LEASE_HELD;
+  if (fcntl(f->fd, F_SETLEASE, F_WRLCK) == 0)
+    return;
+  /* EAGAIN: opened elsewhere. Anything else: not our file, or
+   * no leases on this filesystem */
+  f->lease = (errno == EAGAIN ? LEASE_NONE : LEASE_NEVER);
+  f->lease_retry = LEASE_RETRY;
+}
+
+static void lease_init(struct file_fd *f)
+{
+#ifdef __linux__
+  struct statfs buf;
+#endif
+
+  f->own_lk_num = 0;
+  f->lease = LEASE_NEVER;
+#ifdef __linux__
+  /* a write lease needs a writable fd. On network filesystems that
+   * don't check the lease with the server it is only local. */
+  if (!f->is_writable || fstatfs(f->fd, &buf) != 0 ||
+      buf.f_type == FUSE_SUPER_MAGIC || buf.f_type == V9FS_MAGIC ||
+      buf.f_type == CEPH_SUPER_MAGIC)
+    return;
+  if (fcntl(f->fd, F_SETSIG, SIG_LEASE) || fcntl(f->fd, F_SETOWN, getpid()))
+    return;
+  lease_try(f);
+#endif
+}
+
+static void buf_writeback(struct file_fd *f)
+{
+  if (buf_flush(f))
+    error("MFS: delayed write to %s failed\n", f->name);
+}
+
+/* write back and forget the buffer */
+static void buf_sync(struct file_fd *f)
+{
+  buf_writeback(f);
+  buf_drop(f);
+}
+
+/* called before we open the file ourselves: match by inode, as the
+ * file may be open under another name or through a hard link */
+static void lease_drop_ino(dev_t dev, ino_t ino)
+{
+  int i;
+
+  for (i = 0; i < MAX_OPENED_FILES; i++) {
+    struct file_fd *f = &open_files[i];
+    if (f->name && f->lease == LEASE_HELD && f->st.st_dev == dev &&
+        f->st.st_ino == ino) {
+      buf_sync(f);
+      lease_release(f);
+    }
+  }
+}
+
+static void lease_drop_path(const char *path)
+{
+  struct stat st;
+  int i;
+
+  for (i = 0; i < MAX_OPENED_FILES; i++) {
+    if (open_files[i].name && open_files[i].lease == LEASE_HELD)
+      break;
+  }
+  /* don't stat() anything if no lease is held */
+  if (i == MAX_OPENED_FILES || stat(path, &st) != 0)
+    return;
+  lease_drop_ino(st.st_dev, st.st_ino);
+}
+
+/*
+ * Registered with registersig_std(), so the signal handler only
+ * queues this and it runs later from handle_signals() in the main
+ * loop, never in the middle of a redirector call. The siginfo is
+ * not passed on, so look for the leases being broken: F_GETLEASE
+ * returns the type the lease is going to, F_UNLCK for those.
+ */
+static void mfs_lease_break(void *arg)
+{
+  int i;
+
+  for (i = 0; i < MAX_OPENED_FILES; i++) {
+    struct file_fd *f = &open_files[i];
+    if (f->name && f->lease == LEASE_HELD &&
+        fcntl(f->fd, F_GETLEASE) != F_WRLCK) {
+      buf_sync(f);
+      lease_release(f);
+    }
+  }
+}
+
+/* before anything else looks at the files */
+void mfs_flush_buffers(void)
+{
+  int i;
+
+  for (i = 0; i < MAX_OPENED_FILES; i++) {
+    struct file_fd *f = &open_files[i];
+    if (f->name && f->dirty_end)
+      buf_sync(f);
+  }
+}
+
 static int downgrade_dir_lock(int dir_fd, int fd, off_t start)
 {
     struct flock fl;
@@ -441,6 +610,12 @@ static struct file_fd *do_claim_fd(const char *name)
     ret->dir_fd = -1;
     ret->seek = 0;
     ret->size = 0;
+    ret->lease = LEASE_NEVER;
+    ret->buf_len = 0;
+    ret->dirty_start = ret->dirty_end = 0;
+    ret->ra_size = 0;
+    ret->ra_next = 0;
+    ret->buf_off = 0;
     return ret;
 }
 
@@ -505,6 +680,7 @@ static int do_mfs_creat(struct file_fd *f, const char *dname,
     f->psp = sda_cur_psp(sda);
     f->write_allowed = 1;
     f->is_writable = 1;
+    lease_init(f);
     return 0;
 
 err2:
@@ -523,6 +699,8 @@ static struct file_fd *mfs_creat(char *name, mode_t mode)
     int err;
     if (!slash)
         return NULL;
+    /* O_TRUNC of an existing file */
+    lease_drop_path(name);
     f = do_claim_fd(name);
     if (!f)
         return NULL;
@@ -707,6 +885,7 @@ static int do_mfs_open(struct file_fd *f, const char *dname,
     assert(is_writable >= write_requested);
     f->write_allowed = write_requested;
     f->is_writable = is_writable;
+    lease_init(f);
     return 0;
 
 err2:
@@ -725,6 +904,7 @@ static struct file_fd *mfs_open(char *name, int flags, struct stat *st,
     int err;
     if (!slash)
         return NULL;
+    lease_drop_ino(st->st_dev, st->st_ino);
     f = do_claim_fd(name);
     if (!f)
         return NULL;
@@ -898,6 +1078,10 @@ static int mfs_rename(char *name, char *name2)
 
 static void mfs_close(struct file_fd *f)
 {
+    buf_sync(f);
+    free(f->buf);
+    f->buf = NULL;
+    f->lease = LEASE_NEVER;
     close(f->fd);
     close(f->dir_fd);
     free(f->name);
@@ -1346,7 +1530,10 @@ int get_dos_attr(const char *fname, int mode)
 
 #ifdef __linux__
   if (fname && file_on_fat(fname) && (S_ISREG(mode) || S_ISDIR(mode))) {
-    int fd = open(fname, O_RDONLY);
+    int fd;
+    if (S_ISREG(mode))
+      lease_drop_path(fname);
+    fd = open(fname, O_RDONLY);
     if (fd != -1) {
       int res = ioctl(fd, FAT_IOCTL_GET_ATTRIBUTES, &attr);
       close(fd);
@@ -1403,8 +1590,10 @@ int set_dos_attr(char *fpath, int attr)
   int res;
 
 #ifdef __linux__
-  if (fpath && file_on_fat(fpath))
+  if (fpath && file_on_fat(fpath)) {
+    lease_drop_path(fpath);
     fd = open(fpath, O_RDONLY);
+  }
   if (fd != -1) {
     res = set_fat_attr(fd, attr);
     if (res && errno != ENOTTY) {
@@ -1536,6 +1725,12 @@ init_all_drives(void)
     init_one_drive(dd);
 }
 
+void mfs_init(void)
+{
+  registersig_std(SIG_LEASE, mfs_lease_break);
+  register_exit_handler(mfs_flush_buffers);
+}
+
 void mfs_reset(void)
 {
   int process_mask;
@@ -2447,15 +2642,247 @@ static inline void build_ufs_path(char *ufs, const char *path, int drive)
   build_ufs_path_(ufs, path, drive, 1);
 }
 
+/*
+ * Cache of the directory listings that scan_dir() searches, keyed by the
+ * inode of the directory, with hash tables for the DOS names of the
+ * entries. A listing is used again while the mtime and ctime of the
+ * directory stay the same and, if the directory is watched with inotify,
+ * no entry was added, removed or renamed. An unwatched directory that had
+ * been changed less than DIR_CACHE_RACY seconds before it was read is
+ * read again: with coarse (FAT: 2s) timestamps a second change in the
+ * same tick would go unnoticed.
+ */
+#define DIR_CACHE_NUM 16
+#define DIR_CACHE_RACY 2
+#define DIR_CACHE_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+struct dir_cache_ent {
+  int name;		/* host name, offset in pool */
+  int raw;		/* name in the DOS character set */
+  int lkey;		/* raw, uppercased */
+  int skey;		/* uppercased 8.3 or mangled name */
+  int lnext, snext;
+  unsigned char dos_ok, is83;
+};
+
+struct dir_cache {
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime, ctime;
+  unsigned used;
+  int racy;
+  struct dirwatch *watch;
+  volatile int changed;	/* set by the watch */
+  int num, max;
+  int stack_from;	/* entries from here on may end up on the mangled stack */
+  struct dir_cache_ent *ent;
+  char *pool;
+  size_t pool_len, pool_size;
+  int *lhash, *shash;
+  unsigned hmask;
+};
+
+static struct dir_cache dir_cache[DIR_CACHE_NUM];
+static unsigned dir_cache_clock;
+
+static unsigned dir_cache_hash(const char *s)
+{
+  unsigned h = 2166136261u;
+
+  while (*s)
+    h = (h ^ (unsigned char)*s++) * 16777619u;
+  return h;
+}
+
+static int dir_cache_str(struct dir_cache *dc, const char *s)
+{
+  size_t len = strlen(s) + 1;
+  int ret;
+
+  if (dc->pool_len + len > dc->pool_size) {
+    size_t size = dc->pool_size ? dc->pool_size * 2 : 4096;
+    char *p;
+    while (size < dc->pool_len + len)
+      size *= 2;
+    p = realloc(dc->pool, size);
+    if (!p)
+      return -1;
+    dc->pool = p;
+    dc->pool_size = size;
+  }
+  ret = dc->pool_len;
+  memcpy(dc->pool + ret, s, len);
+  dc->pool_len += len;
+  return ret;
+}
+
+static int dir_cache_upstr(struct dir_cache *dc, const char *s)
+{
+  char up[strlen(s) + 1];
+
+  strcpy(up, s);
+  strupperDOS(up);
+  return dir_cache_str(dc, up);
+}
+
+static void dir_cache_changed(void *arg, uint32_t mask)
+{
+  struct dir_cache *dc = arg;
+
+  dc->changed = 1;
+}
+
+static void dir_cache_free(struct dir_cache *dc)
+{
+  dirwatch_remove(dc->watch);
+  free(dc->ent);
+  free(dc->pool);
+  free(dc->lhash);
+  free(dc->shash);
+  memset(dc, 0, sizeof(*dc));
+}
+
+/* link the entries into the hash chains, in readdir order */
+static void dir_cache_link(struct dir_cache *dc, int *hash, int lfn)
+{
+  int i;
+
+  for (i = 0; i <= dc->hmask; i++)
+    hash[i] = -1;
+  for (i = dc->num - 1; i >= 0; i--) {
+    struct dir_cache_ent *e = &dc->ent[i];
+    int key = lfn ? e->lkey : e->skey;
+    unsigned h;
+    if (key == -1)
+      continue;
+    h = dir_cache_hash(dc->pool + key) & dc->hmask;
+    if (lfn) {
+      e->lnext = hash[h];
+    } else {
+      e->snext = hash[h];
+    }
+    hash[h] = i;
+  }
+}
+
+static int dir_cache_fill(struct dir_cache *dc, const char *path,
+    const struct stat *st)
+{
+  struct mfs_dir *cur_dir;
+  struct mfs_dirent *cur_ent;
+  time_t now = time(NULL);
+  unsigned size;
+  int i;
+
+  /* watch before reading, so that no change is missed */
+  dc->watch = dirwatch_add(path, DIR_CACHE_EVENTS, dir_cache_changed, dc);
+  if ((cur_dir = dos_opendir(path)) == NULL) {
+    dir_cache_free(dc);
+    return -1;
+  }
+  dc->dev = st->st_dev;
+  dc->ino = st->st_ino;
+  dc->mtime = st->st_mtim;
+  dc->ctime = st->st_ctim;
+  dc->racy = !dc->watch && (st->st_mtim.tv_sec + DIR_CACHE_RACY >= now ||
+      st->st_ctim.tv_sec + DIR_CACHE_RACY >= now);
+
+  while ((cur_ent = dos_readdir(cur_dir))) {
+    struct dir_cache_ent *e;
+    char tmpname[NAME_MAX + 1];
+
+    if (dc->num == dc->max) {
+      int max = dc->max ? dc->max * 2 : 64;
+      e = realloc(dc->ent, max * sizeof(*e));
+      if (!e)
+        goto fail;
+      dc->ent = e;
+      dc->max = max;
+    }
+    e = &dc->ent[dc->num];
+    e->dos_ok = name_ufs_to_dos(tmpname, cur_ent->d_long_name);
+    e->name = dir_cache_str(dc, cur_ent->d_name);
+    e->raw = dir_cache_str(dc, tmpname);
+    e->lkey = dir_cache_upstr(dc, tmpname);
+    e->is83 = name_convert(tmpname, 0);
+    /* mangle here without pushing on the mangled stack, that is done
+       by scan_dir() for the names it was asked for */
+    if (!e->is83)
+      mangle_name_83(tmpname, NULL);
+    e->skey = dir_cache_upstr(dc, tmpname);
+    if (e->name == -1 || e->raw == -1 || e->lkey == -1 || e->skey == -1)
+      goto fail;
+    dc->num++;
+  }
+  dos_closedir(cur_dir);
+
+  /* a scan for a mangled name that was not found pushed all names that
+     are not 8.3 on the stack, of which only the last MANGLED_STACK stay */
+  for (i = dc->num, size = 0; i > 0 && size < MANGLED_STACK; i--)
+    size += !dc->ent[i - 1].is83;
+  dc->stack_from = i;
+
+  for (size = 16; size < dc->num * 2; size *= 2);
+  dc->hmask = size - 1;
+  dc->lhash = malloc(size * sizeof(int));
+  dc->shash = malloc(size * sizeof(int));
+  if (!dc->lhash || !dc->shash) {
+    dir_cache_free(dc);
+    return -1;
+  }
+  dir_cache_link(dc, dc->lhash, 1);
+  dir_cache_link(dc, dc->shash, 0);
+  Debug0((dbg_fd, "dir_cache: read %d entries of %s\n", dc->num, path));
+  return 0;
+
+fail:
+  dos_closedir(cur_dir);
+  dir_cache_free(dc);
+  return -1;
+}
+
+static struct dir_cache *dir_cache_get(const char *path)
+{
+  struct dir_cache *dc, *lru = &dir_cache[0];
+  struct stat st;
+  int i;
+
+  if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+    return NULL;
+  dirwatch_sync();
+  for (i = 0; i < DIR_CACHE_NUM; i++) {
+    dc = &dir_cache[i];
+    if (dc->ent && dc->dev == st.st_dev && dc->ino == st.st_ino) {
+      if (!dc->racy && !dc->changed &&
+          dc->mtime.tv_sec == st.st_mtim.tv_sec &&
+          dc->mtime.tv_nsec == st.st_mtim.tv_nsec &&
+          dc->ctime.tv_sec == st.st_ctim.tv_sec &&
+          dc->ctime.tv_nsec == st.st_ctim.tv_nsec) {
+        dc->used = ++dir_cache_clock;
+        return dc;
+      }
+      lru = dc;
+      break;
+    }
+    if (dc->used < lru->used)
+      lru = dc;
+  }
+  dir_cache_free(lru);
+  if (dir_cache_fill(lru, path, &st))
+    return NULL;
+  lru->used = ++dir_cache_clock;
+  return lru;
+}
+
 /*
  * scan a directory for a matching filename
  */
 static int
 scan_dir(const char *path, char *name, int root_len)
 {
-  struct mfs_dir *cur_dir;
-  struct mfs_dirent *cur_ent;
-  int maybe_mangled, is_8_3;
+  struct dir_cache *dc;
+  struct dir_cache_ent *e = NULL;
+  int maybe_mangled, is_8_3, i;
   char dosname[strlen(name)+1];
 
   /* handle null paths */
@@ -2481,49 +2908,43 @@ scan_dir(const char *path, char *name, int root_len)
       (dosname[1] == '\0' || strcmp(dosname, "..") == 0))
     return (FALSE);
 
-  /* open the directory */
-  if ((cur_dir = dos_opendir(path)) == NULL) {
+  /* get the directory listing */
+  if ((dc = dir_cache_get(path)) == NULL) {
     Debug0((dbg_fd, "scan_dir(): failed to open dir: %s\n", path));
     return (FALSE);
   }
 
   strupperDOS(dosname);
 
-  /* now scan for matching names */
-  while ((cur_ent = dos_readdir(cur_dir))) {
-    char tmpname[NAME_MAX + 1];
-
-    if (!name_ufs_to_dos(tmpname,cur_ent->d_long_name) && !is_8_3)
-      continue;
-
-    if (is_8_3 && !name_convert(tmpname,maybe_mangled))
+  /* now look up the name: an LFN matches the readdir names that can be
+     represented in DOS, an 8.3 name the ones that are 8.3, and a mangled
+     name also the mangled names of the others. The first entry in
+     readdir order wins, as it would in a scan */
+  i = (is_8_3 ? dc->shash : dc->lhash)[dir_cache_hash(dosname) & dc->hmask];
+  for (; i != -1; i = is_8_3 ? e->snext : e->lnext) {
+    e = &dc->ent[i];
+    if (is_8_3 ? !e->is83 && !maybe_mangled : !e->dos_ok)
       continue;
+    if (strcmp(dc->pool + (is_8_3 ? e->skey : e->lkey), dosname) == 0)
+      break;
+  }
 
-    /* tmpname now contains the readdir name in the DOS character set */
-    if (!strequalDOS(tmpname, dosname)) {
-      if (!maybe_mangled || cur_ent->d_long_name == cur_ent->d_name)
-	continue;
-
-      /* check if the long name variety of the current name
-	 can be represented in DOS; otherwise it is mangled.
-	 only used for the LFN code on VFAT partitions.
-      */
-      if (name_ufs_to_dos(tmpname,cur_ent->d_long_name))
-	continue;
-      name_convert(tmpname,MANGLE);
-      if (!strequalDOS(tmpname, dosname))
-	continue;
-    }
-
-    Debug0((dbg_fd, "scan_dir found %s\n",cur_ent->d_name));
+  if (i != -1) {
+    Debug0((dbg_fd, "scan_dir found %s\n", dc->pool + e->name));
+    if (maybe_mangled && !e->is83)
+      push_mangled_name(dc->pool + e->raw);
 
     /* we've found the file, change it's name and return */
-    strcpy(name, cur_ent->d_name);
-    dos_closedir(cur_dir);
+    strcpy(name, dc->pool + e->name);
     return (TRUE);
   }
 
-  dos_closedir(cur_dir);
+  if (maybe_mangled) {
+    for (i = dc->stack_from; i < dc->num; i++) {
+      if (!dc->ent[i].is83)
+        push_mangled_name(dc->pool + dc->ent[i].raw);
+    }
+  }
 
   if (MANGLE && is_mangled(name))
     check_mangled_stack(name,NULL);
@@ -3483,6 +3904,181 @@ static void region_unlock_offs(int fd)
   flock(fd, LOCK_UN);
 }
 
+static void own_lock_add(struct file_fd *f, uint64_t start, uint64_t len)
+{
+  /* len 0 locks up to the end of file, don't bother */
+  if (!len || f->own_lk_num >= MAX_OWN_LOCKS)
+    return;
+  f->own_lk[f->own_lk_num].start = start;
+  f->own_lk[f->own_lk_num].end = start + len;
+  f->own_lk_num++;
+}
+
+static void own_lock_del(struct file_fd *f, uint64_t start, uint64_t len)
+{
+  uint64_t end = len ? start + len : UINT64_MAX;
+  int i;
+
+  /* forget everything the unlock touches: a partly unlocked
+   * region is simply not known to be ours any more */
+  for (i = 0; i < f->own_lk_num; ) {
+    if (f->own_lk[i].start < end && f->own_lk[i].end > start)
+      f->own_lk[i] = f->own_lk[--f->own_lk_num];
+    else
+      i++;
+  }
+}
+
+/* can nobody else have locks in the region? */
+static int region_owned(struct file_fd *f, uint64_t start, uint64_t len)
+{
+  int i;
+
+  if (f->lease == LEASE_HELD)
+    return 1;
+  if (f->lease == LEASE_NONE && --f->lease_retry <= 0) {
+    lease_try(f);
+    if (f->lease == LEASE_HELD)
+      return 1;
+  }
+  for (i = 0; i < f->own_lk_num; i++) {
+    if (f->own_lk[i].start <= start && f->own_lk[i].end >= start + len)
+      return 1;
+  }
+  return 0;
+}
+
+/*
+ * Returns how many bytes at start can be accessed, -1 on error.
+ * region_unlock() must follow after the I/O.
+ */
+static int region_lock(struct file_fd *f, uint64_t start, unsigned len,
+    int *locked)
+{
+  int ret;
+
+  *locked = 0;
+  if (start > 0xFFFFffff || start + len > 0xFFFFffff ||
+      region_owned(f, start, len))
+    return len;
+  ret = region_lock_offs(f->fd, start, len);
+  if (ret != -1)
+    *locked = 1;
+  return ret;
+}
+
+static void region_unlock(struct file_fd *f, int locked)
+{
+  if (locked)
+    region_unlock_offs(f->fd);
+}
+
+/*
+ * Optional read-ahead/write-behind buffer of a handle ($_mfs_buffer).
+ * It is used only while no other process can tell the difference:
+ * under a lease, or when the DOS share mode keeps the others from
+ * writing (read-ahead) or from opening the file at all (write-behind).
+ * Record locks turn it off for the handle. Dirty data is written back
+ * before any other redirector call, on a lease break, on close and
+ * on exit.
+ */
+static int buf_ok(struct file_fd *f, int write)
+{
+  if (config.mfs_buffer <= 0 || f->buf_off || f->type != TYPE_DISK)
+    return 0;
+  if (f->lease != LEASE_HELD && f->share_mode != DENY_ALL &&
+      (write || f->share_mode != DENY_WRITE))
+    return 0;
+  if (!f->buf) {
+    f->buf_size = _min(config.mfs_buffer, 1024) * 1024;
+    f->buf = malloc(f->buf_size);
+    if (!f->buf) {
+      f->buf_off = 1;
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int buf_pread(struct file_fd *f, dosaddr_t data, int cnt,
+    uint64_t pos)
+{
+  int seq = (pos == f->ra_next);
+  int done = 0, filled = 0;
+  unsigned len;
+  int ret;
+
+  if (!buf_ok(f, 0) || cnt >= f->buf_size) {
+    buf_writeback(f);
+    buf_drop(f);
+    ret = dos_pread(f->fd, data, cnt, pos);
+    if (ret < 0 && errno == ESPIPE)
+      ret = dos_read(f->fd, data, cnt);
+    return ret;
+  }
+  while (done < cnt) {
+    if (pos >= f->buf_pos && pos < f->buf_pos + f->buf_len) {
+      len = _min(cnt - done, f->buf_pos + f->buf_len - pos);
+      memcpy_2dos(data + done, f->buf + (pos - f->buf_pos), len);
+      done += len;
+      pos += len;
+      continue;
+    }
+    /* a short fill means end of file */
+    if (filled)
+      break;
+    buf_writeback(f);
+    /* the read-ahead grows while the reads are sequential */
+    if (seq && f->ra_size)
+      f->ra_size = _min(f->ra_size * 2, f->buf_size);
+    else
+      f->ra_size = _min(RA_MIN, f->buf_size);
+    len = _max(cnt - done, f->ra_size);
+    ret = RPT_SYSCALL(pread(f->fd, f->buf, len, pos));
+    if (ret < 0) {
+      buf_drop(f);
+      return (done ? done : ret);
+    }
+    f->buf_pos = pos;
+    f->buf_len = ret;
+    filled = 1;
+  }
+  f->ra_next = pos;
+  return done;
+}
+
+static int buf_pwrite(struct file_fd *f, dosaddr_t data, int cnt,
+    uint64_t pos)
+{
+  unsigned off;
+  int ret;
+
+  if (!buf_ok(f, 1) || cnt >= f->buf_size) {
+    buf_writeback(f);
+    buf_drop(f);
+    ret = dos_pwrite(f->fd, data, cnt, pos);
+    if (ret < 0 && errno == ESPIPE)
+      ret = dos_write(f->fd, data, cnt);
+    return ret;
+  }
+  /* the buffer must stay contiguous */
+  if (!f->buf_len || pos < f->buf_pos || pos > f->buf_pos + f->buf_len ||
+      pos + cnt > f->buf_pos + f->buf_size) {
+    buf_writeback(f);
+    f->buf_pos = pos;
+    f->buf_len = 0;
+  }
+  off = pos - f->buf_pos;
+  memcpy_2unix(f->buf + off, data, cnt);
+  if (off + cnt > f->buf_len)
+    f->buf_len = off + cnt;
+  if (!f->dirty_end || off < f->dirty_start)
+    f->dirty_start = off;
+  if (off + cnt > f->dirty_end)
+    f->dirty_end = off + cnt;
+  return cnt;
+}
+
 /* returns pointer to the basename of fpath */
 static char *getbasename(char *fpath)
 {
@@ -3946,6 +4542,9 @@ static int dos_fs_redirect(struct vm86_regs *state, char *stk)
   if (!mfs_enabled)
     return REDIRECT;
 
+  if (LOW(state->eax) != READ_FILE && LOW(state->eax) != WRITE_FILE)
+    mfs_flush_buffers();
+
   sft = LINEAR2UNIX(SEGOFF2LINEAR(SREG(es), LWORD(edi)));
 
   Debug0((dbg_fd, "Entering dos_fs_redirect, FN=%02X, '%s'\n",
@@ -4084,20 +4683,14 @@ static int dos_fs_redirect(struct vm86_regs *state, char *stk)
       update_seek_from_dos(sft_position(sft), &f->seek);
       cnt = WORD(state->ecx);
       if (cnt) {
-        int cnt1 = cnt;
-        if (f->seek <= 0xFFFFffff && f->seek + cnt <= 0xFFFFffff) {
-          cnt1 = region_lock_offs(f->fd, f->seek, cnt);
-          if (cnt1 != -1)
-            locked++;
-        }
+        int cnt1 = region_lock(f, f->seek, cnt, &locked);
         assert(cnt1 <= cnt);
 #if 1
         if (cnt1 <= 0) {  // allow partial reads even though DOS does not
 #else
         if (cnt1 < cnt) {  // partial reads not allowed
 #endif
-          if (locked)
-            region_unlock_offs(f->fd);
+          region_unlock(f, locked);
           Debug0((dbg_fd, "error, region already locked\n"));
           SETWORD(&state->eax, ACCESS_DENIED);
           return FALSE;
@@ -4107,18 +4700,9 @@ static int dos_fs_redirect(struct vm86_regs *state, char *stk)
       Debug0((dbg_fd, "Read file fd=%d, dta=%#x, cnt=%d\n", f->fd, dta, cnt));
       Debug0((dbg_fd, "Read file pos = %"PRIu64"\n", f->seek));
       Debug0((dbg_fd, "Handle cnt %d\n", sft_handle_cnt(sft)));
-      s_pos = lseek(f->fd, f->seek, SEEK_SET);
-      if (s_pos < 0 && errno != ESPIPE) {
-        if (locked)
-          region_unlock_offs(f->fd);
-        SETWORD(&state->ecx, 0);
-        return TRUE;
-      }
-      Debug0((dbg_fd, "Actual pos %"PRIu64"\n", (uint64_t)s_pos));
-
-      ret = dos_read(f->fd, dta, cnt);
-      if (locked)
-        region_unlock_offs(f->fd);
+      s_pos = f->seek;
+      ret = buf_pread(f, dta, cnt, s_pos);
+      region_unlock(f, locked);
 
       Debug0((dbg_fd, "Read returned : %d\n", ret));
       if (ret < 0) {
@@ -4171,6 +4755,7 @@ static int dos_fs_redirect(struct vm86_regs *state, char *stk)
 
       if (!cnt) {
         Debug0((dbg_fd, "Applying O_TRUNC at %x\n", (int)s_pos));
+        buf_sync(f);
         if (ftruncate(f->fd, (off_t)f->seek)) {
           Debug0((dbg_fd, "O_TRUNC failed\n"));
           SETWORD(&state->eax, ACCESS_DENIED);
@@ -4180,39 +4765,26 @@ static int dos_fs_redirect(struct vm86_regs *state, char *stk)
         set_32bit_size_or_position(&sft_size(sft), f->size);
         SETWORD(&state->ecx, 0);
       } else {
-        int cnt1 = cnt;
-        if (f->seek <= 0xFFFFffff && f->seek + cnt <= 0xFFFFffff) {
-          cnt1 = region_lock_offs(f->fd, f->seek, cnt);
-          if (cnt1 != -1)
-            locked++;
-        }
+        int cnt1 = region_lock(f, f->seek, cnt, &locked);
         assert(cnt1 <= cnt);
 #if 1
         if (cnt1 <= 0) {  // allow partial writes even though DOS does not
 #else
         if (cnt1 < cnt) {  // partial writes not allowed
 #endif
-          if (locked)
-            region_unlock_offs(f->fd);
+          region_unlock(f, locked);
           Debug0((dbg_fd, "error, region already locked\n"));
           SETWORD(&state->eax, ACCESS_DENIED);
           return FALSE;
         }
         cnt = cnt1;
 
-        s_pos = lseek(f->fd, f->seek, SEEK_SET);
-        if (s_pos < 0 && errno != ESPIPE) {
-          if (locked)
-            region_unlock_offs(f->fd);
-          SETWORD(&state->ecx, 0);
-          return TRUE;
-        }
+        s_pos = f->seek;
         Debug0((dbg_fd, "Handle cnt %d\n", sft_handle_cnt(sft)));
         Debug0((dbg_fd, "fsize = %"PRIx64", fseek = %"PRIx64", dta = %#x, cnt = %x\n",
                       f->size, f->seek, dta, (int)cnt));
-        ret = dos_write(f->fd, dta, cnt);
-        if (locked)
-          region_unlock_offs(f->fd);
+        ret = buf_pwrite(f, dta, cnt, s_pos);
+        region_unlock(f, locked);
 
         if (ret < 0) {
           Debug0((dbg_fd, "Write Failed : %s\n", strerror(errno)));
@@ -4230,8 +4802,12 @@ static int dos_fs_redirect(struct vm86_regs *state, char *stk)
         SETWORD(&state->ecx, ret);
       }
       //    sft_abs_cluster(sft) = 0x174a;	/* XXX a test */
-      /* update stat for atime/mtime */
-      if (fstat(f->fd, &f->st) == 0)
+      /* update stat for atime/mtime. Buffered data only gets its mtime
+       * when it is written back, so until then report the time of the
+       * write, as the SFT date is read without asking us. */
+      if (f->dirty_end)
+        time_to_dos(time(NULL), &sft_date(sft), &sft_time(sft));
+      else if (fstat(f->fd, &f->st) == 0)
         time_to_dos(f->st.st_mtime, &sft_date(sft), &sft_time(sft));
       return TRUE;
     }
@@ -4864,13 +5440,19 @@ do_create_truncate:
       if ((start & mask) != 0)
         start = (start & ~mask) | ((start & mask) >> 2);
 
+      /* record locks mean sharing, so no more buffering */
+      buf_sync(f);
+      f->buf_off = 1;
       ret = lock_file_region(f->fd, is_lock, start, pt->size & ~mask);
       if (ret == 0) {
         /* locks can be coalesced so the single unlock resets the counter */
-        if (is_lock)
+        if (is_lock) {
           f->lock_cnt++;
-        else
+          own_lock_add(f, start, pt->size & ~mask);
+        } else {
           f->lock_cnt = 0;
+          own_lock_del(f, start, pt->size & ~mask);
+        }
         return TRUE; /* no error */
       }
       SETWORD(&state->eax, FILE_LOCK_VIOLATION);
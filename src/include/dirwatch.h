@@ -0,0 +1,33 @@
+/*
+ * (C) Copyright 1992, ..., 2014 the "DOSEMU-Development-Team".
+ *
+ * for details see file COPYING in the DOSEMU distribution
+ */
+
+#ifndef DIRWATCH_H
+#define DIRWATCH_H
+
+#include <stdint.h>
+#include <sys/inotify.h>
+
+/*
+ * Change tracking for host directories that are cached by the DOS side
+ * (MFS directory listings, fatfs object tables), with inotify.
+ *
+ * func(arg, mask) is called from io_select() or dirwatch_sync() for the
+ * events in mask that happened in the directory, with IN_IGNORED if the
+ * watch went away (directory deleted or unmounted) and IN_Q_OVERFLOW if
+ * events were lost. It must not add or remove watches.
+ *
+ * dirwatch_add() returns NULL if the changes can't be tracked, e.g. on
+ * network and FUSE filesystems where inotify only sees the local ones;
+ * the caller then has to check the directory itself.
+ */
+struct dirwatch;
+
+struct dirwatch *dirwatch_add(const char *path, uint32_t mask,
+    void (*func)(void *, uint32_t), void *arg);
+void dirwatch_remove(struct dirwatch *w);
+void dirwatch_sync(void);
+
+#endif
@@ -208,6 +208,7 @@ void mimic_boot_blk(void);
 
 void fatfs_init(struct disk *);
 void fatfs_done(struct disk *);
+void fatfs_reset(struct disk *);
 
 fatfs_t *get_fat_fs_by_serial(unsigned long serial, int *r_idx, int *r_ro);
 fatfs_t *get_fat_fs_by_drive(unsigned char drv_num);
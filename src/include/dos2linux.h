@@ -347,6 +347,8 @@ int unix_read(int fd, void *data, int cnt);
 int dos_read(int fd, unsigned data, int cnt);
 int unix_write(int fd, const void *data, int cnt);
 int dos_write(int fd, unsigned data, int cnt);
+int dos_pread(int fd, unsigned data, int cnt, off_t pos);
+int dos_pwrite(int fd, unsigned data, int cnt, off_t pos);
 int com_vsprintf(char *str, const char *format, va_list ap);
 int com_vsnprintf(char *str, size_t size, const char *format, va_list ap);
 int com_sprintf(char *str, const char *format, ...) FORMAT(printf, 2, 3);
@@ -156,6 +156,10 @@ typedef struct config_info {
        #define EMU_FULL() (EMU_V86() && EMU_DPMI())
        #define IS_EMU() (EMU_V86() || EMU_DPMI())
        boolean cpusim;
+       char *cpuemu_cache;	/* persistent JIT code cache file */
+       char *cpuemu_profile;	/* JIT per-block profile output file */
+       int cpuemu_codesize;	/* JIT translated code budget, Kbytes */
+       boolean cpuemu_bgcompile;	/* JIT traces compiled on a worker */
 #endif
        int cpu_vm;
        int cpu_vm_dpmi;
@@ -171,6 +175,10 @@ typedef struct config_info {
        boolean X_fullscreen;
        boolean sdl;
        boolean vga_fonts;
+       int render_threads;		/* remap worker threads, 0 = off */
+       int render_fps;			/* frame rate cap, 0 = VGA retrace */
+       char *video_capture;		/* file or |pipe for vidcap.c */
+       char *vga_diff_modes;	/* modes with snapshot dirty tracking */
        int sdl_sound;
        int libao_sound;
        u_short cardtype;
@@ -281,6 +289,7 @@ typedef struct config_info {
 
        /* Lock File business */
        int file_lock_limit;
+       int mfs_buffer;		/* KB of read-ahead/write-behind per file */
        char *tty_lockdir;	/* The Lock directory  */
        char *tty_lockfile;	/* Lock file pretext ie LCK.. */
        boolean tty_lockbinary;	/* Binary lock files ? */
@@ -334,6 +343,7 @@ typedef struct config_info {
        boolean pcm_hpf;
        char *midi_file;
        char *wav_file;
+       char *opl_file;
 
        /* joystick */
        char *joy_device[2];
@@ -385,6 +395,7 @@ extern void cpu_setup(void);
 extern void cpu_reset(void);
 extern void real_run_int(int);
 extern void mfs_reset(void);
+extern void mfs_init(void);
 extern int mfs_redirector(struct vm86_regs *regs, char *stk, int revect);
 extern int mfs_fat32(void);
 extern int mfs_lfn(void);
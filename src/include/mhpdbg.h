@@ -54,6 +54,8 @@ int mhpdbg_is_stopped(void);
 int mhp_usermap_move_block(uint16_t oldseg, uint16_t newseg,
                            uint16_t startoff, uint32_t blklen);
 int mhp_usermap_load_gnuld(const char *fname, uint16_t origin);
+const char *mhp_getsym_near(unsigned int seg, unsigned int off,
+                            unsigned int *delta);
 #ifdef USE_MHPDBG
 int mhp_revectored(int inum);
 #else
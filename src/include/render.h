@@ -22,11 +22,13 @@ struct render_system
 };
 
 int register_render_system(struct render_system *render_system);
+
 enum { REMAP_DOSEMU, REMAP_PIXMAN };
 int register_remapper(struct remap_calls *calls, int prio);
 int remapper_init(int have_true_color, int have_shmap, int features,
 	ColorSpaceDesc *csd);
 void remapper_done(void);
+int remapper_get_csd(ColorSpaceDesc *csd);
 struct vid_mode_params get_mode_parameters(void);
 int render_update_vidmode(void);
 int update_screen(void);
@@ -43,5 +45,8 @@ void render_mode_lock_w(void);
 void render_mode_unlock(void);
 void render_enable(struct render_system *render);
 void render_disable(struct render_system *render);
+unsigned render_frame_period(void);
+int vidcap_init(void);
+void vidcap_done(void);
 
 #endif
@@ -60,6 +60,8 @@ extern void SIG_close(void);
 #define SIG_RELEASE     SIGUSR1
 #define SIG_ACQUIRE     SIGUSR2
 #define SIG_THREAD_NOTIFY (SIGRTMIN + 0)
+/* lease breaks on files opened by MFS */
+#define SIG_LEASE       (SIGRTMIN + 1)
 
 typedef mcontext_t sigcontext_t;
 
@@ -131,6 +131,9 @@
 #define INPUT_STATUS_1		0x3da
 #define FEATURE_CONTROL_W	0x3da
 
+/* period of the emulated vertical retrace in usecs (see miscemu.c) */
+#define VGA_VRETRACE_US		17000
+
 
 /*
  *
@@ -268,6 +271,9 @@ typedef struct {
   unsigned bank_pages;			/* size of a bank in pages */
   unsigned bank;			/* selected bank */
   unsigned char *dirty_map;		/* 1 == dirty */
+  unsigned char *snapshot;		/* last displayed copy of base */
+  int diff;				/* find changes by diffing snapshot */
+  int diff_wanted;			/* diff selected for current mode */
   unsigned char *prot_map0, *prot_map1;	/* prot flags per page */
   int planes;				/* 4 for PL4 and ModeX, 1 otherwise */
   int plane_pages;			/* pages per plane  */
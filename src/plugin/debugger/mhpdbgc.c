@@ -322,6 +322,38 @@ static const char *getsym_from_bios(unsigned int seg, unsigned int off)
   return NULL;
 }
 
+/* nearest symbol at or below seg:off, for profilers and the like;
+ * *delta gets the distance from the symbol */
+const char *mhp_getsym_near(unsigned int seg, unsigned int off,
+                            unsigned int *delta)
+{
+  dosaddr_t addr = SEGOFF2LINEAR(seg, off), a, best = 0;
+  const char *s = NULL;
+  int i;
+
+  for (i = 0; i < user_symbol_num; i++) {
+    if (!user_symbol[i].name[0])
+      continue;
+    a = SEGOFF2LINEAR(user_symbol[i].seg, user_symbol[i].off);
+    if (a <= addr && addr - a < 0x10000 && (!s || a > best)) {
+      best = a;
+      s = user_symbol[i].name;
+    }
+  }
+  if ((addr & 0xffff0000) >> 4 == BIOSSEG) {
+    for (i = 0; i < bios_symbol_num; i++) {
+      a = SEGOFF2LINEAR(BIOSSEG, bios_symbol[i].off);
+      if (a <= addr && (!s || a > best)) {
+        best = a;
+        s = bios_symbol[i].name;
+      }
+    }
+  }
+  if (s)
+    *delta = addr - best;
+  return s;
+}
+
 static unsigned int getaddr_from_dos_sym(char *n1, unsigned int *v1, unsigned int *s1, unsigned int *o1)
 {
   int i;
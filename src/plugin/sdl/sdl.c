@@ -145,8 +145,8 @@ static int use_ttf_font;
 static pthread_mutex_t rects_mtx = PTHREAD_MUTEX_INITIALIZER;
 static int sdl_rects_num;
 static int tmp_rects_num;
-#define RECTS_UPD_THRESHOLD 10000
-static struct rng_s rects_rng;
+/* bounding box of the surface area not yet uploaded to texture_buf */
+static SDL_Rect dirty_rect;
 static pthread_mutex_t rend_mtx = PTHREAD_MUTEX_INITIALIZER;
 #if THREADED_REND
 static pthread_t rend_thr;
@@ -341,9 +341,6 @@ static int SDL_init(void)
 
   assert(pthread_equal(pthread_self(), dosemu_pthread_self));
 
-  rng_init(&rects_rng, RECTS_UPD_THRESHOLD, sizeof(struct rect_desc));
-  rng_allow_ovw(&rects_rng, 0);
-
   if (!config.sdl_hwrend)
     rflags |= SDL_RENDERER_SOFTWARE;
 #ifdef SDL_HINT_VIDEO_X11_NET_WM_BYPASS_COMPOSITOR /* only available since SDL 2.0.8 */
@@ -474,7 +471,6 @@ void SDL_close(void)
   }
   rng_destroy(&ttf_char_rng);
 #endif
-  rng_destroy(&rects_rng);
   SDL_DestroyWindow(window);
   SDL_QuitSubSystem(SDL_INIT_VIDEO | SDL_INIT_EVENTS);
 }
@@ -579,6 +575,8 @@ static void unlock_surface(void)
 #endif
 }
 
+#if defined(HAVE_SDL2_TTF) && defined(HAVE_FONTCONFIG)
+
 /* wrapper needed to "clean up" the created textures */
 static SDL_Texture *CreateTextureTarget(int w, int h, int clean)
 {
@@ -593,8 +591,6 @@ static SDL_Texture *CreateTextureTarget(int w, int h, int clean)
   return tex;
 }
 
-#if defined(HAVE_SDL2_TTF) && defined(HAVE_FONTCONFIG)
-
 static TTF_Font *do_open_font(int idx, int psize, int *w, int *h)
 {
   TTF_Font *f;
@@ -753,7 +749,6 @@ static void setup_ttf_winsize(int xtarget, int ytarget)
     leavedos(99);
   }
 }
-#endif
 
 static void do_rend_rects(struct rng_s *rng, SDL_Texture *tex)
 {
@@ -769,6 +764,33 @@ static void do_rend_rects(struct rng_s *rng, SDL_Texture *tex)
   pthread_mutex_unlock(&rects_mtx);
   SDL_SetRenderTarget(renderer, NULL);
 }
+#endif
+
+/* upload the dirty part of the surface to the streaming texture */
+static void do_rend_surface(void)
+{
+  SDL_Rect r;
+  void *pixels;
+  int pitch, len, i;
+  const Uint8 *src;
+
+  pthread_mutex_lock(&rects_mtx);
+  r = dirty_rect;
+  dirty_rect.w = dirty_rect.h = 0;
+  pthread_mutex_unlock(&rects_mtx);
+  if (SDL_RectEmpty(&r))
+    return;
+  if (SDL_LockTexture(texture_buf, &r, &pixels, &pitch)) {
+    error("SDL: texture lock failed: %s\n", SDL_GetError());
+    return;
+  }
+  len = r.w * surface->format->BytesPerPixel;
+  src = (const Uint8 *)surface->pixels + r.y * surface->pitch +
+      r.x * surface->format->BytesPerPixel;
+  for (i = 0; i < r.h; i++)
+    memcpy((Uint8 *)pixels + i * pitch, src + i * surface->pitch, len);
+  SDL_UnlockTexture(texture_buf);
+}
 
 static void do_rend(void)
 {
@@ -778,8 +800,8 @@ static void do_rend(void)
     do_rend_rects(&ttf_char_rng, texture_ttf);
 #endif
   } else {
-    /* texture_buf protected by render_mode_lock() */
-    do_rend_rects(&rects_rng, texture_buf);
+    /* texture_buf and surface protected by render_mode_lock() */
+    do_rend_surface();
   }
   pthread_mutex_unlock(&rend_mtx);
 }
@@ -858,9 +880,10 @@ static void SDL_change_mode(int x_res, int y_res, int w_x_res, int w_y_res)
     texture_buf = NULL;
   }
   if (x_res > 0 && y_res > 0) {
-    texture_buf = CreateTextureTarget(x_res, y_res, 1);
+    texture_buf = SDL_CreateTexture(renderer, pixel_format,
+        SDL_TEXTUREACCESS_STREAMING, x_res, y_res);
     if (!texture_buf) {
-      error("SDL target texture failed: %s\n", SDL_GetError());
+      error("SDL streaming texture failed: %s\n", SDL_GetError());
       leavedos(99);
     }
     surface = SDL_CreateRGBSurface(0, x_res, y_res, SDL_csd.bits,
@@ -956,9 +979,12 @@ static void SDL_change_mode(int x_res, int y_res, int w_x_res, int w_y_res)
   win_width = x_res;
   win_height = y_res;
 
-  /* forget about those rectangles */
+  /* forget about those rectangles, but upload the (blank) surface */
   pthread_mutex_lock(&rects_mtx);
   sdl_rects_num = 0;
+  dirty_rect.x = dirty_rect.y = 0;
+  dirty_rect.w = surface ? x_res : 0;
+  dirty_rect.h = surface ? y_res : 0;
   pthread_mutex_unlock(&rects_mtx);
 
   update_mouse_coords();
@@ -972,31 +998,21 @@ static int SDL_update_screen(void)
   return 0;
 }
 
+/*
+ * The remapper has drawn into the surface; only remember the area.
+ * do_rend() uploads the bounding box of all rects once per frame.
+ */
 static void SDL_put_image(int x, int y, unsigned width, unsigned height)
 {
-  int offs = x * SDL_csd.bits / 8 + y * surface->pitch;
-  struct rect_desc d;
-
-  d.rect.x = x;
-  d.rect.y = y;
-  d.rect.w = width;
-  d.rect.h = height;
+  SDL_Rect r = { x, y, width, height };
 
-  pthread_mutex_lock(&rend_mtx);
-  d.tex = SDL_CreateTexture(renderer,
-        pixel_format,
-        SDL_TEXTUREACCESS_STATIC,
-        width, height);
-  assert(d.tex);
-  SDL_UpdateTexture(d.tex, NULL, surface->pixels + offs, surface->pitch);
   pthread_mutex_lock(&rects_mtx);
-  if (!rng_put(&rects_rng, &d)) {
-    error("SDL: rects queue overflow\n");
-    SDL_DestroyTexture(d.tex);
-  }
+  if (SDL_RectEmpty(&dirty_rect))
+    dirty_rect = r;
+  else
+    SDL_UnionRect(&dirty_rect, &r, &dirty_rect);
   tmp_rects_num++;
   pthread_mutex_unlock(&rects_mtx);
-  pthread_mutex_unlock(&rend_mtx);
 }
 
 static void window_grab(int on, int kbd)
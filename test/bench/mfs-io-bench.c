@@ -0,0 +1,239 @@
+/*
+ * Microbenchmark for the MFS READ_FILE path: src/dosext/mfs/mfs.c is
+ * built into the bench as it is, and each DOS read does what the
+ * READ_FILE case does, region_lock() + buf_pread() + region_unlock(),
+ * on a temp file. The syscalls are counted with ld --wrap. Cases:
+ *   probe:    no lease (read-only handle), every read takes the lock
+ *             probe, flock + F_OFD_GETLK + flock around the pread
+ *   lease:    write lease held, nobody else has the file open
+ *   shared:   another fd has the file open, so the lease can't be
+ *             taken and is retried every LEASE_RETRY reads
+ *   own lock: as shared, but the records were locked by the reader
+ *   buffered: as lease, with $_mfs_buffer = 64
+ * The rest of mfs.c is dropped by --gc-sections, so only what this
+ * path calls is stubbed below.
+ *
+ * Needs a configured tree (src/include/config.hh).
+ *
+ * Usage: mfs-io-bench [reads] [record size] [dir]
+ */
+#include "mfs.c"
+#include <stdarg.h>
+
+#define FILE_SIZE	(1 << 20)
+
+/* ---- what the read path needs from the rest of dosemu ---- */
+
+struct config_info config;
+unsigned char debug_levels[DEBUG_CLASSES];
+static unsigned char dosmem[0x10000];
+
+int log_printf(int flg, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+	return 0;
+}
+
+void error(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+}
+
+void *dosaddr_to_unixaddr(dosaddr_t addr)
+{
+	return dosmem + (addr & 0xffff);
+}
+
+void memcpy_2dos(dosaddr_t dest, const void *src, size_t n)
+{
+	memcpy(dosaddr_to_unixaddr(dest), src, n);
+}
+
+void memcpy_2unix(void *dest, dosaddr_t src, size_t n)
+{
+	memcpy(dest, dosaddr_to_unixaddr(src), n);
+}
+
+/* as in dos2linux.c without the VGA and the code invalidation */
+int dos_pread(int fd, unsigned data, int cnt, off_t pos)
+{
+	return RPT_SYSCALL(pread(fd, dosaddr_to_unixaddr(data), cnt, pos));
+}
+
+int dos_read(int fd, unsigned data, int cnt)
+{
+	return RPT_SYSCALL(read(fd, dosaddr_to_unixaddr(data), cnt));
+}
+
+int dos_pwrite(int fd, unsigned data, int cnt, off_t pos)
+{
+	return RPT_SYSCALL(pwrite(fd, dosaddr_to_unixaddr(data), cnt, pos));
+}
+
+int dos_write(int fd, unsigned data, int cnt)
+{
+	return RPT_SYSCALL(write(fd, dosaddr_to_unixaddr(data), cnt));
+}
+
+/* ---- syscall counting, see -Wl,--wrap in the Makefile ---- */
+
+static unsigned long nsys;
+
+ssize_t __real_pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t __wrap_pread(int fd, void *buf, size_t count, off_t offset)
+{
+	nsys++;
+	return __real_pread(fd, buf, count, offset);
+}
+
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __wrap_read(int fd, void *buf, size_t count)
+{
+	nsys++;
+	return __real_read(fd, buf, count);
+}
+
+off_t __real_lseek(int fd, off_t offset, int whence);
+off_t __wrap_lseek(int fd, off_t offset, int whence)
+{
+	nsys++;
+	return __real_lseek(fd, offset, whence);
+}
+
+int __real_flock(int fd, int op);
+int __wrap_flock(int fd, int op)
+{
+	nsys++;
+	return __real_flock(fd, op);
+}
+
+int __real_fcntl(int fd, int cmd, ...);
+int __wrap_fcntl(int fd, int cmd, ...)
+{
+	va_list args;
+	void *arg;
+
+	va_start(args, cmd);
+	arg = va_arg(args, void *);
+	va_end(args);
+	nsys++;
+	return __real_fcntl(fd, cmd, arg);
+}
+
+/* ---- the bench ---- */
+
+enum { PROBE, LEASE, SHARED, OWN_LOCK, BUFFERED, NUM_CASES };
+static const char *case_name[NUM_CASES] = {
+	"probe", "lease", "shared", "own lock", "buffered"
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(int c, const char *path, long reads, int rec)
+{
+	struct file_fd *f = &open_files[0];
+	const char *lease;
+	int other = -1;
+	double t;
+	long i;
+
+	memset(f, 0, sizeof(*f));
+	config.mfs_buffer = (c == BUFFERED ? 64 : 0);
+	f->name = strdup(path);
+	f->type = TYPE_DISK;
+	f->is_writable = (c != PROBE);
+	f->share_mode = DENY_NONE;
+	f->fd = open(path, f->is_writable ? O_RDWR : O_RDONLY);
+	if (f->fd == -1) {
+		perror(path);
+		exit(1);
+	}
+	if (c == SHARED || c == OWN_LOCK)
+		other = open(path, O_RDONLY);
+	lease_init(f);
+	if (c == OWN_LOCK) {
+		lock_file_region(f->fd, 1, 0, FILE_SIZE);
+		own_lock_add(f, 0, FILE_SIZE);
+	}
+
+	nsys = 0;
+	t = now();
+	for (i = 0; i < reads; i++) {
+		uint64_t pos = (i * rec) % (FILE_SIZE - rec + 1);
+		int locked, cnt, ret;
+
+		cnt = region_lock(f, pos, rec, &locked);
+		if (cnt <= 0) {
+			fprintf(stderr, "%s: region locked\n", case_name[c]);
+			exit(1);
+		}
+		ret = buf_pread(f, 0, cnt, pos);
+		region_unlock(f, locked);
+		if (ret != cnt) {
+			fprintf(stderr, "%s: short read\n", case_name[c]);
+			exit(1);
+		}
+	}
+	t = now() - t;
+
+	switch (f->lease) {
+	case LEASE_HELD: lease = "held"; break;
+	case LEASE_NONE: lease = "none"; break;
+	default: lease = "never"; break;
+	}
+	printf("%-9s lease %-5s %5.2f syscalls %7.3f us per read\n",
+	       case_name[c], lease, (double)nsys / reads, t * 1e6 / reads);
+
+	if (f->lease == LEASE_HELD)
+		lease_release(f);
+	free(f->buf);
+	free(f->name);
+	close(f->fd);
+	if (other != -1)
+		close(other);
+}
+
+int main(int argc, char **argv)
+{
+	long reads = (argc > 1 ? atol(argv[1]) : 1000000);
+	int rec = (argc > 2 ? atoi(argv[2]) : 512);
+	const char *dir = (argc > 3 ? argv[3] : "/tmp");
+	char path[PATH_MAX];
+	static char blk[4096];
+	int c, fd, i;
+
+	if (reads <= 0 || rec <= 0 || rec > 0x8000) {
+		fprintf(stderr, "usage: %s [reads] [record size] [dir]\n",
+			argv[0]);
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s/mfs-io-bench.XXXXXX", dir);
+	fd = mkstemp(path);
+	if (fd == -1) {
+		perror(path);
+		return 1;
+	}
+	for (i = 0; i < FILE_SIZE / sizeof(blk); i++)
+		write(fd, blk, sizeof(blk));
+	close(fd);
+
+	printf("%ld reads of %d bytes\n", reads, rec);
+	for (c = 0; c < NUM_CASES; c++)
+		run(c, path, reads, rec);
+	unlink(path);
+	return 0;
+}
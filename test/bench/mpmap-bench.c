@@ -0,0 +1,290 @@
+/*
+ * Microbenchmark for the simx86 code page map: times e_querymark() and
+ * e_querymprotrange() from src/base/emu-i386/simx86/memory.c, which
+ * is built into the bench as it is, with code marks and protected
+ * pages spread over the address range as in big DPMI apps. The marks
+ * are checked against a plain bitmap. The same queries are timed on a
+ * copy of the linked list of 1M chunks that memory.c used before the
+ * table, as a baseline. The few emulator functions memory.c calls are
+ * stubbed below.
+ *
+ * Needs a configured tree (src/include/config.hh).
+ *
+ * Usage: mpmap-bench [megabytes] [queries]
+ */
+#include "emu.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mapping.h"
+#include "emudpmi.h"
+#include "emu86.h"
+#include "trees.h"
+#include "codegen.h"
+
+/* ---- what memory.c needs from the rest of dosemu ---- */
+
+unsigned char debug_levels[DEBUG_CLASSES];
+union _SynCPU TheCPU_union;
+unsigned char *mem_base;
+volatile __thread int fault_cnt;
+volatile int in_vm86;
+union vm86_union vm86u;
+volatile int InCompiledCode;
+
+int log_printf(int flg, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+	return 0;
+}
+
+void error(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+}
+
+int mprotect_mapping(int cap, dosaddr_t targ, size_t mapsize, int protect)
+{
+	return 0;
+}
+
+void *dosaddr_to_unixaddr(dosaddr_t addr)
+{
+	return mem_base + addr;
+}
+
+int InvalidateNodeRange(int addr, int len, unsigned char *eip)
+{
+	return 0;
+}
+
+int Cpatch(sigcontext_t *scp)
+{
+	return 0;
+}
+
+int DPMIValidSelector(unsigned short selector)
+{
+	return 0;
+}
+
+unsigned int GetSegmentBase(unsigned short selector)
+{
+	return 0;
+}
+
+int dpmi_read_access(dosaddr_t addr)
+{
+	return 0;
+}
+
+/* ---- baseline: the old list of 1M chunks with a one-entry cache ---- */
+
+typedef struct _listmap {
+	struct _listmap *next;
+	int mega;
+	unsigned char pagemap[32];
+	uint64_t subpage[0x100000/64];
+} tListMap;
+
+static tListMap *ListH, *LastList;
+
+static inline tListMap *list_find(unsigned int addr)
+{
+	int a2l = addr >> (PAGE_SHIFT+8);
+	tListMap *M = LastList;
+
+	if (M && (M->mega==a2l)) return M;
+	M = ListH;
+	while (M) {
+		if (M->mega==a2l) {
+		    LastList = M; break;
+		}
+		M = M->next;
+	}
+	return M;
+}
+
+/* The old code only marked in chunks made by e_mprotect(), here the
+   chunk is added on the first mark too so both maps hold the same marks.
+   It also went on to M->next at a megabyte boundary, which is not the
+   next megabyte; that is looked up here, as the table does, so both
+   return the same answers. */
+static tListMap *list_add(unsigned int addr)
+{
+	tListMap *M = list_find(addr);
+
+	if (M == NULL) {
+		M = calloc(1, sizeof(*M));
+		M->next = ListH; ListH = M;
+		M->mega = addr >> 20;
+	}
+	return M;
+}
+
+static void list_markpage(unsigned int addr)
+{
+	tListMap *M = list_add(addr);
+
+	set_bit(addr & 0xfffff, M->subpage);
+}
+
+static void list_mprotect(unsigned int addr)
+{
+	tListMap *M = list_add(addr);
+
+	set_bit((addr >> PAGE_SHIFT) & 255, M->pagemap);
+}
+
+static int list_querymark(unsigned int addr, size_t len)
+{
+	unsigned int abeg, aend, idx;
+	tListMap *M = list_find(addr);
+	uint64_t mask;
+
+	if (M == NULL) return 0;
+
+	abeg = addr;
+	aend = addr + len;
+	if (len == 1)
+		return test_bit(abeg & 0xfffff, M->subpage) != 0;
+
+	idx = (abeg & 0xfffff) / 64;
+	mask = ~0ULL << (abeg & 63);
+	while (abeg < (aend & ~63)) {
+		if (M->subpage[idx] & mask)
+			return 1;
+		abeg = (abeg + 64) & ~63;
+		idx++;
+		mask = ~0ULL;
+		if (idx == sizeof(M->subpage)/sizeof(M->subpage[0])) {
+			M = list_find(abeg);
+			if (M == NULL) return 0;
+			idx = 0;
+		}
+	}
+	if (aend & 63) {
+		mask &= ~0ULL >> (64 - (aend & 63));
+		if (M->subpage[idx] & mask)
+			return 1;
+	}
+	return 0;
+}
+
+static int list_querymprotrange(unsigned int addr, size_t len)
+{
+	int a2l, a2h;
+	tListMap *M = list_find(addr);
+
+	a2l = addr >> PAGE_SHIFT;
+	a2h = (addr+len-1) >> PAGE_SHIFT;
+
+	while (M && a2l <= a2h) {
+		if (test_bit(a2l&255, M->pagemap))
+			return 1;
+		a2l++;
+		if ((a2l&255)==0)
+			M = list_find(a2l << PAGE_SHIFT);
+	}
+	return 0;
+}
+
+/* ---- driver ---- */
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	int megas = argc > 1 ? atoi(argv[1]) : 64;
+	long queries = argc > 2 ? atol(argv[2]) : 50000000;
+	unsigned int *addrs, a;
+	uint64_t *ref;
+	int i, nq = 1 << 20;
+	long n;
+	unsigned sum1 = 0, sum2 = 0, sum3 = 0;
+	unsigned lsum1 = 0, lsum2 = 0, lsum3 = 0;
+	double t0, t1, t2, t3, l0, l1, l2, l3;
+
+	mprot_init();
+	ref = calloc((size_t)megas << 14, sizeof(*ref));
+	for (a = 0; a < (unsigned)megas << 20; a += 977) {
+		/* sprinkle some code marks */
+		e_markpage(a, 1);
+		list_markpage(a);
+		ref[a >> 6] |= 1ULL << (a & 63);
+		/* and protect every 8th page that has code */
+		if (((a >> PAGE_SHIFT) & 7) == 0) {
+			e_mprotect(a, 1);
+			list_mprotect(a);
+		}
+	}
+
+	addrs = malloc(nq * sizeof(*addrs));
+	srand(1);
+	for (i = 0; i < nq; i++)
+		addrs[i] = ((unsigned)rand() << 1 ^ rand()) % (megas << 20);
+	for (i = 0; i < nq; i++) {
+		a = addrs[i];
+		if (e_querymark(a, 1) != ((ref[a >> 6] >> (a & 63)) & 1) ||
+		    list_querymark(a, 1) != e_querymark(a, 1) ||
+		    list_querymark(a, 256) != e_querymark(a, 256) ||
+		    list_querymprotrange(a, 2 * PAGE_SIZE) !=
+		    e_querymprotrange(a, 2 * PAGE_SIZE)) {
+			fprintf(stderr, "mismatch at %08x\n", a);
+			return 1;
+		}
+	}
+
+	t0 = now();
+	for (n = 0; n < queries; n++)
+		sum1 += e_querymark(addrs[n & (nq - 1)], 1);
+	t1 = now();
+	for (n = 0; n < queries; n++)
+		sum2 += e_querymark(addrs[n & (nq - 1)], 256);
+	t2 = now();
+	for (n = 0; n < queries; n++)
+		sum3 += e_querymprotrange(addrs[n & (nq - 1)], 2 * PAGE_SIZE);
+	t3 = now();
+
+	l0 = now();
+	for (n = 0; n < queries; n++)
+		lsum1 += list_querymark(addrs[n & (nq - 1)], 1);
+	l1 = now();
+	for (n = 0; n < queries; n++)
+		lsum2 += list_querymark(addrs[n & (nq - 1)], 256);
+	l2 = now();
+	for (n = 0; n < queries; n++)
+		lsum3 += list_querymprotrange(addrs[n & (nq - 1)], 2 * PAGE_SIZE);
+	l3 = now();
+	if (lsum1 != sum1 || lsum2 != sum2 || lsum3 != sum3) {
+		fprintf(stderr, "baseline hits differ\n");
+		return 1;
+	}
+
+	printf("%d MB, %ld queries (%u/%u/%u hits)\n", megas, queries,
+	       sum1, sum2, sum3);
+	printf("                        table      list  (ns/query)\n");
+	printf("querymark 1:         %8.2f  %8.2f\n",
+	       (t1 - t0) * 1e9 / queries, (l1 - l0) * 1e9 / queries);
+	printf("querymark 256:       %8.2f  %8.2f\n",
+	       (t2 - t1) * 1e9 / queries, (l2 - l1) * 1e9 / queries);
+	printf("querymprotrange 8K:  %8.2f  %8.2f\n",
+	       (t3 - t2) * 1e9 / queries, (l3 - l2) * 1e9 / queries);
+	return 0;
+}
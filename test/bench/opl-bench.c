@@ -0,0 +1,234 @@
+/*
+ * Benchmark for the OPL2/OPL3 synth (src/base/dev/sb16/opl.c): renders
+ * a register log through opl_write()/opl_getsample() in the same chunk
+ * sizes the adlib synth thread uses, and prints the speed and a
+ * checksum of the output, so that two synth versions can be compared
+ * for both speed and bit-exactness.
+ *
+ * The log is either a DOSBox raw OPL v2 file (.dro), as written by
+ * dosemu with $_opl_file or by DOSBox, or generated here: a made-up tune
+ * that keeps all 18 OPL3 channels busy with 2-op and 4-op voices, all
+ * waveforms, vibrato, tremolo and feedback, followed by a part in OPL2
+ * rhythm mode.
+ *
+ * Usage: opl-bench [seconds | file.dro] [runs]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "types.h"
+#include "opl.h"
+
+#define RATE		44100
+#define CHUNK		512	/* OPL3_MAX_BUF in adlib.c */
+
+struct opl_event {
+	unsigned delay;		/* samples to render before the write */
+	unsigned short reg;
+	unsigned char val;
+};
+
+static struct opl_event *ev;
+static int ev_num, ev_max;
+static unsigned ev_delay;	/* also the tail after the last write */
+
+static void emit(unsigned reg, unsigned val)
+{
+	if (ev_num == ev_max) {
+		ev_max = ev_max ? ev_max * 2 : 1024;
+		ev = realloc(ev, ev_max * sizeof(*ev));
+	}
+	ev[ev_num].delay = ev_delay;
+	ev[ev_num].reg = reg;
+	ev[ev_num].val = val;
+	ev_num++;
+	ev_delay = 0;
+}
+
+static void wait_ms(unsigned ms)
+{
+	ev_delay += RATE * ms / 1000;
+}
+
+/* register offset of the modulator of channel 0..8 in a set */
+static const unsigned char mod_off[9] = { 0, 1, 2, 8, 9, 10, 16, 17, 18 };
+
+static void instrument(unsigned set, int ch, unsigned seed)
+{
+	unsigned base = set + mod_off[ch];
+	int o;
+
+	for (o = 0; o < 2; o++) {
+		unsigned r = base + o * 3;
+		seed = seed * 1103515245 + 12345;
+		emit(0x20 + r, (seed >> 8) & 0xff);	/* am, vib, egt, ksr, mult */
+		emit(0x40 + r, o ? (seed >> 16) & 0xc7 : (seed >> 16) & 0xdf);
+		emit(0x60 + r, ((seed >> 4) & 0xff) | 0x20);	/* ar/dr */
+		emit(0x80 + r, (seed >> 12) & 0xff);	/* sl/rr */
+		emit(0xe0 + r, (seed >> 20) & 7);	/* waveform */
+	}
+	emit(0xc0 + set + ch, 0x30 | ((seed >> 24) & 0x0f));	/* pan, fb, cnt */
+}
+
+static void note(unsigned set, int ch, unsigned fnum, unsigned block, int on)
+{
+	emit(0xa0 + set + ch, fnum & 0xff);
+	emit(0xb0 + set + ch, (on ? 0x20 : 0) | (block << 2) | (fnum >> 8));
+}
+
+static void make_log(int seconds)
+{
+	unsigned seed = 1;
+	int t, ch, steps = seconds * 10;
+
+	emit(0x105, 1);			/* OPL3 mode */
+	emit(0x104, 0x09);		/* channels 0 and 9 in 4-op mode */
+	emit(0x01, 0x20);		/* waveform select */
+	emit(0xbd, 0xc0);		/* deep vibrato and tremolo */
+	for (ch = 0; ch < 9; ch++) {
+		instrument(0, ch, ch * 7 + 1);
+		instrument(0x100, ch, ch * 13 + 5);
+	}
+
+	/* OPL3 part: a new chord every 100ms */
+	for (t = 0; t < steps * 3 / 4; t++) {
+		for (ch = 0; ch < 18; ch++) {
+			unsigned set = ch < 9 ? 0 : 0x100;
+			seed = seed * 1103515245 + 12345;
+			if ((seed >> 16) % 3 == 0)
+				continue;
+			note(set, ch % 9, 0x100 + (seed >> 8) % 0x200,
+			     2 + (seed >> 20) % 4, (seed >> 24) & 3);
+		}
+		if (t % 20 == 19)
+			instrument(t & 1 ? 0x100 : 0, t / 20 % 9, seed);
+		wait_ms(100);
+	}
+
+	/* OPL2 rhythm part */
+	emit(0x105, 0);
+	for (; t < steps; t++) {
+		for (ch = 0; ch < 6; ch++) {
+			seed = seed * 1103515245 + 12345;
+			note(0, ch, 0x100 + (seed >> 8) % 0x200,
+			     3 + (seed >> 20) % 3, (seed >> 24) & 1);
+		}
+		note(0, 6, 0x150, 2, 0);
+		note(0, 7, 0x1c0, 2, 0);
+		note(0, 8, 0x120, 3, 0);
+		emit(0xbd, 0xe0 | (1 << (t % 5)) | ((t & 1) << 4));
+		wait_ms(100);
+	}
+	wait_ms(1000);
+	emit(0xbd, 0);
+}
+
+static int load_dro(const char *name)
+{
+	unsigned char h[26], map[128], pair[2];
+	unsigned pairs, n, maplen, smp, pos = 0;
+	unsigned long long ms = 0;
+	FILE *f = fopen(name, "rb");
+
+	if (!f) {
+		perror(name);
+		return -1;
+	}
+	if (fread(h, sizeof(h), 1, f) != 1 || memcmp(h, "DBRAWOPL", 8) ||
+	    h[8] != 2 || h[9] || h[21] || h[22] ||
+	    (maplen = h[25]) > sizeof(map) ||
+	    fread(map, maplen, 1, f) != 1) {
+		fprintf(stderr, "%s: not a DRO v2 file\n", name);
+		fclose(f);
+		return -1;
+	}
+	pairs = h[12] | h[13] << 8 | h[14] << 16 | (unsigned)h[15] << 24;
+	for (n = 0; n < pairs && fread(pair, 2, 1, f) == 1; n++) {
+		if (pair[0] == h[23]) {
+			ms += pair[1] + 1;
+		} else if (pair[0] == h[24]) {
+			ms += (pair[1] + 1) << 8;
+		} else if ((pair[0] & 0x7f) < maplen) {
+			smp = ms * RATE / 1000;
+			ev_delay += smp - pos;
+			pos = smp;
+			emit(map[pair[0] & 0x7f] | (pair[0] & 0x80 ? 0x100 : 0),
+			     pair[1]);
+		}
+	}
+	fclose(f);
+	ev_delay += ms * RATE / 1000 - pos;
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned sum;
+static long long nsamp;
+
+static double render_samples(unsigned left)
+{
+	static Bit16s buf[CHUNK * 2];
+	double t0, t = 0;
+	int i;
+
+	while (left) {
+		unsigned n = left > CHUNK ? CHUNK : left;
+		t0 = now();
+		opl_getsample(buf, n);
+		t += now() - t0;
+		for (i = 0; i < n * 2; i++)
+			sum = (sum ^ (Bit16u)buf[i]) * 16777619u;
+		nsamp += n;
+		left -= n;
+	}
+	return t;
+}
+
+static double render(void)
+{
+	double t = 0;
+	int e;
+
+	sum = 2166136261u;
+	nsamp = 0;
+	srand(1);			/* rhythm mode noise uses rand() */
+	opl_init(RATE);
+	for (e = 0; e < ev_num; e++) {
+		t += render_samples(ev[e].delay);
+		opl_write(ev[e].reg, ev[e].val);
+	}
+	return t + render_samples(ev_delay);
+}
+
+int main(int argc, char **argv)
+{
+	const char *arg = argc > 1 ? argv[1] : "60";
+	int runs = argc > 2 ? atoi(argv[2]) : 3;
+	double t, best = 0;
+	int r;
+
+	if (strstr(arg, ".dro") || strstr(arg, ".DRO")) {
+		if (load_dro(arg))
+			return 1;
+	} else {
+		make_log(atoi(arg));
+	}
+	for (r = 0; r < runs; r++) {
+		t = render();
+		if (!r || t < best)
+			best = t;
+	}
+	printf("%d register writes, %lld samples, checksum %08x\n",
+	       ev_num, nsamp, sum);
+	printf("%.1f ms, %.2f Msamples/s, %.0fx realtime\n", best * 1e3,
+	       nsamp / best / 1e6, nsamp / best / RATE);
+	return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * Microbenchmark for the 8 -> 32 bit remap functions: runs the generic
+ * gen_8to32_all() from src/base/video/remap.c and the one remap_simd()
+ * in remap_simd.c selects for this CPU (SSE2 or AVX2) on the same
+ * image, for 1x, 2x and 3x scaling, and checks that they produce the
+ * same result. Both files are built into the bench as they are; the
+ * few emulator functions they need are stubbed below.
+ *
+ * Needs a configured tree (src/include/config.hh).
+ *
+ * Usage: remap-bench [width] [height] [frames]
+ */
+#include "emu.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vgaemu.h"
+#include "render.h"
+#include "remap_priv.h"
+#include "render_priv.h"
+
+void gen_8to32_all(RemapObject *);
+
+/* ---- what remap.c and remap_simd.c need from the rest of dosemu ---- */
+
+unsigned char debug_levels[DEBUG_CLASSES];
+
+int log_printf(int flg, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+	return 0;
+}
+
+void error(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+}
+
+void dirty_all_vga_colors(void)
+{
+}
+
+int find_supported_modes(unsigned dst_mode)
+{
+	return 0;
+}
+
+int register_remapper(struct remap_calls *calls, int prio)
+{
+	return 0;
+}
+
+/* ---- driver ---- */
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(void (*fn)(RemapObject *), RemapObject *ro, int frames)
+{
+	double t0 = now();
+	int f;
+
+	for (f = 0; f < frames; f++)
+		fn(ro);
+	return now() - t0;
+}
+
+int main(int argc, char **argv)
+{
+	int w = argc > 1 ? atoi(argv[1]) : 320;
+	int h = argc > 2 ? atoi(argv[2]) : 200;
+	int frames = argc > 3 ? atoi(argv[3]) : 1000;
+	RemapFuncDesc *rfd;
+	void (*simd)(RemapObject *) = NULL;
+	int scale, i, err = 0;
+	unsigned char *src;
+	unsigned *ref, *dst, lut[256];
+	RemapObject ro;
+
+	debug_levels['v'] = 1;
+	for (rfd = remap_simd(); rfd; rfd = rfd->next) {
+		if (strcmp(rfd->func_name, "simd_8to32_all") == 0)
+			simd = rfd->func;
+	}
+	if (!simd) {
+		printf("no SIMD remap function for this CPU\n");
+		return 1;
+	}
+
+	src = malloc((size_t)w * h);
+	ref = malloc((size_t)w * h * 9 * sizeof(*ref));
+	dst = malloc((size_t)w * h * 9 * sizeof(*dst));
+	srand(1);
+	for (i = 0; i < w * h; i++) src[i] = rand();
+	for (i = 0; i < 256; i++) lut[i] = rand();
+
+	memset(&ro, 0, sizeof(ro));
+	ro.src_image = src;
+	ro.src_width = ro.src_scan_len = w;
+	ro.src_height = h;
+	ro.true_color_lut = lut;
+	ro.bre_x = malloc(w * 3 * sizeof(*ro.bre_x));
+	ro.bre_y = malloc(h * 3 * sizeof(*ro.bre_y));
+
+	printf("%dx%d, %d frames, ms/frame\n", w, h, frames);
+	printf("scale   generic      simd\n");
+	for (scale = 1; scale <= 3; scale++) {
+		size_t n = (size_t)w * h * scale * scale;
+		double tg, ts;
+
+		ro.dst_width = w * scale;
+		ro.dst_height = ro.dst_y1 = h * scale;
+		ro.dst_scan_len = ro.dst_width * 4;
+		for (i = 0; i < w * scale; i++)
+			ro.bre_x[i] = i % scale == scale - 1;
+		for (i = 0; i < h * scale; i++)
+			ro.bre_y[i] = i / scale * w;
+
+		ro.dst_image = (unsigned char *)ref;
+		tg = run(gen_8to32_all, &ro, frames);
+		memset(dst, 0, n * sizeof(*dst));
+		ro.dst_image = (unsigned char *)dst;
+		ts = run(simd, &ro, frames);
+		if (memcmp(ref, dst, n * sizeof(*dst))) {
+			printf("%dx: mismatch\n", scale);
+			err = 1;
+		}
+		printf("%4dx  %8.4f  %8.4f\n", scale,
+		       tg * 1e3 / frames, ts * 1e3 / frames);
+	}
+	return err;
+}
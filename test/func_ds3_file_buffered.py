@@ -0,0 +1,135 @@
+def ds3_file_buffered(self, fstype):
+    testdir = self.mkworkdir('d')
+
+    self.mkfile("testit.bat", """\
+d:
+c:\\filebufd
+rem end
+""", newline="\r\n")
+
+# compile sources
+    self.mkexe_with_djgpp("filebufd", r"""
+
+#include <dos.h>
+#include <fcntl.h>
+#include <io.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FNAME "FOO.DAT"
+#define FDATA "0123456789abcdefghij"
+
+int main(int argc, char *argv[]) {
+  int hnd1, hnd2;
+  int ret, rc, i;
+  unsigned int fdate, ftime, today;
+  struct dosdate_t d;
+  struct find_t ff;
+  char buf[80];
+
+  if (_dos_creatnew(FNAME, 0, &hnd1) != 0) {
+    printf("FAIL: File '%s' not created\n", FNAME);
+    return -1;
+  }
+  _dos_close(hnd1);
+
+  ret = _dos_open(FNAME, O_RDWR, &hnd1);
+  if (ret != 0) {
+    printf("FAIL: File '%s' not opened(%d)\n", FNAME, ret);
+    return -1;
+  }
+  // small writes that stay in the buffer
+  for (i = 0; i < strlen(FDATA); i += 5) {
+    ret = _dos_write(hnd1, FDATA + i, 5, &rc);
+    if (ret != 0 || rc != 5) {
+      printf("FAIL: Write at %d failed(%d), cnt=%d\n", i, ret, rc);
+      _dos_close(hnd1);
+      return -1;
+    }
+  }
+
+  _dos_getdate(&d);
+  today = ((d.year - 1980) << 9) | (d.month << 5) | d.day;
+  if (_dos_getftime(hnd1, &fdate, &ftime) != 0 || fdate != today) {
+    printf("FAIL: File date 0x%04x is not today 0x%04x\n", fdate, today);
+    _dos_close(hnd1);
+    return -1;
+  }
+  printf("OKAY: File date is today\n");
+
+  if (llseek(hnd1, 0, SEEK_END) != strlen(FDATA) ||
+      llseek(hnd1, -4, SEEK_END) != strlen(FDATA) - 4) {
+    printf("FAIL: Seek from end does not see the written data\n");
+    _dos_close(hnd1);
+    return -1;
+  }
+  printf("OKAY: Seek from end\n");
+
+  if (_dos_findfirst(FNAME, _A_NORMAL | _A_ARCH, &ff) != 0 ||
+      ff.size != strlen(FDATA)) {
+    printf("FAIL: Findfirst size %ld != %d\n", ff.size, strlen(FDATA));
+    _dos_close(hnd1);
+    return -1;
+  }
+  printf("OKAY: Findfirst size\n");
+
+  ret = _dos_open(FNAME, O_RDONLY, &hnd2);
+  if (ret != 0) {
+    printf("FAIL: File '%s' not opened again(%d)\n", FNAME, ret);
+    _dos_close(hnd1);
+    return -1;
+  }
+  memset(buf, 0, sizeof(buf));
+  ret = _dos_read(hnd2, buf, sizeof(buf), &rc);
+  if (ret != 0 || rc != strlen(FDATA) || strcmp(buf, FDATA) != 0) {
+    printf("FAIL: Second handle read '%s'(%d), cnt=%d\n", buf, ret, rc);
+    _dos_close(hnd2);
+    _dos_close(hnd1);
+    return -1;
+  }
+  printf("OKAY: Second handle read the data\n");
+
+  // and with the second handle open
+  llseek(hnd1, 0, SEEK_END);
+  ret = _dos_write(hnd1, "XYZ", 3, &rc);
+  if (ret != 0 || rc != 3) {
+    printf("FAIL: Write with second handle open failed(%d), cnt=%d\n", ret, rc);
+    _dos_close(hnd2);
+    _dos_close(hnd1);
+    return -1;
+  }
+  memset(buf, 0, sizeof(buf));
+  ret = _dos_read(hnd2, buf, sizeof(buf), &rc);
+  if (ret != 0 || rc != 3 || strcmp(buf, "XYZ") != 0) {
+    printf("FAIL: Second handle read '%s'(%d), cnt=%d\n", buf, ret, rc);
+    _dos_close(hnd2);
+    _dos_close(hnd1);
+    return -1;
+  }
+
+  _dos_close(hnd2);
+  _dos_close(hnd1);
+
+  printf("PASS: all tests okay on file '%s'\n", FNAME);
+  return 0;
+}
+""")
+
+    if fstype == "MFS":
+        config = """\
+$_hdimage = "dXXXXs/c:hdtype1 dXXXXs/d:hdtype1 +1"
+$_floppy_a = ""
+$_mfs_buffer = (64)
+"""
+    else:       # FAT
+        name = self.mkimage("12", cwd=testdir)
+        config = """\
+$_hdimage = "dXXXXs/c:hdtype1 %s +1"
+$_floppy_a = ""
+""" % name
+
+    results = self.runDosemu("testit.bat", config=config)
+
+    self.assertNotIn("FAIL:", results)
+    self.assertIn("PASS:", results)
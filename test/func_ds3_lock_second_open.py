@@ -0,0 +1,137 @@
+from os import link
+
+
+def ds3_lock_second_open(self, how):
+    testdir = self.mkworkdir('d')
+
+    # The first handle is alone on the file and skips the lock probe,
+    # so a lock set through the second one must still be seen by it.
+    # Opening it again must not wait for the first handle's lease.
+    fname = "FOO.DAT"
+    self.mkfile(fname, "0123456789abcdef", dname=testdir)
+    if how == "NAME":
+        fname2 = fname
+    else:       # LINK
+        fname2 = "BAR.DAT"
+        link(testdir / fname, testdir / fname2)
+
+    self.mkfile("testit.bat", """\
+d:
+%s
+c:\\lcksecnd %s %s
+rem end
+""" % ("rem Internal share" if self.version == "FDPP kernel" else "c:\\share",
+       fname, fname2), newline="\r\n")
+
+# compile sources
+    self.mkexe_with_djgpp("lcksecnd", r"""
+
+#include <dos.h>
+#include <fcntl.h>
+#include <io.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+  int hnd1, hnd2;
+  int ret, rc;
+  char buf[80];
+
+  if (argc < 3) {
+    printf("FAIL: missing arguments\n");
+    return -1;
+  }
+
+  ret = _dos_open(argv[1], O_RDWR, &hnd1);
+  if (ret != 0) {
+    printf("FAIL: File '%s' not opened(%d)\n", argv[1], ret);
+    return -1;
+  }
+  // a few reads and writes while nobody else has the file open
+  ret = _dos_read(hnd1, buf, 16, &rc);
+  if (ret != 0 || rc != 16 || memcmp(buf, "0123456789abcdef", 16) != 0) {
+    printf("FAIL: First read failed(%d), cnt=%d\n", ret, rc);
+    _dos_close(hnd1);
+    return -1;
+  }
+  llseek(hnd1, 0, SEEK_SET);
+  ret = _dos_write(hnd1, "ABC", 3, &rc);
+  if (ret != 0 || rc != 3) {
+    printf("FAIL: First write failed(%d), cnt=%d\n", ret, rc);
+    _dos_close(hnd1);
+    return -1;
+  }
+  printf("OKAY: First handle read and written\n");
+
+  ret = _dos_open(argv[2], O_RDWR, &hnd2);
+  if (ret != 0) {
+    printf("FAIL: File '%s' not opened(%d)\n", argv[2], ret);
+    _dos_close(hnd1);
+    return -1;
+  }
+  if (_dos_lock(hnd2, 5, 3) != 0) {
+    printf("FAIL: Could not get lock on file '%s'\n", argv[2]);
+    _dos_close(hnd2);
+    _dos_close(hnd1);
+    return -1;
+  }
+  printf("OKAY: Acquired lock on second handle\n");
+
+  llseek(hnd1, 5, SEEK_SET);
+  ret = _dos_read(hnd1, buf, 3, &rc);
+  if (ret != 33) {
+    printf("FAIL: Read of locked region via first handle (err=%d != 33), cnt=%d\n", ret, rc);
+    _dos_unlock(hnd2, 5, 3);
+    _dos_close(hnd2);
+    _dos_close(hnd1);
+    return -1;
+  }
+  llseek(hnd1, 4, SEEK_SET);
+  ret = _dos_write(hnd1, "xyz", 3, &rc);
+  if (ret != 33) {
+    printf("FAIL: Write of locked region via first handle (err=%d != 33), cnt=%d\n", ret, rc);
+    _dos_unlock(hnd2, 5, 3);
+    _dos_close(hnd2);
+    _dos_close(hnd1);
+    return -1;
+  }
+  printf("OKAY: First handle refused locked region\n");
+
+  // the data written before the second open must be there
+  llseek(hnd2, 0, SEEK_SET);
+  ret = _dos_read(hnd2, buf, 5, &rc);
+  if (ret != 0 || rc != 5 || memcmp(buf, "ABC34", 5) != 0) {
+    printf("FAIL: Read via second handle failed(%d), cnt=%d\n", ret, rc);
+    _dos_unlock(hnd2, 5, 3);
+    _dos_close(hnd2);
+    _dos_close(hnd1);
+    return -1;
+  }
+
+  _dos_unlock(hnd2, 5, 3);
+  _dos_close(hnd2);
+
+  llseek(hnd1, 5, SEEK_SET);
+  ret = _dos_read(hnd1, buf, 3, &rc);
+  if (ret != 0 || rc != 3 || memcmp(buf, "567", 3) != 0) {
+    printf("FAIL: Read via first handle after unlock failed(%d), cnt=%d\n", ret, rc);
+    _dos_close(hnd1);
+    return -1;
+  }
+  _dos_close(hnd1);
+
+  printf("PASS: all tests okay on file '%s'\n", argv[1]);
+  return 0;
+}
+""")
+
+    config = """\
+$_hdimage = "dXXXXs/c:hdtype1 dXXXXs/d:hdtype1 +1"
+$_floppy_a = ""
+"""
+
+    results = self.runDosemu("testit.bat", config=config)
+
+    self.assertNotIn("FAIL:", results)
+    self.assertIn("PASS:", results)
@@ -0,0 +1,124 @@
+def mfs_dircache(self):
+    testdir = self.mkworkdir('d')
+
+    # host names the DOS side only finds case-insensitively or mangled
+    self.mkfile("MixCase.Dat", "mixed", dname=testdir)
+    self.mkfile("Long File Name.txt", "long", dname=testdir)
+
+    self.mkfile("testit.bat", """\
+set LFN=n
+d:
+c:\\mfscache
+rem end
+""", newline="\r\n")
+
+# compile sources
+    self.mkexe_with_djgpp("mfscache", r"""
+
+#include <dos.h>
+#include <fcntl.h>
+#include <io.h>
+#include <stdio.h>
+#include <string.h>
+
+static int check_file(const char *name, const char *data) {
+  int hnd, ret, rc;
+  char buf[80];
+
+  ret = _dos_open(name, O_RDONLY, &hnd);
+  if (ret != 0) {
+    printf("FAIL: File '%s' not opened(%d)\n", name, ret);
+    return -1;
+  }
+  memset(buf, 0, sizeof(buf));
+  ret = _dos_read(hnd, buf, sizeof(buf) - 1, &rc);
+  _dos_close(hnd);
+  if (ret != 0 || strcmp(buf, data) != 0) {
+    printf("FAIL: File '%s' read '%s' != '%s'(%d)\n", name, buf, data, ret);
+    return -1;
+  }
+  printf("OKAY: File '%s' read\n", name);
+  return 0;
+}
+
+static int check_gone(const char *name) {
+  int hnd;
+
+  if (_dos_open(name, O_RDONLY, &hnd) == 0) {
+    printf("FAIL: File '%s' still opens\n", name);
+    _dos_close(hnd);
+    return -1;
+  }
+  printf("OKAY: File '%s' is gone\n", name);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  struct find_t ff;
+  char mangled[13];
+  int hnd, cnt = 0;
+
+  // list the directory first so that the lookups below are cached
+  if (_dos_findfirst("*.*", _A_NORMAL | _A_ARCH, &ff) == 0) {
+    do {
+      cnt++;
+    } while (_dos_findnext(&ff) == 0);
+  }
+  if (cnt < 2) {
+    printf("FAIL: Found only %d files\n", cnt);
+    return -1;
+  }
+  if (_dos_findfirst("*.TXT", _A_NORMAL | _A_ARCH, &ff) != 0) {
+    printf("FAIL: Long name not found\n");
+    return -1;
+  }
+  strcpy(mangled, ff.name);
+  printf("OKAY: Long name is '%s'\n", mangled);
+
+  if (check_file("mixcase.dat", "mixed") || check_file(mangled, "long"))
+    return -1;
+
+  // renames in the listed directory
+  if (rename("MIXCASE.DAT", "renamed.dat") != 0) {
+    printf("FAIL: Rename of 'MIXCASE.DAT' failed\n");
+    return -1;
+  }
+  if (check_file("RENAMED.DAT", "mixed") || check_gone("MIXCASE.DAT"))
+    return -1;
+  if (rename(mangled, "SHORT.TXT") != 0) {
+    printf("FAIL: Rename of '%s' failed\n", mangled);
+    return -1;
+  }
+  if (check_file("short.txt", "long") || check_gone(mangled))
+    return -1;
+
+  // and a new file
+  if (_dos_creatnew("NEW.DAT", 0, &hnd) != 0) {
+    printf("FAIL: File 'NEW.DAT' not created\n");
+    return -1;
+  }
+  _dos_close(hnd);
+  if (_dos_findfirst("new.dat", _A_NORMAL | _A_ARCH, &ff) != 0) {
+    printf("FAIL: File 'NEW.DAT' not found\n");
+    return -1;
+  }
+  if (check_file("New.Dat", ""))
+    return -1;
+
+  printf("PASS: all tests okay\n");
+  return 0;
+}
+""")
+
+    config = """\
+$_hdimage = "dXXXXs/c:hdtype1 dXXXXs/d:hdtype1 +1"
+$_floppy_a = ""
+"""
+
+    results = self.runDosemu("testit.bat", config=config)
+
+    self.assertNotIn("FAIL:", results)
+    self.assertIn("PASS:", results)
+
+    names = sorted(p.name.upper() for p in testdir.iterdir())
+    self.assertEqual(names, ["NEW.DAT", "RENAMED.DAT", "SHORT.TXT"])
@@ -23,10 +23,12 @@ from func_ds2_file_seek_tell import ds2_file_seek_tell
 from func_ds2_file_seek_read import ds2_file_seek_read
 from func_ds2_set_fattrs import ds2_set_fattrs
 from func_ds3_file_access import ds3_file_access
+from func_ds3_file_buffered import ds3_file_buffered
 from func_ds3_lock_concurrent import ds3_lock_concurrent
 from func_ds3_lock_two_handles import ds3_lock_two_handles
 from func_ds3_lock_readlckd import ds3_lock_readlckd
 from func_ds3_lock_readonly import ds3_lock_readonly
+from func_ds3_lock_second_open import ds3_lock_second_open
 from func_ds3_lock_twice import ds3_lock_twice
 from func_ds3_lock_writable import ds3_lock_writable
 from func_ds3_share_open_access import ds3_share_open_access
@@ -34,6 +36,7 @@ from func_ds3_share_open_twice import ds3_share_open_twice
 from func_lfs_file_info import lfs_file_info
 from func_lfs_file_seek_tell import lfs_file_seek_tell
 from func_memory_ems_borland import memory_ems_borland
+from func_mfs_dircache import mfs_dircache
 from func_mfs_findfile import mfs_findfile
 from func_mfs_truename import mfs_truename
 
@@ -3471,6 +3474,10 @@ $_floppy_a = ""
         )
         mfs_findfile(self, "UFS", "SFN", tests)
 
+    def test_mfs_dircache_rename_create(self):
+        """MFS rename and create in a cached directory"""
+        mfs_dircache(self)
+
     def test_mfs_findfile_vfat_linux_mounted_lfn(self):
         """MFS findfile VFAT Linux mounted LFN"""
         tests = (
@@ -4523,6 +4530,14 @@ $_floppy_a = ""
         """MFS DOSv3 file access write device readonly"""
         ds3_file_access(self, "MFSRO", "WRITE")
 
+    def test_mfs_ds3_file_buffered(self):
+        """MFS DOSv3 file buffered write seen by seek, find and second handle"""
+        ds3_file_buffered(self, "MFS")
+
+    def test_fat_ds3_file_buffered(self):
+        """FAT DOSv3 file buffered write seen by seek, find and second handle"""
+        ds3_file_buffered(self, "FAT")
+
     def test_mfs_ds3_lock_readonly(self):
         """MFS DOSv3 lock file readonly"""
         ds3_lock_readonly(self, "MFS")
@@ -4555,6 +4570,14 @@ $_floppy_a = ""
         """FAT DOSv3 lock file lock with two handles"""
         ds3_lock_two_handles(self, "FAT")
 
+    def test_mfs_ds3_lock_second_open(self):
+        """MFS DOSv3 lock file after second open"""
+        ds3_lock_second_open(self, "NAME")
+
+    def test_mfs_ds3_lock_second_open_hardlink(self):
+        """MFS DOSv3 lock file after second open via hard link"""
+        ds3_lock_second_open(self, "LINK")
+
     def test_mfs_ds3_lock_twice(self):
         """MFS DOSv3 lock file twice"""
         ds3_lock_twice(self, "MFS")